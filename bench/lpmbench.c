@@ -0,0 +1,254 @@
+/*
+ *			L P M B E N C H . C
+ *
+ * Time the ASN lookup from every NUMA node of the box, on a copy of the
+ * table placed on every node. The module keeps one copy per node so the
+ * hook only ever reads the local one, this shows what a remote read costs.
+ *
+ * The table is a synthetic BGP-like one, mostly /24s, flattened with
+ * lpm_build of xdp/lpm-build.c, the layout the module looks up. Every copy
+ * is built by a thread pinned to the first CPU of its node, so its pages
+ * are allocated there (first touch). Lookups are dependent on each other,
+ * so the time is the latency of one lookup, not the throughput.
+ *
+ *   lpmbench [-n prefixes] [-r lookups]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "../xdp/lpm-build.h"
+
+#define MAX_NODES 64
+#define NKEYS     (1 << 20)
+
+struct node {
+	int id;
+	int cpu;               /* first CPU of the node */
+	struct lpm *lpm;       /* copy allocated on the node */
+};
+
+static struct node nodes[MAX_NODES];
+static int nnodes;
+
+static struct lpm_prefix *prefixes;
+static size_t nprefixes = 500000;
+static uint32_t *keys;
+static long rounds = 20000000;
+
+/* first CPU of every node with CPUs, a single node 0 without sysfs */
+static void nodes_read(void)
+{
+	char path[64], buf[256];
+	FILE *f;
+	int i;
+
+	for (i = 0; i < MAX_NODES; i++)
+	{
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", i);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+
+		if (fgets(buf, sizeof(buf), f) && buf[0] >= '0' && buf[0] <= '9')
+		{
+			nodes[nnodes].id = i;
+			nodes[nnodes].cpu = atoi(buf);
+			nnodes++;
+		}
+		fclose(f);
+	}
+
+	if (nnodes == 0)
+	{
+		nodes[0].id = 0;
+		nodes[0].cpu = 0;
+		nnodes = 1;
+	}
+}
+
+static void pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/* about the length distribution of a full BGP table */
+static int random_len(void)
+{
+	int r = rand() % 100;
+
+	if (r < 60)
+		return 24;
+	if (r < 70)
+		return 23;
+	if (r < 80)
+		return 22;
+
+	return 8 + rand() % 14;
+}
+
+static uint32_t random32(void)
+{
+	return (uint32_t) rand() << 16 ^ (uint32_t) rand();
+}
+
+static void table_make(void)
+{
+	size_t i;
+
+	prefixes = malloc(nprefixes * sizeof(*prefixes));
+	keys = malloc(NKEYS * sizeof(*keys));
+	if (!prefixes || !keys)
+	{
+		perror("malloc");
+		exit(1);
+	}
+
+	for (i = 0; i < nprefixes; i++)
+	{
+		prefixes[i].addr = random32();
+		prefixes[i].len = random_len();
+		prefixes[i].gw = htonl(random32() | 1);
+		prefixes[i].seq = i;
+	}
+
+	/* half of the destinations inside a prefix of the table */
+	for (i = 0; i < NKEYS; i++)
+	{
+		if (i & 1)
+			keys[i] = htonl(random32());
+		else
+			keys[i] = htonl(prefixes[rand() % nprefixes].addr | (random32() & 0xff));
+	}
+}
+
+static void *node_build(void *arg)
+{
+	struct node *n = arg;
+	struct lpm_prefix *p;
+
+	pin(n->cpu);
+
+	/* lpm_build sorts its input, every copy works on its own */
+	p = malloc(nprefixes * sizeof(*p));
+	if (!p)
+		return NULL;
+
+	memcpy(p, prefixes, nprefixes * sizeof(*p));
+	n->lpm = lpm_build(p, nprefixes);
+	free(p);
+
+	return NULL;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct run {
+	struct node *reader;
+	const struct lpm *lpm;
+	double ns;
+};
+
+static void *node_lookup(void *arg)
+{
+	struct run *r = arg;
+	volatile uint32_t sink;
+	uint32_t gw = 0;
+	uint64_t start;
+	long i;
+
+	pin(r->reader->cpu);
+
+	start = now_ns();
+
+	for (i = 0; i < rounds; i++)
+		gw = lpm_lookup(r->lpm, keys[(i + (gw & 1)) & (NKEYS - 1)]);
+
+	r->ns = (double) (now_ns() - start) / rounds;
+	sink = gw;
+	(void) sink;
+
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	pthread_t t;
+	struct run r;
+	int opt, i, j;
+
+	while ((opt = getopt(argc, argv, "n:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			nprefixes = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = strtol(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: lpmbench [-n prefixes] [-r lookups]\n");
+			return 1;
+		}
+	}
+
+	if (nprefixes == 0 || rounds <= 0)
+	{
+		fprintf(stderr, "lpmbench: need at least one prefix and one lookup\n");
+		return 1;
+	}
+
+	srand(1);
+	nodes_read();
+	table_make();
+
+	for (i = 0; i < nnodes; i++)
+	{
+		pthread_create(&t, NULL, node_build, &nodes[i]);
+		pthread_join(t, NULL);
+		if (!nodes[i].lpm)
+		{
+			fprintf(stderr, "lpmbench: out of memory\n");
+			return 1;
+		}
+	}
+
+	printf("%zu prefixes, %zu ranges (%zu KB), %d node(s)\n", nprefixes, nodes[0].lpm->n,
+	       nodes[0].lpm->n * sizeof(struct lpm_range) / 1024, nnodes);
+	printf("%-12s %-12s %10s\n", "reader node", "table node", "ns/lookup");
+
+	for (i = 0; i < nnodes; i++)
+	{
+		for (j = 0; j < nnodes; j++)
+		{
+			r.reader = &nodes[i];
+			r.lpm = nodes[j].lpm;
+			pthread_create(&t, NULL, node_lookup, &r);
+			pthread_join(t, NULL);
+
+			printf("%-12d %-12d %10.1f%s\n", nodes[i].id, nodes[j].id, r.ns,
+			       i == j ? "  local" : "");
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+#			L P M C H U R N . S H
+#
+# Check that the NUMA local copies of the ASN table stay valid while the
+# routes of another table change. Pings a destination covered by the ASN
+# table while adding and deleting routes in TABLE (main by default), then
+# prints how many lookups fell back to the table walk (lpm_stale) and how
+# many times the copies were rebuilt (lpm_rebuild). Both stay at 0 for
+# any table but the ASN one; run it with the ASN table to compare.
+#
+# Needs the module loaded, an ASN route to DEST and debugfs mounted.
+#
+#   lpmchurn.sh DEST [CHANGES [TABLE]]
+
+STATS=/sys/kernel/debug/asn-fwd/stats
+
+DEST=$1
+CHANGES=${2:-10000}
+TABLE=${3:-main}
+
+if [ -z "$DEST" ] || [ ! -r $STATS ]
+then
+	echo "usage: lpmchurn.sh DEST [CHANGES [TABLE]], with the module loaded" >&2
+	exit 1
+fi
+
+counter()
+{
+	awk -v f=$1 '$1 == f { print $2 }' $STATS
+}
+
+# warm up: the first lookup builds the copies
+ping -q -c 1 $DEST > /dev/null
+sleep 1
+stale=$(counter lpm_stale)
+rebuild=$(counter lpm_rebuild)
+
+ping -q -i 0.01 $DEST > /dev/null &
+PING=$!
+
+start=$(date +%s.%N)
+i=0
+while [ $i -lt $CHANGES ]
+do
+	# 198.18.0.0/15 is the benchmarking range, never routed
+	net=198.18.$((i / 256 % 256)).$((i % 256))
+	ip route add $net/32 dev lo table $TABLE
+	ip route del $net/32 dev lo table $TABLE
+	i=$((i + 1))
+done
+end=$(date +%s.%N)
+
+kill $PING
+
+echo "$CHANGES routes added and deleted in table $TABLE, $(echo "$end - $start" | bc) s"
+echo "lpm_stale   +$(( $(counter lpm_stale) - stale ))"
+echo "lpm_rebuild +$(( $(counter lpm_rebuild) - rebuild ))"
@@ -0,0 +1,370 @@
+/*
+ *			O P T B E N C H . C
+ *
+ * Time the OPTIONS format parsing of one packet, as done before and after
+ * the single pass parser of module/asn-fwd-options.c, over synthetic
+ * option mixes. Each run looks the options up and replaces the IPOPT_END
+ * bytes, which is what the encapsulation path does, on a fresh copy of
+ * the header.
+ *
+ * The two parsers are copies of the module code, only the kernel types
+ * are replaced. Keep them in sync with module/asn-fwd-options.[ch]. Mixes
+ * marked bad are malformed, the new parser must leave them alone, and
+ * the run stops if it would not. Both parsers are timed RUNS times, in
+ * alternating order, and the fastest run of each is reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <netinet/ip.h>
+
+#define IPOPT_ASNFWD_TYPE 222
+#define IPOPT_ASNFWD_LEN  8
+
+#define ROUNDS 3000000
+#define RUNS   15
+
+struct __attribute__((packed)) asnfwd_opt {
+	unsigned char type;
+	unsigned char len;
+	uint32_t addr;
+	unsigned char pad1;
+	unsigned char pad2;
+};
+
+struct asnfwd_optinfo {
+	uint64_t      eol;
+	unsigned char asn;
+	unsigned char pad;
+	unsigned char free;
+};
+
+/* the kernel's get_unaligned on a u64 */
+static inline uint64_t get_unaligned64(const void *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static int ip_opt_len(const struct iphdr *iph)
+{
+	return (iph->ihl * 4) - sizeof(struct iphdr);
+}
+
+/*
+ * Before: asnfwd_find_option, then asnfwd_replace_eol walking the
+ * options a second time.
+ */
+static void old_replace_eol(struct iphdr *iph)
+{
+	unsigned char *optptr = (unsigned char *) &(iph[1]);
+	int optlen = ip_opt_len(iph);
+	int len;
+
+	for ( ; optlen > 0; )
+	{
+		switch (*optptr)
+		{
+		case IPOPT_END:
+			*optptr = IPOPT_NOOP;
+			/* pass through */
+		case IPOPT_NOOP:
+			optlen--;
+			optptr++;
+			continue;
+		}
+
+		len = optptr[1];
+		optlen -= len;
+		optptr += len;
+	}
+}
+
+/* exported by the module, so called across files and not inlined */
+static __attribute__((noinline)) int old_find_option(struct iphdr *iph, struct asnfwd_opt **opt)
+{
+	unsigned char *optptr;
+	int optlen;
+	int len;
+	int err = 0;
+
+	*opt = NULL;
+
+	if (iph->ihl > 5)
+	{
+		optlen = ip_opt_len(iph);
+		optptr = (unsigned char *) &(iph[1]);
+		for ( ; optlen > 0; )
+		{
+			switch (*optptr)
+			{
+			case IPOPT_NOOP:
+			case IPOPT_END:
+				optlen--;
+				optptr++;
+				continue;
+			}
+
+			if (optlen < 2)
+				goto end;
+
+			len = optptr[1];
+			if (len < 2 || len > optlen)
+				goto end;
+
+			if (*optptr == IPOPT_ASNFWD_TYPE)
+			{
+				*opt = (struct asnfwd_opt *) optptr;
+				if ((*opt)->len < IPOPT_ASNFWD_LEN)
+					err = -EPROTO;
+
+				goto end;
+			}
+			else
+			{
+				optlen -= len;
+				optptr += len;
+			}
+		}
+	}
+
+end:
+	return err;
+}
+
+static int old_parse(struct iphdr *iph)
+{
+	struct asnfwd_opt *opt;
+	int err;
+
+	err = old_find_option(iph, &opt);
+	if (err == 0 && !opt && MAX_IPOPTLEN - ip_opt_len(iph) >= IPOPT_ASNFWD_LEN)
+		old_replace_eol(iph);
+
+	return err;
+}
+
+/*
+ * After: asnfwd_parse_options, then the IPOPT_END bitmap, the NOOP
+ * padding being looked for only when there are enough padding bytes.
+ */
+static inline int asnfwd_parse_options(const struct iphdr *iph, struct asnfwd_optinfo *info)
+{
+	const unsigned char *opts = (const unsigned char *) &(iph[1]);
+	const unsigned char *optptr = opts;
+	int optlen = (iph->ihl * 4) - sizeof(struct iphdr);
+	int len, pad = optlen;
+	uint64_t eol = 0;
+
+	info->eol = 0;
+	info->asn = 0;
+	info->pad = 0;
+	info->free = MAX_IPOPTLEN - optlen;
+
+	if (optlen >= IPOPT_ASNFWD_LEN && *optptr == IPOPT_NOOP &&
+	    get_unaligned64(optptr) == 0x0101010101010101ULL)
+	{
+		optlen -= IPOPT_ASNFWD_LEN;
+		optptr += IPOPT_ASNFWD_LEN;
+	}
+
+	while (optlen > 0)
+	{
+		if (*optptr <= IPOPT_NOOP)
+		{
+			if (*optptr == IPOPT_END)
+				eol |= 1ULL << (optptr - opts);
+			optlen--;
+			optptr++;
+			continue;
+		}
+
+		if (optlen < 2 || (len = optptr[1]) < 2 || len > optlen)
+		{
+			info->free = 0;
+			return 0;
+		}
+
+		if (*optptr == IPOPT_ASNFWD_TYPE)
+		{
+			info->asn = sizeof(struct iphdr) + (optptr - opts);
+			return len != IPOPT_ASNFWD_LEN ? -EPROTO : 0;
+		}
+
+		pad -= len;
+		optlen -= len;
+		optptr += len;
+	}
+
+	info->eol = eol;
+	info->pad = pad;
+
+	return 0;
+}
+
+static unsigned char asnfwd_find_padding(const struct iphdr *iph)
+{
+	const unsigned char *optptr = (const unsigned char *) &(iph[1]);
+	int optlen = ip_opt_len(iph);
+	int off;
+
+	for (off = 0; off <= optlen - IPOPT_ASNFWD_LEN; )
+	{
+		switch (optptr[off])
+		{
+		case IPOPT_NOOP:
+			if (get_unaligned64(optptr + off) == 0x0101010101010101ULL)
+				return sizeof(struct iphdr) + off;
+			/* pass through */
+		case IPOPT_END:
+			off++;
+			continue;
+		}
+
+		off += optptr[off + 1];
+	}
+
+	return 0;
+}
+
+static void asnfwd_replace_eol(struct iphdr *iph, uint64_t eol)
+{
+	unsigned char *optptr = (unsigned char *) &(iph[1]);
+
+	for ( ; eol; eol &= eol - 1)
+		optptr[__builtin_ctzll(eol)] = IPOPT_NOOP;
+}
+
+static int new_parse(struct iphdr *iph)
+{
+	struct asnfwd_optinfo info;
+	unsigned char noop = 0;
+	int err;
+
+	err = asnfwd_parse_options(iph, &info);
+	if (err != 0 || info.asn)
+		return err;
+
+	if (info.pad >= IPOPT_ASNFWD_LEN)
+		noop = asnfwd_find_padding(iph);
+
+	if (noop || info.free >= IPOPT_ASNFWD_LEN)
+		asnfwd_replace_eol(iph, info.eol);
+
+	return noop;
+}
+
+struct mix {
+	const char *name;
+	int optlen;
+	unsigned char opt[MAX_IPOPTLEN];
+	int bad;      /* malformed, the parser must leave the header alone */
+};
+
+static const struct mix mixes[] = {
+	{ "none",           0,  { 0 } },
+	{ "noop x8",        8,  { 1, 1, 1, 1, 1, 1, 1, 1 } },
+	{ "noop x4 + end",  8,  { 1, 1, 1, 1, 0, 0, 0, 0 } },
+	{ "rr 3 + end",     16, { IPOPT_RR, 15, 4 } },
+	{ "rr 9",           40, { IPOPT_RR, 39, 4 } },
+	{ "ts 4",           20, { IPOPT_TS, 20, 5 } },
+	{ "ts 4 + asn",     28, { IPOPT_TS, 20, 5, [20] = IPOPT_ASNFWD_TYPE, IPOPT_ASNFWD_LEN } },
+	{ "noop + rr 3",    20, { 1, 1, 1, 1, IPOPT_RR, 15, 4 } },
+	{ "noop x8 + bad",  12, { 1, 1, 1, 1, 1, 1, 1, 1, IPOPT_RR, 1 }, 1 },
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+union hdr {
+	struct iphdr iph;
+	unsigned char b[sizeof(struct iphdr) + MAX_IPOPTLEN];
+};
+
+static void hdr_make(union hdr *h, const struct mix *m)
+{
+	memset(h, 0, sizeof(*h));
+	h->iph.version = 4;
+	h->iph.ihl = 5 + m->optlen / 4;
+	memcpy(&h->b[sizeof(struct iphdr)], m->opt, m->optlen);
+}
+
+/* nothing is written in a malformed header, not even in padding found before */
+static int check(const struct mix *m)
+{
+	struct asnfwd_optinfo info;
+	union hdr h;
+
+	hdr_make(&h, m);
+	asnfwd_parse_options(&h.iph, &info);
+
+	return !m->bad || (info.pad == 0 && info.eol == 0 && info.free == 0);
+}
+
+static double run(const struct mix *m, int (*parse)(struct iphdr *))
+{
+	union hdr orig, hdr;
+	volatile int sink = 0;
+	uint64_t start;
+	int i;
+
+	hdr_make(&orig, m);
+
+	start = now_ns();
+
+	for (i = 0; i < ROUNDS; i++)
+	{
+		/* the IPOPT_END bytes are replaced, start over every time */
+		memcpy(&hdr, &orig, sizeof(struct iphdr) + m->optlen);
+		sink += parse(&hdr.iph);
+	}
+
+	return (double) (now_ns() - start) / ROUNDS;
+}
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	double o, n, a, b;
+	int k;
+
+	printf("%-16s %10s %10s %8s\n", "options", "before ns", "after ns", "speedup");
+
+	for (i = 0; i < sizeof(mixes) / sizeof(mixes[0]); i++)
+	{
+		if (!check(&mixes[i]))
+		{
+			fprintf(stderr, "optbench: %s: the malformed header would be written\n", mixes[i].name);
+			return 1;
+		}
+
+		/* alternate the order, the faster of the runs is kept */
+		o = n = 1e9;
+		for (k = 0; k < RUNS; k++)
+		{
+			a = k & 1 ? 0 : run(&mixes[i], old_parse);
+			b = run(&mixes[i], new_parse);
+			if (k & 1)
+				a = run(&mixes[i], old_parse);
+
+			o = a < o ? a : o;
+			n = b < n ? b : n;
+		}
+
+		printf("%-16s %10.2f %10.2f %7.2fx\n", mixes[i].name, o, n, o / n);
+	}
+
+	return 0;
+}
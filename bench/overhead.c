@@ -0,0 +1,123 @@
+/*
+ *			O V E R H E A D . C
+ *
+ * Overhead calculator: the goodput of the three wire formats on an
+ * Ethernet link, computed from the bytes each one adds
+ * (asnfwd_format_overhead): IPIP 20, OPTIONS 8, SHIM 8. Nothing is
+ * measured, no packet goes through the module.
+ * The packet rate at a given line rate is set by the frame size on the
+ * wire, preamble and inter-frame gap included, and the goodput is the
+ * inner IP bytes carried at that rate.
+ *
+ * Two cases are printed: fixed inner packet sizes, and a TCP bulk flow
+ * whose MSS shrinks by the overhead so the encapsulated packet still
+ * fits the MTU. This models the link only: the cost of encapsulating in
+ * the module, and the punt of IP options to the CPU by hardware routers,
+ * which is what makes OPTIONS slower on real paths, are not part of it.
+ *
+ *   overhead [-g gbit/s] [-m mtu]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define ETH_WIRE    (14 + 4 + 8 + 12)  /* header, FCS, preamble, inter-frame gap */
+#define ETH_MIN_PDU 46
+#define TCPIP_HLEN  (20 + 20 + 12)     /* IP, TCP and the timestamp option */
+
+struct format {
+	const char *name;
+	int overhead;
+};
+
+static const struct format formats[] = {
+	{ "none",    0 },
+	{ "IPIP",    20 },
+	{ "OPTIONS", 8 },
+	{ "SHIM",    8 },
+};
+
+#define NFORMATS (int) (sizeof(formats) / sizeof(formats[0]))
+
+/* inner IP total lengths, 1400 leaves room for any format in a 1500 MTU */
+static const int sizes[] = { 46, 128, 256, 576, 1400 };
+
+static double gbps = 10;
+static int mtu = 1500;
+
+static int wire_bytes(int ip_len)
+{
+	return (ip_len < ETH_MIN_PDU ? ETH_MIN_PDU : ip_len) + ETH_WIRE;
+}
+
+/* inner bytes per second, in Gbit/s */
+static double goodput(int ip_len, int overhead)
+{
+	return gbps * ip_len / wire_bytes(ip_len + overhead);
+}
+
+/* simple IMIX 7:4:1, with 1400 for the large packets, see sizes */
+static double imix(int overhead)
+{
+	double inner = 7 * 46 + 4 * 576 + 1 * 1400;
+	double wire = 7 * wire_bytes(46 + overhead) + 4 * wire_bytes(576 + overhead) +
+	              1 * wire_bytes(1400 + overhead);
+
+	return gbps * inner / wire;
+}
+
+int main(int argc, char **argv)
+{
+	int opt, i, f, mss;
+
+	while ((opt = getopt(argc, argv, "g:m:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'g':
+			gbps = atof(optarg);
+			break;
+		case 'm':
+			mtu = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: overhead [-g gbit/s] [-m mtu]\n");
+			return 1;
+		}
+	}
+
+	if (gbps <= 0 || mtu < 576)
+	{
+		fprintf(stderr, "overhead: need a positive rate and an MTU of 576 or more\n");
+		return 1;
+	}
+
+	printf("inner IP goodput at %.1f Gbit/s from the header overhead, Gbit/s (Mpps)\n\n", gbps);
+	printf("%-10s", "size");
+	for (f = 0; f < NFORMATS; f++)
+		printf(" %18s", formats[f].name);
+	putchar('\n');
+
+	for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++)
+	{
+		printf("%-10d", sizes[i]);
+		for (f = 0; f < NFORMATS; f++)
+			printf(" %10.2f (%5.2f)", goodput(sizes[i], formats[f].overhead),
+			       gbps * 1e3 / 8 / wire_bytes(sizes[i] + formats[f].overhead));
+		putchar('\n');
+	}
+
+	printf("%-10s", "imix");
+	for (f = 0; f < NFORMATS; f++)
+		printf(" %10.2f%s", imix(formats[f].overhead), f < NFORMATS - 1 ? "        " : "");
+	printf("\n\nTCP bulk at MTU %d, payload Gbit/s\n\n", mtu);
+
+	for (f = 0; f < NFORMATS; f++)
+	{
+		mss = mtu - formats[f].overhead - TCPIP_HLEN;
+		printf("%-10s MSS %4d  %6.3f\n", formats[f].name, mss, gbps * mss / wire_bytes(mtu));
+	}
+
+	return 0;
+}
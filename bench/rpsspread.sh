@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+#			R P S S P R E A D . S H
+#
+# Show how the packets received on DEV spread over the CPUs with RPS, to
+# compare before and after the GRO handler of asn-fwd-gro.c: run it with
+# the module unloaded, then loaded, while one upstream box sends ASN-FWD
+# packets of many inner flows. RPS is turned on for every CPU on all the
+# receive queues of DEV, and the packets each CPU processed (softnet_stat)
+# and its NET_RX softirqs are counted over SECONDS. Without the handler,
+# the IPIP and SHIM packets of one box hash to a single CPU.
+#
+# Needs root. The RPS masks of DEV are restored on exit.
+#
+#   rpsspread.sh DEV [SECONDS]
+
+DEV=$1
+TIME=${2:-10}
+QUEUES=/sys/class/net/$DEV/queues
+
+if [ -z "$DEV" ] || [ ! -d $QUEUES ]
+then
+	echo "usage: rpsspread.sh DEV [SECONDS]" >&2
+	exit 1
+fi
+
+TMP=$(mktemp -d) || exit 1
+
+# all the CPUs, in the comma separated 32 bit groups of rps_cpus
+cpumask()
+{
+	n=$1
+	mask=""
+
+	while [ $n -gt 32 ]
+	do
+		mask=",ffffffff$mask"
+		n=$((n - 32))
+	done
+
+	printf '%x%s' $(( (1 << n) - 1 )) "$mask"
+}
+
+# packets processed by each CPU, the first column of softnet_stat
+processed()
+{
+	while read count rest
+	do
+		echo $((0x$count))
+	done < /proc/net/softnet_stat
+}
+
+# NET_RX softirqs run by each CPU
+net_rx()
+{
+	awk '$1 == "NET_RX:" { for (i = 2; i <= NF; i++) print $i }' /proc/softirqs
+}
+
+restore()
+{
+	for q in $QUEUES/rx-*
+	do
+		cat $TMP/$(basename $q) > $q/rps_cpus
+	done
+
+	rm -rf $TMP
+}
+
+ncpu=$(grep -c '^processor' /proc/cpuinfo)
+mask=$(cpumask $ncpu)
+
+for q in $QUEUES/rx-*
+do
+	cat $q/rps_cpus > $TMP/$(basename $q)
+	echo $mask > $q/rps_cpus
+done
+
+trap restore EXIT
+trap 'exit 1' INT TERM
+
+processed > $TMP/pkts.0
+net_rx > $TMP/rx.0
+sleep $TIME
+processed > $TMP/pkts.1
+net_rx > $TMP/rx.1
+
+echo "RPS on $DEV over $ncpu CPUs, ${TIME} s"
+printf '%-5s %12s %7s %12s\n' cpu packets share softirqs
+
+paste $TMP/pkts.0 $TMP/pkts.1 $TMP/rx.0 $TMP/rx.1 | awk '
+	{ pkts[NR] = $2 - $1; rx[NR] = $4 - $3; total += pkts[NR] }
+	END {
+		for (i = 1; i <= NR; i++)
+		{
+			share = total ? 100 * pkts[i] / total : 0
+			printf "%-5d %12d %6.1f%% %12d\n", i - 1, pkts[i], share, rx[i]
+			if (pkts[i] > max)
+				max = pkts[i]
+			if (share >= 1)
+				busy++
+		}
+		printf "busiest CPU %.1f%% of %d packets, %d CPUs with 1%% or more\n",
+		       total ? 100 * max / total : 0, total, busy
+	}'
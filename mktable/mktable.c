@@ -0,0 +1,376 @@
+/*
+ *			M K T A B L E . C
+ *
+ * Compile a prebuilt ASN table image for the ASN-FWD module, loaded at
+ * init with "insmod asn-fwd.ko image=<name>" from the firmware directory,
+ * so the box forwards before the control plane pushed table 100.
+ *
+ * The input is either text, one route per line:
+ *
+ *   203.0.113.0/24 198.51.100.1
+ *   203.0.113.0/24 via 198.51.100.1 dev eth0 ...   (ip route show table 100)
+ *   unreachable 192.0.2.0/24                        (route without ASN)
+ *
+ * or, with -m, an MRT TABLE_DUMP_V2 RIB dump (RFC 6396), the BGP next hop
+ * of the first entry of each IPv4 prefix being its ASN gateway.
+ *
+ * Prefixes are resolved into sorted disjoint ranges, the most specific
+ * one winning, which is the layout the module looks up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include "../module/asn-fwd-image.h"
+#include "../xdp/lpm-build.h"
+
+#define MRT_TABLE_DUMP_V2     13
+#define MRT_RIB_IPV4_UNICAST  2
+#define BGP_ATTR_NEXT_HOP     3
+#define BGP_ATTR_EXTENDED_LEN 0x10
+
+static struct lpm_prefix *prefixes;
+static size_t nprefixes, maxprefixes;
+
+static struct lpm *lpm;
+
+static void add_prefix(uint32_t addr, int len, uint32_t gw)
+{
+	if (nprefixes == maxprefixes)
+	{
+		maxprefixes = maxprefixes ? 2 * maxprefixes : 4096;
+		prefixes = realloc(prefixes, maxprefixes * sizeof(*prefixes));
+		if (!prefixes)
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+
+	prefixes[nprefixes].addr = len ? addr & (~(uint32_t) 0 << (32 - len)) : 0;
+	prefixes[nprefixes].len = len;
+	prefixes[nprefixes].gw = gw;
+	prefixes[nprefixes].seq = nprefixes;
+	nprefixes++;
+}
+
+/* "a.b.c.d/len", "a.b.c.d" or "default" */
+static int parse_prefix(const char *s, uint32_t *addr, int *len)
+{
+	char buf[32], *slash;
+	struct in_addr in;
+
+	if (strcmp(s, "default") == 0)
+	{
+		*addr = 0;
+		*len = 0;
+		return 0;
+	}
+
+	snprintf(buf, sizeof(buf), "%s", s);
+	*len = 32;
+
+	slash = strchr(buf, '/');
+	if (slash)
+	{
+		*slash++ = '\0';
+		*len = atoi(slash);
+		if (*len < 0 || *len > 32)
+			return -1;
+	}
+
+	if (inet_pton(AF_INET, buf, &in) != 1)
+		return -1;
+
+	*addr = ntohl(in.s_addr);
+
+	return 0;
+}
+
+/*
+ *			L O A D _ T E X T
+ */
+static int load_text(FILE *f)
+{
+	char line[1024], *tok[16], *save;
+	struct in_addr gw;
+	uint32_t addr;
+	int lineno = 0, ntok, len, i;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		lineno++;
+
+		for (ntok = 0, tok[0] = strtok_r(line, " \t\n", &save);
+		     tok[ntok] && ntok < 15;
+		     tok[++ntok] = strtok_r(NULL, " \t\n", &save))
+			;
+
+		if (ntok == 0 || tok[0][0] == '#')
+			continue;
+
+		/* route types without next hop, they hide the less specific routes */
+		if (strcmp(tok[0], "unreachable") == 0 || strcmp(tok[0], "blackhole") == 0 ||
+		    strcmp(tok[0], "prohibit") == 0 || strcmp(tok[0], "throw") == 0 ||
+		    strcmp(tok[0], "unicast") == 0)
+		{
+			if (strcmp(tok[0], "unicast") != 0)
+			{
+				if (ntok < 2 || parse_prefix(tok[1], &addr, &len) != 0)
+					goto bad;
+				add_prefix(addr, len, 0);
+				continue;
+			}
+
+			/* "unicast" is only a prefix of a normal route */
+			memmove(tok, tok + 1, --ntok * sizeof(tok[0]));
+		}
+
+		if (parse_prefix(tok[0], &addr, &len) != 0)
+			goto bad;
+
+		gw.s_addr = 0;
+
+		if (ntok >= 2 && inet_pton(AF_INET, tok[1], &gw) == 1)
+		{
+			add_prefix(addr, len, gw.s_addr);
+			continue;
+		}
+
+		for (i = 1; i + 1 < ntok; i++)
+		{
+			if (strcmp(tok[i], "via") == 0)
+			{
+				if (inet_pton(AF_INET, tok[i + 1], &gw) != 1)
+					goto bad;
+				break;
+			}
+		}
+
+		/* a route without gateway has no ASN, as in the module */
+		add_prefix(addr, len, gw.s_addr);
+		continue;
+
+bad:
+		fprintf(stderr, "mktable: line %d: cannot parse route\n", lineno);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* next hop of a BGP path attributes block, 0 if none */
+static uint32_t mrt_next_hop(const uint8_t *p, size_t len)
+{
+	size_t i = 0, alen, hlen;
+	uint32_t nh;
+
+	while (i + 3 <= len)
+	{
+		hlen = (p[i] & BGP_ATTR_EXTENDED_LEN) ? 4 : 3;
+		if (i + hlen > len)
+			break;
+
+		alen = hlen == 4 ? (p[i + 2] << 8 | p[i + 3]) : p[i + 2];
+		if (i + hlen + alen > len)
+			break;
+
+		if (p[i + 1] == BGP_ATTR_NEXT_HOP && alen == 4)
+		{
+			memcpy(&nh, p + i + hlen, 4);
+			return nh;
+		}
+
+		i += hlen + alen;
+	}
+
+	return 0;
+}
+
+/*
+ *			L O A D _ M R T
+ */
+static int load_mrt(FILE *f)
+{
+	uint8_t hdr[12], *rec = NULL, *p;
+	uint32_t len, addr, attr_len;
+	size_t plen;
+	int pfx_len, entries;
+
+	while (fread(hdr, 1, sizeof(hdr), f) == sizeof(hdr))
+	{
+		len = (uint32_t) hdr[8] << 24 | hdr[9] << 16 | hdr[10] << 8 | hdr[11];
+
+		rec = realloc(rec, len ? len : 1);
+		if (!rec || fread(rec, 1, len, f) != len)
+		{
+			fprintf(stderr, "mktable: truncated MRT record\n");
+			free(rec);
+			return -1;
+		}
+
+		if ((hdr[4] << 8 | hdr[5]) != MRT_TABLE_DUMP_V2 || (hdr[6] << 8 | hdr[7]) != MRT_RIB_IPV4_UNICAST)
+			continue;
+
+		/* sequence, prefix length, prefix, entry count */
+		if (len < 5)
+			continue;
+
+		pfx_len = rec[4];
+		plen = (pfx_len + 7) / 8;
+		if (pfx_len > 32 || len < 5 + plen + 2)
+			continue;
+
+		addr = 0;
+		memcpy(&addr, rec + 5, plen);
+		addr = ntohl(addr);
+
+		p = rec + 5 + plen;
+		entries = p[0] << 8 | p[1];
+		p += 2;
+
+		/* peer index, originated time, attributes length */
+		if (entries == 0 || p + 8 > rec + len)
+			continue;
+
+		attr_len = p[6] << 8 | p[7];
+		if (p + 8 + attr_len > rec + len)
+			continue;
+
+		add_prefix(addr, pfx_len, mrt_next_hop(p + 8, attr_len));
+	}
+
+	free(rec);
+
+	return 0;
+}
+
+/* shared with the AF_XDP data plane, see xdp/lpm-build.c */
+static void build(void)
+{
+	lpm = lpm_build(prefixes, nprefixes);
+	if (!lpm)
+	{
+		perror("malloc");
+		exit(1);
+	}
+}
+
+/* zlib crc32, what the kernel checks with crc32_le */
+static uint32_t crc32(const uint8_t *p, size_t len)
+{
+	uint32_t crc = 0xffffffff;
+	int k;
+
+	while (len--)
+	{
+		crc ^= *p++;
+		for (k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return crc ^ 0xffffffff;
+}
+
+static int write_image(const char *path)
+{
+	struct asnfwd_image_hdr hdr;
+	struct asnfwd_image_range *r;
+	FILE *f;
+	size_t i;
+
+	r = calloc(lpm->n ? lpm->n : 1, sizeof(*r));
+	if (!r)
+		return -1;
+
+	for (i = 0; i < lpm->n; i++)
+	{
+		r[i].start = htonl(lpm->r[i].start);
+		r[i].end = htonl(lpm->r[i].end);
+		r[i].gw = lpm->r[i].gw;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = htonl(ASNFWD_IMAGE_MAGIC);
+	hdr.version = htons(ASNFWD_IMAGE_VERSION);
+	hdr.hdr_len = htons(sizeof(hdr));
+	hdr.count = htonl(lpm->n);
+	hdr.crc = htonl(crc32((const uint8_t *) r, lpm->n * sizeof(*r)));
+	hdr.serial = htobe64(time(NULL));
+
+	f = fopen(path, "wb");
+	if (!f)
+	{
+		perror(path);
+		free(r);
+		return -1;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    (lpm->n && fwrite(r, sizeof(*r), lpm->n, f) != lpm->n) ||
+	    fclose(f) != 0)
+	{
+		perror(path);
+		free(r);
+		return -1;
+	}
+
+	free(r);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *out = "asn-fwd.img";
+	FILE *in = stdin;
+	int mrt = 0, opt, err;
+
+	while ((opt = getopt(argc, argv, "mo:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			mrt = 1;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: mktable [-m] [-o image] [routes]\n");
+			return 1;
+		}
+	}
+
+	if (optind < argc)
+	{
+		in = fopen(argv[optind], mrt ? "rb" : "r");
+		if (!in)
+		{
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	err = mrt ? load_mrt(in) : load_text(in);
+	if (in != stdin)
+		fclose(in);
+
+	if (err != 0)
+		return 1;
+
+	build();
+
+	if (write_image(out) != 0)
+		return 1;
+
+	printf("%zu prefixes, %zu ranges written to %s\n", nprefixes, lpm->n, out);
+
+	return 0;
+}
@@ -1,8 +1,18 @@
 #include "asn-fwd-common.h"
+#include "asn-fwd-latency.h"
+#include "asn-fwd-options.h"
+#include "asn-fwd-shim.h"
+#include "asn-fwd-ecn.h"
+#include "asn-fwd-lpm.h"
 
 unsigned int table = 100;
 unsigned int format = ASNFWD_FORMAT_IPIP;
 unsigned int debug = 0;
+unsigned int keep_padding = 0;
+unsigned int lookup = 1;
+unsigned int dscp = ASNFWD_DSCP_COPY;
+unsigned int dscp_decap = 0;
+unsigned int std_ipip = 0;
 fib_get_table_t my_fib_get_table;
 
 /**
@@ -10,14 +20,19 @@ fib_get_table_t my_fib_get_table;
  * @iph: IP header 
  * @in: The input device, if incoming packet
  * @out: The output device, if local outgoing packet
+ * @cfg: configuration of the packet namespace
  *
  * This function looks for ASN FWD route in the table
- * specified during module loading. Returns the address
- * or 0 if a route is not found.
+ * configured for the namespace, through the copy of the
+ * table on the local NUMA node when it is up to date. The
+ * image pushed by the control plane is only consulted when
+ * the table has no route for the address.
+ * Returns the address or 0 if a route is not found.
  */
 __be32 asnfwd_find_route(struct iphdr *iph,
                          const struct net_device *in,
-                         const struct net_device *out)
+                         const struct net_device *out,
+                         const struct asnfwd_config *cfg)
 {
 	struct net *net;
 	struct fib_table *tb;
@@ -25,20 +40,34 @@ __be32 asnfwd_find_route(struct iphdr *iph,
 	struct fib_result res;
 	struct fib_nh *nh;
 	__be32 addr = 0;
+	int err;
+	u64 start = ASNFWD_LAT_START();
 
 	/* sanity check */
 	if (!in && !out)
 		goto end;
 
+	/* ASN routes are in the main table, through asnfwd devices */
+	if (!cfg->lookup)
+		goto end;
+
 	/* recover net from input or output net_device */
 	net = dev_net(in ? in : out);
 	if (!net)
 		goto end;
 
+	/* read only the memory of the local node */
+	if (asnfwd_lpm_lookup(net, cfg, iph->daddr, &addr) == 0)
+		goto end;
+
 	/* recover the asn-fwd table */
-	tb = my_fib_get_table(net,  table);
+	tb = my_fib_get_table(net, cfg->table);
 	if (!tb)
-		goto end; /* no asn-fwd table found */
+	{
+		/* no asn-fwd table found, the control plane may not have pushed it yet */
+		asnfwd_lpm_image_lookup(net, iph->daddr, &addr);
+		goto end;
+	}
 
 	/* lookup for the destination address */
 	fl4.flowi4_oif = 0;  /*                   */
@@ -48,8 +77,15 @@ __be32 asnfwd_find_route(struct iphdr *iph,
 	fl4.saddr = 0;       /*                   */
 	fl4.flowi4_scope = RT_SCOPE_UNIVERSE;
 	fl4.daddr = iph->daddr;
-	if (fib_table_lookup(tb, &fl4, &res, 0) != 0)
+	err = fib_table_lookup(tb, &fl4, &res, 0);
+	if (err != 0)
+	{
+		/* only a miss falls back to the image, 1 here and -EAGAIN in later
+		   kernels; unreachable, prohibit and blackhole routes are final */
+		if (err > 0 || err == -EAGAIN)
+			asnfwd_lpm_image_lookup(net, iph->daddr, &addr);
 		goto end;
+	}
 
 	if (!res.fi)
 		goto end; /* incomplete route */
@@ -64,5 +100,24 @@ __be32 asnfwd_find_route(struct iphdr *iph,
 	addr = nh->nh_gw;
 
 end:
+	ASNFWD_LAT_END(ASNFWD_LAT_LOOKUP, start);
+
 	return addr;
 }
+
+/**
+ * asnfwd_format_overhead - bytes a format adds to a packet
+ * @format: the header format, ASNFWD_FORMAT_*
+ */
+int asnfwd_format_overhead(unsigned int format)
+{
+	switch (format)
+	{
+		case ASNFWD_FORMAT_IPIP:
+			return sizeof(struct iphdr);
+		case ASNFWD_FORMAT_OPTIONS:
+			return IPOPT_ASNFWD_LEN;
+		default:
+			return ASNFWD_SHIM_LEN;
+	}
+}
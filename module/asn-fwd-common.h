@@ -4,6 +4,7 @@
 #include <linux/ip.h>              // included for struct iphdr, ntohs, htons and others
 #include <net/ip_fib.h>            // included for fib_table_lookup and related structs
 #include <net/ip.h>                // included for ip_send_check
+#include "asn-fwd-config.h"
 
 #define PRINTK(...) do { if (debug) printk(KERN_INFO "[ASN-FWD] " __VA_ARGS__); } while (0)
 
@@ -15,16 +16,26 @@
 
 #define ASNFWD_FORMAT_IPIP    0
 #define ASNFWD_FORMAT_OPTIONS 1
+#define ASNFWD_FORMAT_SHIM    2
+#define ASNFWD_FORMATS        3
 
 typedef struct fib_table *(*fib_get_table_t)(struct net *, u32);
 
 extern unsigned int table;
 extern unsigned int format;
 extern unsigned int debug;
+extern unsigned int keep_padding;
+extern unsigned int lookup;
+extern unsigned int dscp;
+extern unsigned int dscp_decap;
+extern unsigned int std_ipip;
 extern fib_get_table_t my_fib_get_table;
+extern char format_name[][8];
 
 __be32 asnfwd_find_route(struct iphdr *iph,
                          const struct net_device *in,
-                         const struct net_device *out);
+                         const struct net_device *out,
+                         const struct asnfwd_config *cfg);
+int asnfwd_format_overhead(unsigned int format);
 
 #endif /* _ASN_FWD_COMMON_H */
@@ -0,0 +1,233 @@
+#include <linux/slab.h>            // included for kmalloc and kfree_rcu
+#include <linux/mutex.h>           // included for DEFINE_MUTEX
+#include <linux/proc_fs.h>         // included for proc_create_data
+#include <linux/seq_file.h>        // included for seq_printf and single_open_net
+#include <linux/uaccess.h>         // included for copy_from_user
+#include <linux/capability.h>      // included for CAP_NET_ADMIN
+#include "asn-fwd-config.h"
+#include "asn-fwd-common.h"
+#include "asn-fwd-headroom.h"
+#include "asn-fwd-ecn.h"
+#include "asn-fwd-ipip.h"
+
+int asnfwd_net_id __read_mostly;
+
+static atomic_t asnfwd_config_gen = ATOMIC_INIT(0);
+
+/* serializes the writers, readers only need RCU */
+static DEFINE_MUTEX(asnfwd_config_mutex);
+
+static int asnfwd_config_valid(const struct asnfwd_config *cfg)
+{
+	if (cfg->format >= ASNFWD_FORMATS)
+		return -EINVAL;
+
+	if (cfg->table == 0)
+		return -EINVAL;
+
+	if (cfg->dscp > ASNFWD_DSCP_COPY)
+		return -EINVAL;
+
+	if (cfg->std_ipip > ASNFWD_STD_IPIP_ON)
+		return -EINVAL;
+
+	return 0;
+}
+
+/**
+ * asnfwd_config_publish - swap the configuration of a namespace
+ * @net: the network namespace
+ * @new: the new configuration, copied
+ *
+ * Must be called with asnfwd_config_mutex held. Packets in flight keep
+ * the configuration they started with, the old one is freed after a
+ * grace period.
+ */
+static int asnfwd_config_publish(struct net *net, const struct asnfwd_config *new)
+{
+	struct asnfwd_net *an = net_generic(net, asnfwd_net_id);
+	struct asnfwd_config *cfg, *old;
+
+	cfg = kmemdup(new, sizeof(*cfg), GFP_KERNEL);
+	if (!cfg)
+		return -ENOMEM;
+
+	cfg->gen = atomic_inc_return(&asnfwd_config_gen);
+
+	old = rcu_dereference_protected(an->config, lockdep_is_held(&asnfwd_config_mutex));
+	rcu_assign_pointer(an->config, cfg);
+
+	if (old)
+		kfree_rcu(old, rcu);
+
+	return 0;
+}
+
+static int asnfwd_config_show(struct seq_file *m, void *v)
+{
+	const struct asnfwd_config *cfg;
+
+	rcu_read_lock();
+
+	cfg = asnfwd_config(m->private);
+	seq_printf(m, "table %u\n", cfg->table);
+	seq_printf(m, "format %u\n", cfg->format);
+	seq_printf(m, "keep_padding %u\n", cfg->keep_padding);
+	seq_printf(m, "lookup %u\n", cfg->lookup);
+	seq_printf(m, "dscp %u\n", cfg->dscp);
+	seq_printf(m, "dscp_decap %u\n", cfg->dscp_decap);
+	seq_printf(m, "std_ipip %u\n", cfg->std_ipip);
+
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static int asnfwd_config_open(struct inode *inode, struct file *file)
+{
+	return single_open_net(inode, file, asnfwd_config_show);
+}
+
+/* one "name value" pair per write, e.g. echo "format 1" > /proc/net/asn-fwd */
+static ssize_t asnfwd_config_write(struct file *file,
+                                   const char __user *ubuf,
+                                   size_t count,
+                                   loff_t *ppos)
+{
+	struct net *net = ((struct seq_file *) file->private_data)->private;
+	struct asnfwd_net *an = net_generic(net, asnfwd_net_id);
+	struct asnfwd_config cfg;
+	char buf[64], *val;
+	unsigned int v;
+	int err;
+
+	if (!ns_capable(net->user_ns, CAP_NET_ADMIN))
+		return -EPERM;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+
+	buf[count] = '\0';
+
+	val = strchr(buf, ' ');
+	if (!val)
+		return -EINVAL;
+
+	*val++ = '\0';
+
+	err = kstrtouint(strim(val), 0, &v);
+	if (err != 0)
+		return err;
+
+	mutex_lock(&asnfwd_config_mutex);
+
+	cfg = *rcu_dereference_protected(an->config, lockdep_is_held(&asnfwd_config_mutex));
+
+	if (strcmp(buf, "table") == 0)
+		cfg.table = v;
+	else if (strcmp(buf, "format") == 0)
+		cfg.format = v;
+	else if (strcmp(buf, "keep_padding") == 0)
+		cfg.keep_padding = v;
+	else if (strcmp(buf, "lookup") == 0)
+		cfg.lookup = v;
+	else if (strcmp(buf, "dscp") == 0)
+		cfg.dscp = v;
+	else if (strcmp(buf, "dscp_decap") == 0)
+		cfg.dscp_decap = v;
+	else if (strcmp(buf, "std_ipip") == 0)
+		cfg.std_ipip = v;
+	else
+		err = -EINVAL;
+
+	if (err == 0)
+		err = asnfwd_config_valid(&cfg);
+
+	if (err == 0)
+		err = asnfwd_config_publish(net, &cfg);
+
+	mutex_unlock(&asnfwd_config_mutex);
+
+	if (err != 0)
+		return err;
+
+	/* the format sets how much headroom the devices need */
+	asnfwd_headroom_update(net);
+
+	printk(KERN_INFO "[ASN-FWD] table = %u, format = %s, keep_padding = %u, lookup = %u\n",
+	       cfg.table, format_name[cfg.format], cfg.keep_padding, cfg.lookup);
+
+	return count;
+}
+
+static const struct file_operations asnfwd_config_fops = {
+	.owner   = THIS_MODULE,
+	.open    = asnfwd_config_open,
+	.read    = seq_read,
+	.write   = asnfwd_config_write,
+	.llseek  = seq_lseek,
+	.release = single_release_net,
+};
+
+/* new namespaces start with the module parameters */
+static int __net_init asnfwd_config_net_init(struct net *net)
+{
+	struct asnfwd_config cfg = {
+		.table        = table,
+		.format       = format,
+		.keep_padding = keep_padding,
+		.lookup       = lookup,
+		.dscp         = dscp,
+		.dscp_decap   = dscp_decap,
+		.std_ipip     = std_ipip,
+	};
+	int err;
+
+	err = asnfwd_config_valid(&cfg);
+	if (err != 0)
+		return err;
+
+	mutex_lock(&asnfwd_config_mutex);
+	err = asnfwd_config_publish(net, &cfg);
+	mutex_unlock(&asnfwd_config_mutex);
+
+	if (err != 0)
+		return err;
+
+	if (!proc_create_data("asn-fwd", S_IRUGO | S_IWUSR, net->proc_net, &asnfwd_config_fops, NULL))
+		printk(KERN_WARNING "[ASN-FWD] Cannot create /proc/net/asn-fwd\n");
+
+	return 0;
+}
+
+static void __net_exit asnfwd_config_net_exit(struct net *net)
+{
+	struct asnfwd_net *an = net_generic(net, asnfwd_net_id);
+
+	remove_proc_entry("asn-fwd", net->proc_net);
+
+	kfree_rcu(rcu_dereference_protected(an->config, 1), rcu);
+}
+
+static struct pernet_operations asnfwd_config_net_ops = {
+	.init = asnfwd_config_net_init,
+	.exit = asnfwd_config_net_exit,
+	.id   = &asnfwd_net_id,
+	.size = sizeof(struct asnfwd_net),
+};
+
+int asnfwd_config_init(void)
+{
+	return register_pernet_subsys(&asnfwd_config_net_ops);
+}
+
+void asnfwd_config_exit(void)
+{
+	unregister_pernet_subsys(&asnfwd_config_net_ops);
+
+	/* wait for the configurations to be freed */
+	rcu_barrier();
+}
@@ -0,0 +1,41 @@
+#ifndef _ASN_FWD_CONFIG_H
+#define _ASN_FWD_CONFIG_H
+
+#include <linux/rcupdate.h>        // included for rcu_dereference
+#include <net/net_namespace.h>     // included for struct net
+#include <net/netns/generic.h>     // included for net_generic
+
+/*
+ * Per namespace configuration. Never changed once published: the control
+ * path builds a new one and swaps it, the hook reads it once per packet.
+ */
+struct asnfwd_config {
+	struct rcu_head rcu;
+	unsigned int    gen;           /* unique to each published configuration */
+	unsigned int    table;         /* routing table where to lookup for ASN's */
+	unsigned int    format;        /* header format, ASNFWD_FORMAT_* */
+	unsigned int    keep_padding;  /* OPTIONS format: leave NOOP padding on decapsulation */
+	unsigned int    lookup;        /* look up the ASN table in the hook, 0 when routing through asnfwd devices only */
+	unsigned int    dscp;          /* IPIP and SHIM formats: DSCP of the outer header, ASNFWD_DSCP_COPY to copy the packet one */
+	unsigned int    dscp_decap;    /* IPIP and SHIM formats: keep the outer DSCP instead of the original one on decapsulation */
+	unsigned int    std_ipip;      /* IPIP format: IPPROTO_IPIP instead of ASNFWD_PROTOCOL, ASNFWD_STD_IPIP_* */
+};
+
+struct asnfwd_net {
+	struct asnfwd_config __rcu *config;
+};
+
+extern int asnfwd_net_id;
+
+/* must be called under rcu_read_lock, which netfilter hooks already hold */
+static inline const struct asnfwd_config *asnfwd_config(struct net *net)
+{
+	struct asnfwd_net *an = net_generic(net, asnfwd_net_id);
+
+	return rcu_dereference(an->config);
+}
+
+int asnfwd_config_init(void);
+void asnfwd_config_exit(void);
+
+#endif /* _ASN_FWD_CONFIG_H */
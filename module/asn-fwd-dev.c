@@ -0,0 +1,267 @@
+#include <linux/netdevice.h>       // included for struct net_device and alloc_netdev
+#include <linux/if_arp.h>          // included for ARPHRD_NONE
+#include <net/rtnetlink.h>         // included for rtnl_link_register
+#include <net/route.h>             // included for skb_rtable
+#include <net/dst.h>               // included for dst_output
+#include <linux/percpu.h>          // included for alloc_percpu
+#include <linux/u64_stats_sync.h>  // included for u64_stats_update_begin
+#include "asn-fwd-dev.h"
+#include "asn-fwd-common.h"
+#include "asn-fwd-config.h"
+#include "asn-fwd-ipip.h"
+#include "asn-fwd-options.h"
+#include "asn-fwd-shim.h"
+#include "asn-fwd-tunnel.h"
+#include "asn-fwd-stats.h"
+#include "asn-fwd-latency.h"
+#include "asn-fwd-sample.h"
+#include "asn-fwd-drop.h"
+#include "asn-fwd-hh.h"
+
+/*
+ * ASN-FWD device, "ip link add asnfwd0 type asnfwd". ASN routes are put
+ * in the main table through it, with the ASN gateway as next hop:
+ *
+ *   ip route add 203.0.113.0/24 via 198.51.100.1 dev asnfwd0 onlink
+ *
+ * Packets routed to the device are encapsulated to the gateway in the
+ * namespace format and sent on the cached route towards it, so the
+ * forwarding decision is the single lookup of the stack. Set "lookup 0"
+ * in /proc/net/asn-fwd to stop looking up the ASN table in the hook,
+ * which then only decapsulates.
+ */
+
+/**
+ * asnfwd_dev_xmit - encapsulate a packet to the gateway of its route
+ * @skb: the socket buffer, with no pending checksum nor GSO
+ * @dev: the ASN-FWD device
+ *
+ * The device has no offload feature, so the stack finishes checksums and
+ * segments the packets before giving them here. It is NETIF_F_LLTX and
+ * counts in per-CPU stats, so CPUs sending through it share no lock.
+ */
+static netdev_tx_t asnfwd_dev_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	struct net *net = dev_net(dev);
+	struct asnfwd_config cfg;
+	struct asnfwd_tunnel *tun;
+	struct asnfwd_optinfo info;
+	struct pcpu_sw_netstats *tstats;
+	struct dst_entry *dst;
+	struct rtable *rt = skb_rtable(skb);
+	unsigned int fmt;
+	__be32 daddr;
+	int headroom;
+	u64 start;
+	int reason = ASNFWD_DROP_NO_ROUTE;
+	int err;
+
+	if (skb->protocol != htons(ETH_P_IP) || !rt || !rt->rt_uses_gateway)
+		goto tx_error;
+
+	daddr = ip_hdr(skb)->daddr;
+
+	rcu_read_lock();
+	cfg = *asnfwd_config(net);
+	rcu_read_unlock();
+
+	fmt = cfg.format;
+
+	tun = asnfwd_tunnel_get(net, rt->rt_gateway);
+	if (!tun)
+	{
+		reason = ASNFWD_DROP_NOMEM;
+		goto tx_error;
+	}
+
+	if (tun->last_used != jiffies)
+		tun->last_used = jiffies;
+
+	dst = asnfwd_tunnel_dst(tun);
+	if (!dst)
+	{
+		dev->stats.tx_carrier_errors++;
+		goto tx_error_put;
+	}
+
+	/* the gateway is routed through ourselves */
+	if (dst->dev == dev)
+	{
+		dev->stats.collisions++;
+		goto tx_error_dst;
+	}
+
+	if (fmt == ASNFWD_FORMAT_OPTIONS &&
+	    (asnfwd_parse_options(ip_hdr(skb), &info) != 0 || info.asn))
+	{
+		reason = ASNFWD_DROP_MALFORMED;
+		goto tx_error_dst;
+	}
+
+	headroom = asnfwd_format_overhead(fmt) + LL_RESERVED_SPACE(dst->dev) + dst->header_len;
+
+	if (skb_headroom(skb) < headroom)
+		ASNFWD_INC(headroom_realloc);
+
+	if (skb_cow_head(skb, headroom))
+	{
+		reason = ASNFWD_DROP_NO_HEADROOM;
+		goto tx_error_dst;
+	}
+
+	start = ASNFWD_LAT_START();
+
+	if (fmt == ASNFWD_FORMAT_IPIP)
+		err = asnfwd_add_header(skb, tun, &cfg);
+	else if (fmt == ASNFWD_FORMAT_SHIM)
+		err = asnfwd_add_shim(skb, tun, &cfg);
+	else
+		err = asnfwd_set_dst_from_table(skb, tun->gw, &info);
+
+	ASNFWD_LAT_END(ASNFWD_LAT_ENCAP, start);
+
+	if (err != 0)
+	{
+		reason = asnfwd_drop_reason(err);
+		goto tx_error_dst;
+	}
+
+	skb->ip_summed = CHECKSUM_NONE;
+
+	start = ASNFWD_LAT_START();
+	ip_send_check(ip_hdr(skb));
+	ASNFWD_LAT_END(ASNFWD_LAT_CSUM, start);
+
+	ASNFWD_SAMPLE(ASNFWD_SAMPLE_ENCAP, skb, NULL, tun->gw, fmt);
+	ASNFWD_HH_HIT(daddr, tun->gw);
+
+	tstats = this_cpu_ptr(dev->tstats);
+	u64_stats_update_begin(&tstats->syncp);
+	tstats->tx_packets++;
+	tstats->tx_bytes += skb->len;
+	u64_stats_update_end(&tstats->syncp);
+
+	asnfwd_tunnel_put(tun);
+
+	memset(IPCB(skb), 0, sizeof(*IPCB(skb)));
+	skb_dst_drop(skb);
+	skb_dst_set(skb, dst);
+
+	dst_output(skb);
+
+	return NETDEV_TX_OK;
+
+tx_error_dst:
+	dst_release(dst);
+tx_error_put:
+	asnfwd_tunnel_put(tun);
+tx_error:
+	dev->stats.tx_errors++;
+	asnfwd_drop_count(skb, reason);
+	kfree_skb(skb);
+	return NETDEV_TX_OK;
+}
+
+/* same as ip_tunnel_get_stats64, the error counters stay in dev->stats */
+static struct rtnl_link_stats64 *asnfwd_dev_get_stats64(struct net_device *dev,
+                                                        struct rtnl_link_stats64 *tot)
+{
+	int i;
+
+	for_each_possible_cpu(i)
+	{
+		const struct pcpu_sw_netstats *tstats = per_cpu_ptr(dev->tstats, i);
+		u64 tx_packets, tx_bytes;
+		unsigned int start;
+
+		do {
+			start = u64_stats_fetch_begin_bh(&tstats->syncp);
+			tx_packets = tstats->tx_packets;
+			tx_bytes = tstats->tx_bytes;
+		} while (u64_stats_fetch_retry_bh(&tstats->syncp, start));
+
+		tot->tx_packets += tx_packets;
+		tot->tx_bytes += tx_bytes;
+	}
+
+	tot->tx_errors = dev->stats.tx_errors;
+	tot->tx_carrier_errors = dev->stats.tx_carrier_errors;
+	tot->collisions = dev->stats.collisions;
+
+	return tot;
+}
+
+static int asnfwd_dev_ndo_init(struct net_device *dev)
+{
+	int i;
+
+	dev->tstats = alloc_percpu(struct pcpu_sw_netstats);
+	if (!dev->tstats)
+		return -ENOMEM;
+
+	for_each_possible_cpu(i)
+		u64_stats_init(&per_cpu_ptr(dev->tstats, i)->syncp);
+
+	return 0;
+}
+
+static void asnfwd_dev_free(struct net_device *dev)
+{
+	free_percpu(dev->tstats);
+	free_netdev(dev);
+}
+
+/* room for the outer header in IPIP format, the worst case */
+static int asnfwd_dev_change_mtu(struct net_device *dev, int new_mtu)
+{
+	if (new_mtu < 68 || new_mtu > IP_MAX_MTU - sizeof(struct iphdr))
+		return -EINVAL;
+
+	dev->mtu = new_mtu;
+
+	return 0;
+}
+
+static const struct net_device_ops asnfwd_netdev_ops = {
+	.ndo_init        = asnfwd_dev_ndo_init,
+	.ndo_start_xmit  = asnfwd_dev_xmit,
+	.ndo_change_mtu  = asnfwd_dev_change_mtu,
+	.ndo_get_stats64 = asnfwd_dev_get_stats64,
+};
+
+static void asnfwd_dev_setup(struct net_device *dev)
+{
+	dev->netdev_ops      = &asnfwd_netdev_ops;
+	dev->destructor      = asnfwd_dev_free;
+
+	dev->type            = ARPHRD_NONE;
+	dev->flags           = IFF_NOARP | IFF_POINTOPOINT;
+	dev->hard_header_len = 0;
+	dev->addr_len        = 0;
+	dev->mtu             = ETH_DATA_LEN - sizeof(struct iphdr);
+	dev->needed_headroom = LL_MAX_HEADER + sizeof(struct iphdr);
+	dev->tx_queue_len    = 0;
+
+	/* gateways and their routes are per namespace */
+	dev->features       |= NETIF_F_NETNS_LOCAL;
+	dev->priv_flags     &= ~IFF_XMIT_DST_RELEASE;
+
+	/* no queue to protect, every CPU sends on its own */
+	dev->features       |= NETIF_F_LLTX;
+}
+
+static struct rtnl_link_ops asnfwd_link_ops __read_mostly = {
+	.kind  = "asnfwd",
+	.setup = asnfwd_dev_setup,
+};
+
+int asnfwd_dev_init(void)
+{
+	return rtnl_link_register(&asnfwd_link_ops);
+}
+
+/* also deletes the ASN-FWD devices of every namespace */
+void asnfwd_dev_exit(void)
+{
+	rtnl_link_unregister(&asnfwd_link_ops);
+}
@@ -0,0 +1,7 @@
+#ifndef _ASN_FWD_DEV_H
+#define _ASN_FWD_DEV_H
+
+int asnfwd_dev_init(void);
+void asnfwd_dev_exit(void);
+
+#endif /* _ASN_FWD_DEV_H */
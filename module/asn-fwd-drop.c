@@ -0,0 +1,83 @@
+#include <linux/errno.h>           // included for the error codes
+#include <linux/netfilter.h>       // included for NF_DROP and NF_STOLEN
+#include "asn-fwd-drop.h"
+#include "asn-fwd-stats.h"
+
+#define CREATE_TRACE_POINTS
+#include "asn-fwd-trace.h"
+
+const char *asnfwd_drop_name[ASNFWD_DROP_REASONS] = {
+	[ASNFWD_DROP_MALFORMED]    = "malformed",
+	[ASNFWD_DROP_TRUNCATED]    = "truncated",
+	[ASNFWD_DROP_ECN]          = "ecn",
+	[ASNFWD_DROP_NO_OPT_SPACE] = "no_opt_space",
+	[ASNFWD_DROP_NO_HEADROOM]  = "no_headroom",
+	[ASNFWD_DROP_TOO_BIG]      = "too_big",
+	[ASNFWD_DROP_NOMEM]        = "nomem",
+	[ASNFWD_DROP_NO_ROUTE]     = "no_route",
+	[ASNFWD_DROP_OTHER]        = "other",
+};
+
+/**
+ * asnfwd_drop_reason - drop reason of an encapsulation or decapsulation error
+ * @err: the error returned by the header, option or shim functions
+ */
+int asnfwd_drop_reason(int err)
+{
+	switch (err)
+	{
+	case -EPROTO:
+		return ASNFWD_DROP_MALFORMED;
+	case -ENODATA:
+		return ASNFWD_DROP_TRUNCATED;
+	case -EINVAL:
+		return ASNFWD_DROP_ECN;
+	case -ENOSPC:
+		return ASNFWD_DROP_NO_OPT_SPACE;
+	case -ENOBUFS:
+		return ASNFWD_DROP_NO_HEADROOM;
+	case -EMSGSIZE:
+		return ASNFWD_DROP_TOO_BIG;
+	case -ENOMEM:
+		return ASNFWD_DROP_NOMEM;
+	}
+
+	return ASNFWD_DROP_OTHER;
+}
+
+/**
+ * asnfwd_drop_count - account a packet the module refuses to forward
+ * @skb: the socket buffer, still owned by the caller
+ * @reason: one of ASNFWD_DROP_*
+ *
+ * 3.13 has no kfree_skb_reason. The reason is counted and reported by the
+ * asnfwd:asnfwd_drop tracepoint instead.
+ */
+void asnfwd_drop_count(struct sk_buff *skb, int reason)
+{
+	ASNFWD_INC(drop[reason]);
+	trace_asnfwd_drop(skb, reason);
+}
+
+/**
+ * asnfwd_drop - drop a packet the module refuses to forward
+ * @skb: the socket buffer
+ * @in: the input device, NULL at LOCAL_OUT
+ * @reason: one of ASNFWD_DROP_*
+ *
+ * Forwarded packets are freed here and NF_STOLEN is returned, so that
+ * skb:kfree_skb and drop_monitor (dropwatch) point to the module rather
+ * than to nf_hook_slow. Locally sent packets are left to netfilter with
+ * NF_DROP, so that ip_local_out still reports -EPERM to the sender.
+ */
+unsigned int asnfwd_drop(struct sk_buff *skb, const struct net_device *in, int reason)
+{
+	asnfwd_drop_count(skb, reason);
+
+	if (!in)
+		return NF_DROP;
+
+	kfree_skb(skb);
+
+	return NF_STOLEN;
+}
@@ -0,0 +1,28 @@
+#ifndef _ASN_FWD_DROP_H
+#define _ASN_FWD_DROP_H
+
+#include <linux/skbuff.h>          // included for struct sk_buff and kfree_skb
+
+/*
+ * Why a packet was dropped by the module. Kept as plain numbers, not an
+ * enum, so the asnfwd:asnfwd_drop tracepoint format resolves them in
+ * perf and trace-cmd.
+ */
+#define ASNFWD_DROP_MALFORMED     0  /* invalid IP options or ASN-FWD option */
+#define ASNFWD_DROP_TRUNCATED     1  /* ASN-FWD packet shorter than its headers */
+#define ASNFWD_DROP_ECN           2  /* CE marked, but the sender does not support ECN */
+#define ASNFWD_DROP_NO_OPT_SPACE  3  /* no room left in the IP header for the ASN-FWD option */
+#define ASNFWD_DROP_NO_HEADROOM   4  /* making room for the header or option failed */
+#define ASNFWD_DROP_TOO_BIG       5  /* packet would exceed IP_MAX_MTU once encapsulated */
+#define ASNFWD_DROP_NOMEM         6  /* no memory for the tunnel or for a private copy of the packet */
+#define ASNFWD_DROP_NO_ROUTE      7  /* asnfwd device: no usable route to the gateway */
+#define ASNFWD_DROP_OTHER         8  /* any other error */
+#define ASNFWD_DROP_REASONS       9
+
+extern const char *asnfwd_drop_name[ASNFWD_DROP_REASONS];
+
+int asnfwd_drop_reason(int err);
+void asnfwd_drop_count(struct sk_buff *skb, int reason);
+unsigned int asnfwd_drop(struct sk_buff *skb, const struct net_device *in, int reason);
+
+#endif /* _ASN_FWD_DROP_H */
@@ -0,0 +1,62 @@
+#include "asn-fwd-ecn.h"
+#include "asn-fwd-stats.h"
+
+/**
+ * asnfwd_ecn_encap - TOS of the outer header
+ * @tos: TOS of the packet being encapsulated
+ * @cfg: configuration of the packet namespace
+ *
+ * RFC 6040 normal mode: the ECN field is copied, so congestion marks made
+ * along the tunnel can be propagated on decapsulation. The DSCP is copied
+ * or rewritten to cfg->dscp.
+ */
+u8 asnfwd_ecn_encap(u8 tos, const struct asnfwd_config *cfg)
+{
+	if (cfg->dscp == ASNFWD_DSCP_COPY)
+		return tos;
+
+	return (cfg->dscp << 2) | (tos & INET_ECN_MASK);
+}
+
+/**
+ * asnfwd_ecn_decap - TOS of the decapsulated packet
+ * @outer: TOS of the header the packet arrived with
+ * @inner: TOS of the original packet, updated
+ * @cfg: configuration of the packet namespace
+ *
+ * Applies the RFC 6040 decapsulation table: outer CE marks are propagated
+ * to ECN capable packets, outer ECT(1) overrides inner ECT(0). The DSCP
+ * is the inner one or, with cfg->dscp_decap, the outer one. Returns
+ * -EINVAL if the packet must be dropped, a CE mark on a packet whose
+ * sender does not support ECN.
+ */
+int asnfwd_ecn_decap(u8 outer, u8 *inner, const struct asnfwd_config *cfg)
+{
+	u8 o = outer & INET_ECN_MASK;
+	u8 i = *inner & INET_ECN_MASK;
+	u8 dscp = (cfg->dscp_decap ? outer : *inner) & ~INET_ECN_MASK;
+
+	if (o == INET_ECN_CE)
+	{
+		ASNFWD_INC(ecn_ce);
+
+		if (i == INET_ECN_NOT_ECT)
+		{
+			ASNFWD_INC(ecn_drop);
+			return -EINVAL;
+		}
+
+		if (i != INET_ECN_CE)
+			ASNFWD_INC(ecn_ce_propagated);
+
+		i = INET_ECN_CE;
+	}
+	else if (o == INET_ECN_ECT_1 && i == INET_ECN_ECT_0)
+	{
+		i = INET_ECN_ECT_1;
+	}
+
+	*inner = dscp | i;
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef _ASN_FWD_ECN_H
+#define _ASN_FWD_ECN_H
+
+#include <linux/types.h>           // included for u8
+#include <net/inet_ecn.h>          // included for INET_ECN_MASK and INET_ECN_CE
+#include "asn-fwd-config.h"
+
+/* cfg->dscp value copying the DSCP of the packet to the outer header */
+#define ASNFWD_DSCP_COPY 64
+
+u8 asnfwd_ecn_encap(u8 tos, const struct asnfwd_config *cfg);
+int asnfwd_ecn_decap(u8 outer, u8 *inner, const struct asnfwd_config *cfg);
+
+#endif /* _ASN_FWD_ECN_H */
@@ -0,0 +1,468 @@
+#include <linux/hashtable.h>       // included for DEFINE_HASHTABLE and the hash_* helpers
+#include <linux/jhash.h>           // included for jhash2
+#include <linux/random.h>          // included for get_random_bytes
+#include <linux/workqueue.h>       // included for the garbage collector work
+#include <linux/seq_file.h>        // included for seq_printf and single_open
+#include <linux/netfilter.h>       // included for the NF_* verdicts
+#include <net/dst.h>               // included for struct dst_entry
+#include <net/netns/hash.h>        // included for net_hash_mix
+#include <net/net_namespace.h>     // included for rt_genid_ipv4 and register_pernet_subsys
+#include "asn-fwd-flow.h"
+#include "asn-fwd-common.h"
+#include "asn-fwd-stats.h"
+#include "asn-fwd-latency.h"
+#include "asn-fwd-ipip.h"
+#include "asn-fwd-options.h"
+#include "asn-fwd-shim.h"
+#include "asn-fwd-sample.h"
+#include "asn-fwd-hh.h"
+#include "asn-fwd-drop.h"
+
+#define ASNFWD_FLOW_BITS 12
+
+unsigned int flow_max = 65536;
+unsigned int flow_timeout = 30;
+
+static DEFINE_HASHTABLE(asnfwd_flow_table, ASNFWD_FLOW_BITS);
+static DEFINE_SPINLOCK(asnfwd_flow_lock);
+static atomic_t asnfwd_flow_count = ATOMIC_INIT(0);
+static u32 asnfwd_flow_rnd;
+
+static void asnfwd_flow_gc(struct work_struct *work);
+static DECLARE_DELAYED_WORK(asnfwd_flow_gc_work, asnfwd_flow_gc);
+
+static u32 asnfwd_flow_hash(struct net *net, const struct asnfwd_flow_key *key)
+{
+	return jhash2((const u32 *) key, sizeof(*key) / sizeof(u32),
+	              asnfwd_flow_rnd ^ net_hash_mix(net));
+}
+
+static int asnfwd_flow_overhead(const struct asnfwd_flow *flow)
+{
+	return asnfwd_format_overhead(flow->format);
+}
+
+static void asnfwd_flow_free_rcu(struct rcu_head *head)
+{
+	struct asnfwd_flow *flow = container_of(head, struct asnfwd_flow, rcu);
+
+	asnfwd_tunnel_put(flow->tun);
+	kfree(flow);
+}
+
+/* must be called with asnfwd_flow_lock held */
+static void __asnfwd_flow_del(struct asnfwd_flow *flow)
+{
+	/* someone else may have removed it already */
+	if (hlist_unhashed(&flow->node))
+		return;
+
+	hash_del_rcu(&flow->node);
+	atomic_dec(&asnfwd_flow_count);
+	call_rcu(&flow->rcu, asnfwd_flow_free_rcu);
+
+	ASNFWD_INC(flow_removed);
+}
+
+static void asnfwd_flow_del(struct asnfwd_flow *flow)
+{
+	spin_lock_bh(&asnfwd_flow_lock);
+	__asnfwd_flow_del(flow);
+	spin_unlock_bh(&asnfwd_flow_lock);
+}
+
+static struct asnfwd_flow *__asnfwd_flow_find(struct net *net,
+                                              const struct asnfwd_flow_key *key,
+                                              u32 hash)
+{
+	struct asnfwd_flow *flow;
+
+	hash_for_each_possible_rcu(asnfwd_flow_table, flow, node, hash)
+	{
+		if (flow->hash == hash && net_eq(flow->net, net) &&
+		    memcmp(&flow->key, key, sizeof(*key)) == 0)
+			return flow;
+	}
+
+	return NULL;
+}
+
+/**
+ * asnfwd_flow_key - build the flow key of a packet
+ * @skb: the socket buffer
+ * @in: The input device, if incoming packet
+ * @key: the key to fill
+ *
+ * Ports are only looked at for unfragmented TCP, UDP, UDP-Lite, DCCP
+ * and SCTP packets, everything else is keyed by addresses and protocol.
+ */
+void asnfwd_flow_key(struct sk_buff *skb,
+                     const struct net_device *in,
+                     struct asnfwd_flow_key *key)
+{
+	const struct iphdr *iph = ip_hdr(skb);
+	__be16 _ports[2], *ports;
+
+	/* the key is hashed and compared as raw memory, clear the padding */
+	memset(key, 0, sizeof(*key));
+
+	key->saddr = iph->saddr;
+	key->daddr = iph->daddr;
+	key->protocol = iph->protocol;
+	key->ifindex = in ? in->ifindex : 0;
+
+	if (ip_is_fragment(iph))
+		return;
+
+	switch (iph->protocol)
+	{
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+	case IPPROTO_DCCP:
+	case IPPROTO_SCTP:
+		ports = skb_header_pointer(skb, iph->ihl * 4, sizeof(_ports), _ports);
+		if (ports)
+		{
+			key->sport = ports[0];
+			key->dport = ports[1];
+		}
+		break;
+	}
+}
+
+/**
+ * asnfwd_flow_find - find the offloaded flow of a packet
+ * @net: network namespace of the packet
+ * @key: the packet flow key, see asnfwd_flow_key
+ * @cfg: configuration of the namespace
+ *
+ * Must be called under rcu_read_lock, which netfilter hooks already
+ * hold. Flows offloaded before the configuration or the routing
+ * changed are removed and not returned, so the packet goes through
+ * the slow path and offloads the flow again.
+ */
+struct asnfwd_flow *asnfwd_flow_find(struct net *net,
+                                     const struct asnfwd_flow_key *key,
+                                     const struct asnfwd_config *cfg)
+{
+	struct asnfwd_flow *flow;
+
+	if (atomic_read(&asnfwd_flow_count) == 0)
+		return NULL;
+
+	flow = __asnfwd_flow_find(net, key, asnfwd_flow_hash(net, key));
+	if (!flow)
+		return NULL;
+
+	/* the ASN table is a routing table, its changes bump the genid as well */
+	if (flow->cfg_gen != cfg->gen || flow->genid != rt_genid_ipv4(net))
+	{
+		PRINTK("Flow to %pI4 via %pI4 invalidated\n", &flow->key.daddr, &flow->tun->gw);
+		asnfwd_flow_del(flow);
+		return NULL;
+	}
+
+	return flow;
+}
+
+/**
+ * asnfwd_flow_usable - check if a packet can be sent through its offloaded flow
+ * @flow: the offloaded flow
+ * @skb: the socket buffer
+ * @in: The input device, if incoming packet
+ * @info: the options layout, filled for asnfwd_flow_xmit in OPTIONS format
+ *
+ * Only packets the slow path would not encapsulate are refused here, the
+ * forwarding checks are done by asnfwd_tunnel_xmit for both paths.
+ */
+bool asnfwd_flow_usable(struct asnfwd_flow *flow,
+                        struct sk_buff *skb,
+                        const struct net_device *in,
+                        struct asnfwd_optinfo *info)
+{
+	/* packets carrying an ASN-FWD option are decapsulated by the slow path */
+	if (flow->format == ASNFWD_FORMAT_OPTIONS &&
+	    (asnfwd_parse_options(ip_hdr(skb), info) != 0 || info->asn))
+		return false;
+
+	return true;
+}
+
+/**
+ * asnfwd_flow_xmit - encapsulate and send a packet of an offloaded flow
+ * @flow: the offloaded flow, see asnfwd_flow_usable
+ * @skb: the socket buffer
+ * @in: The input device, if incoming packet
+ * @info: the options layout given by asnfwd_flow_usable
+ * @cfg: configuration of the packet namespace
+ *
+ * The packet is encapsulated to the gateway of the flow, skipping the
+ * ASN lookup, and handed to asnfwd_tunnel_xmit. Offloading a flow admits
+ * nothing: with a FORWARD hook or an IPsec policy registered, each of its
+ * packets still goes through ip_forward and gets its own verdict.
+ */
+unsigned int asnfwd_flow_xmit(struct asnfwd_flow *flow,
+                              struct sk_buff *skb,
+                              const struct net_device *in,
+                              const struct asnfwd_optinfo *info,
+                              const struct asnfwd_config *cfg)
+{
+	struct asnfwd_tunnel *tun = flow->tun;
+	struct dst_entry *dst;
+	struct iphdr *iph;
+	int headroom = asnfwd_flow_overhead(flow);
+	u64 start;
+	int err;
+
+	/* make room for the link layer header as well, so the head is copied once */
+	dst = rcu_dereference(tun->dst);
+	if (dst)
+		headroom += LL_RESERVED_SPACE(dst->dev) + dst->header_len;
+
+	if (skb_headroom(skb) < headroom)
+		ASNFWD_INC(headroom_realloc);
+
+	if (skb_cow_head(skb, headroom))
+		return asnfwd_drop(skb, in, ASNFWD_DROP_NO_HEADROOM);
+
+	start = ASNFWD_LAT_START();
+
+	if (flow->format == ASNFWD_FORMAT_IPIP)
+		err = asnfwd_add_header(skb, tun, cfg);
+	else if (flow->format == ASNFWD_FORMAT_SHIM)
+		err = asnfwd_add_shim(skb, tun, cfg);
+	else
+		err = asnfwd_set_dst_from_table(skb, tun->gw, info);
+
+	ASNFWD_LAT_END(ASNFWD_LAT_ENCAP, start);
+
+	if (err != 0)
+		return asnfwd_drop(skb, in, asnfwd_drop_reason(err));
+
+	/* update iph pointer, may have changed above */
+	iph = ip_hdr(skb);
+
+	asnfwd_reset_csum(skb);
+
+	start = ASNFWD_LAT_START();
+	ip_send_check(iph);
+	ASNFWD_LAT_END(ASNFWD_LAT_CSUM, start);
+
+	if (flow->last_used != jiffies)
+		flow->last_used = jiffies;
+
+	ASNFWD_INC(flow_hits);
+
+	ASNFWD_SAMPLE(ASNFWD_SAMPLE_ENCAP, skb, in, tun->gw, flow->format);
+	ASNFWD_HH_HIT(flow->key.daddr, tun->gw);
+
+	return asnfwd_tunnel_xmit(tun, skb, in);
+}
+
+/**
+ * asnfwd_flow_add - offload a flow
+ * @net: network namespace of the flow
+ * @key: the flow key, taken before the packet was encapsulated
+ * @tun: the tunnel the flow is encapsulated to
+ * @cfg: configuration the flow was encapsulated with
+ *
+ * Called once the first packet went through the tunnel, flows are only
+ * offloaded when there is a route towards the gateway.
+ */
+void asnfwd_flow_add(struct net *net,
+                     const struct asnfwd_flow_key *key,
+                     struct asnfwd_tunnel *tun,
+                     const struct asnfwd_config *cfg)
+{
+	struct asnfwd_flow *flow;
+	u32 hash;
+
+	if (atomic_read(&asnfwd_flow_count) >= flow_max)
+	{
+		ASNFWD_INC(flow_full);
+		return;
+	}
+
+	if (!rcu_access_pointer(tun->dst))
+		return;
+
+	flow = kmalloc(sizeof(*flow), GFP_ATOMIC);
+	if (!flow)
+		return;
+
+	hash = asnfwd_flow_hash(net, key);
+
+	flow->net = net;
+	flow->key = *key;
+	flow->hash = hash;
+	flow->tun = tun;
+	flow->format = cfg->format;
+	flow->cfg_gen = cfg->gen;
+	flow->genid = rt_genid_ipv4(net);
+	flow->last_used = jiffies;
+
+	spin_lock_bh(&asnfwd_flow_lock);
+
+	/* another CPU may have offloaded the same flow meanwhile */
+	if (__asnfwd_flow_find(net, key, hash))
+	{
+		spin_unlock_bh(&asnfwd_flow_lock);
+		kfree(flow);
+		return;
+	}
+
+	asnfwd_tunnel_hold(tun);
+	hash_add_rcu(asnfwd_flow_table, &flow->node, hash);
+	atomic_inc(&asnfwd_flow_count);
+
+	spin_unlock_bh(&asnfwd_flow_lock);
+
+	ASNFWD_INC(flow_added);
+
+	PRINTK("Flow to %pI4 offloaded via %pI4\n", &key->daddr, &tun->gw);
+}
+
+/**
+ * asnfwd_flow_flush - remove offloaded flows
+ * @net: only remove flows of this namespace, NULL for all
+ * @ifindex: only remove flows coming from this device, 0 for all
+ */
+static void asnfwd_flow_flush(struct net *net, int ifindex)
+{
+	struct asnfwd_flow *flow;
+	struct hlist_node *tmp;
+	int bkt;
+
+	spin_lock_bh(&asnfwd_flow_lock);
+
+	hash_for_each_safe(asnfwd_flow_table, bkt, tmp, flow, node)
+	{
+		if (!net || (net_eq(flow->net, net) && (!ifindex || flow->key.ifindex == ifindex)))
+			__asnfwd_flow_del(flow);
+	}
+
+	spin_unlock_bh(&asnfwd_flow_lock);
+}
+
+static void asnfwd_flow_gc(struct work_struct *work)
+{
+	unsigned long timeout = flow_timeout * HZ;
+	struct asnfwd_flow *flow;
+	struct hlist_node *tmp;
+	int bkt;
+
+	spin_lock_bh(&asnfwd_flow_lock);
+
+	hash_for_each_safe(asnfwd_flow_table, bkt, tmp, flow, node)
+	{
+		if (time_after(jiffies, flow->last_used + timeout))
+			__asnfwd_flow_del(flow);
+	}
+
+	spin_unlock_bh(&asnfwd_flow_lock);
+
+	schedule_delayed_work(&asnfwd_flow_gc_work, HZ);
+}
+
+/* flows keep the input device index, drop them with the device */
+static int asnfwd_flow_netdev_event(struct notifier_block *nb,
+                                    unsigned long event,
+                                    void *ptr)
+{
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+
+	if (event == NETDEV_DOWN || event == NETDEV_UNREGISTER)
+		asnfwd_flow_flush(dev_net(dev), dev->ifindex);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block asnfwd_flow_notifier = {
+	.notifier_call = asnfwd_flow_netdev_event,
+};
+
+static void __net_exit asnfwd_flow_net_exit(struct net *net)
+{
+	asnfwd_flow_flush(net, 0);
+}
+
+static struct pernet_operations asnfwd_flow_net_ops = {
+	.exit = asnfwd_flow_net_exit,
+};
+
+static int asnfwd_flow_show(struct seq_file *m, void *v)
+{
+	struct asnfwd_flow *flow;
+	struct dst_entry *dst;
+	int bkt;
+
+	seq_printf(m, "flows: %d/%u\n", atomic_read(&asnfwd_flow_count), flow_max);
+
+	rcu_read_lock();
+
+	hash_for_each_rcu(asnfwd_flow_table, bkt, flow, node)
+	{
+		dst = rcu_dereference(flow->tun->dst);
+		seq_printf(m, "%pI4:%u -> %pI4:%u proto %u in %d via %pI4 dev %s format %s idle %ums\n",
+		           &flow->key.saddr, ntohs(flow->key.sport),
+		           &flow->key.daddr, ntohs(flow->key.dport),
+		           flow->key.protocol, flow->key.ifindex,
+		           &flow->tun->gw, dst ? dst->dev->name : "-", format_name[flow->format],
+		           jiffies_to_msecs(jiffies - flow->last_used));
+	}
+
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static int asnfwd_flow_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, asnfwd_flow_show, NULL);
+}
+
+static const struct file_operations asnfwd_flow_fops = {
+	.owner   = THIS_MODULE,
+	.open    = asnfwd_flow_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+int asnfwd_flow_init(void)
+{
+	int err;
+
+	get_random_bytes(&asnfwd_flow_rnd, sizeof(asnfwd_flow_rnd));
+
+	err = register_pernet_subsys(&asnfwd_flow_net_ops);
+	if (err != 0)
+		return err;
+
+	err = register_netdevice_notifier(&asnfwd_flow_notifier);
+	if (err != 0)
+	{
+		unregister_pernet_subsys(&asnfwd_flow_net_ops);
+		return err;
+	}
+
+	if (asnfwd_debugfs)
+		debugfs_create_file("flows", S_IRUSR, asnfwd_debugfs, NULL, &asnfwd_flow_fops);
+
+	schedule_delayed_work(&asnfwd_flow_gc_work, HZ);
+
+	return 0;
+}
+
+void asnfwd_flow_exit(void)
+{
+	cancel_delayed_work_sync(&asnfwd_flow_gc_work);
+	unregister_netdevice_notifier(&asnfwd_flow_notifier);
+	unregister_pernet_subsys(&asnfwd_flow_net_ops);
+
+	asnfwd_flow_flush(NULL, 0);
+
+	/* wait for the flows to be freed before the module goes away */
+	rcu_barrier();
+}
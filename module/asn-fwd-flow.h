@@ -0,0 +1,56 @@
+#ifndef _ASN_FWD_FLOW_H
+#define _ASN_FWD_FLOW_H
+
+#include <linux/skbuff.h>          // included for struct sk_buff and related functions
+#include <linux/netdevice.h>       // included for struct net_device
+#include "asn-fwd-tunnel.h"
+#include "asn-fwd-options.h"
+
+struct asnfwd_flow_key {
+	__be32 saddr;
+	__be32 daddr;
+	__be16 sport;
+	__be16 dport;
+	int    ifindex;  /* input device, 0 for locally generated packets */
+	__u8   protocol;
+};
+
+struct asnfwd_flow {
+	struct hlist_node      node;
+	struct rcu_head        rcu;
+	struct net            *net;
+	struct asnfwd_flow_key key;
+	u32                    hash;
+	struct asnfwd_tunnel  *tun;       /* ASN gateway the flow is encapsulated to, holds a reference */
+	unsigned int           format;    /* encapsulation applied to the flow */
+	unsigned int           cfg_gen;   /* asnfwd_config generation the flow was offloaded with */
+	int                    genid;     /* rt_genid_ipv4 when the flow was offloaded */
+	unsigned long          last_used;
+};
+
+extern unsigned int flow_max;
+extern unsigned int flow_timeout;
+
+void asnfwd_flow_key(struct sk_buff *skb,
+                     const struct net_device *in,
+                     struct asnfwd_flow_key *key);
+struct asnfwd_flow *asnfwd_flow_find(struct net *net,
+                                     const struct asnfwd_flow_key *key,
+                                     const struct asnfwd_config *cfg);
+bool asnfwd_flow_usable(struct asnfwd_flow *flow,
+                        struct sk_buff *skb,
+                        const struct net_device *in,
+                        struct asnfwd_optinfo *info);
+unsigned int asnfwd_flow_xmit(struct asnfwd_flow *flow,
+                              struct sk_buff *skb,
+                              const struct net_device *in,
+                              const struct asnfwd_optinfo *info,
+                              const struct asnfwd_config *cfg);
+void asnfwd_flow_add(struct net *net,
+                     const struct asnfwd_flow_key *key,
+                     struct asnfwd_tunnel *tun,
+                     const struct asnfwd_config *cfg);
+int asnfwd_flow_init(void);
+void asnfwd_flow_exit(void);
+
+#endif /* _ASN_FWD_FLOW_H */
@@ -0,0 +1,148 @@
+#include <linux/netdevice.h>       // included for the NAPI_GRO_CB and skb_gro_* helpers
+#include <linux/jhash.h>           // included for jhash_3words
+#include <linux/random.h>          // included for get_random_bytes
+#include <net/protocol.h>          // included for inet_add_offload
+#include "asn-fwd-gro.h"
+#include "asn-fwd-common.h"
+#include "asn-fwd-ipip.h"
+#include "asn-fwd-shim.h"
+
+static u32 asnfwd_gro_rnd;
+
+static bool asnfwd_gro_has_ports(u8 protocol)
+{
+	switch (protocol)
+	{
+	case IPPROTO_TCP:
+	case IPPROTO_UDP:
+	case IPPROTO_UDPLITE:
+	case IPPROTO_DCCP:
+	case IPPROTO_SCTP:
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * asnfwd_gro_receive - hash ASN-FWD IPIP and SHIM packets by their inner flow
+ * @head: the packets being merged
+ * @skb: the received packet, pulled up to the inner header
+ *
+ * GRO runs before RPS, so setting the hash here makes RPS/RFS, and the
+ * rest of the stack, spread the packets of one upstream box by their
+ * inner 5-tuple instead of the outer addresses. Packets are never merged.
+ */
+static struct sk_buff **asnfwd_gro_receive(struct sk_buff **head, struct sk_buff *skb)
+{
+	const struct iphdr *iph;
+	const struct asnfwd_shim *shim;
+	unsigned int off = skb_gro_offset(skb), poff, hlen;
+	__be32 saddr, daddr;
+	u32 ports = 0, hash;
+	__be16 *pp;
+	u8 protocol;
+	bool frag;
+
+	hlen = off + ASNFWD_SHIM_LEN;
+	shim = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen))
+	{
+		shim = skb_gro_header_slow(skb, hlen, off);
+		if (!shim)
+			goto out;
+	}
+
+	if (shim->version == ASNFWD_SHIM_VERSION)
+	{
+		/* SHIM format, the outer header is right before in the same area */
+		iph = (const void *) shim - sizeof(*iph);
+
+		saddr = iph->saddr;
+		daddr = shim->daddr;
+		protocol = shim->protocol;
+		frag = ip_is_fragment(iph);
+		poff = off + ASNFWD_SHIM_LEN;
+	}
+	else
+	{
+		hlen = off + sizeof(*iph);
+		iph = skb_gro_header_fast(skb, off);
+		if (skb_gro_header_hard(skb, hlen))
+		{
+			iph = skb_gro_header_slow(skb, hlen, off);
+			if (!iph)
+				goto out;
+		}
+
+		if (iph->version != 4 || iph->ihl < 5)
+			goto out;
+
+		saddr = iph->saddr;
+		daddr = iph->daddr;
+		protocol = iph->protocol;
+		frag = ip_is_fragment(iph);
+		poff = off + iph->ihl * 4;
+	}
+
+	if (!frag && asnfwd_gro_has_ports(protocol))
+	{
+		hlen = poff + 2 * sizeof(__be16);
+		pp = skb_gro_header_fast(skb, poff);
+		if (skb_gro_header_hard(skb, hlen))
+			pp = skb_gro_header_slow(skb, hlen, poff);
+
+		/* same value for both directions, like __skb_get_rxhash */
+		if (pp)
+			ports = (__force u32) (pp[0] < pp[1] ? (pp[0] << 16 | pp[1]) : (pp[1] << 16 | pp[0]));
+	}
+
+	if ((__force u32) saddr > (__force u32) daddr)
+		swap(saddr, daddr);
+
+	hash = jhash_3words((__force u32) saddr, (__force u32) daddr, ports ^ protocol, asnfwd_gro_rnd);
+
+	/*
+	 * the inner header was parsed, keep skb_get_rxhash from going back
+	 * to the outer addresses for inner packets without ports
+	 */
+	skb->rxhash = hash ? hash : 1;
+	skb->l4_rxhash = 1;
+
+out:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+
+static const struct net_offload asnfwd_gro_offload = {
+	.callbacks = {
+		.gro_receive = asnfwd_gro_receive,
+	},
+};
+
+/*
+ * The 3.x flow dissector can't be extended from a module, the GRO receive
+ * handler of ASNFWD_PROTOCOL is the last point before RPS where the hash
+ * can be set. It covers the IPIP and SHIM formats, both sent with that
+ * protocol. OPTIONS format packets are not covered and can't be: they
+ * keep the protocol of the inner packet, whose handler (TCP, UDP...)
+ * belongs to the stack, and inet_gro_receive does not pass headers with
+ * options to any handler. They don't need it much either: the header is
+ * the inner one, so the stack hashes them by source, gateway and inner
+ * ports, only the original destination saved in the option is not part
+ * of the hash. bench/rpsspread.sh shows the spread.
+ */
+int asnfwd_gro_init(void)
+{
+	get_random_bytes(&asnfwd_gro_rnd, sizeof(asnfwd_gro_rnd));
+
+	if (inet_add_offload(&asnfwd_gro_offload, ASNFWD_PROTOCOL) != 0)
+		return -EBUSY;
+
+	return 0;
+}
+
+void asnfwd_gro_exit(void)
+{
+	inet_del_offload(&asnfwd_gro_offload, ASNFWD_PROTOCOL);
+}
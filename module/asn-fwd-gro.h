@@ -0,0 +1,7 @@
+#ifndef _ASN_FWD_GRO_H
+#define _ASN_FWD_GRO_H
+
+int asnfwd_gro_init(void);
+void asnfwd_gro_exit(void);
+
+#endif /* _ASN_FWD_GRO_H */
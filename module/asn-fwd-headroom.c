@@ -0,0 +1,141 @@
+#include <linux/netdevice.h>       // included for struct net_device and the notifiers
+#include <linux/rtnetlink.h>       // included for rtnl_lock
+#include <linux/slab.h>            // included for kzalloc
+#include "asn-fwd-headroom.h"
+#include "asn-fwd-common.h"
+#include "asn-fwd-config.h"
+#include "asn-fwd-options.h"
+
+/*
+ * Headroom added to a device, so locally generated packets are allocated
+ * with room for the outer header or the option and asnfwd_add_header
+ * never has to reallocate them.
+ */
+struct asnfwd_headroom {
+	struct list_head   list;
+	struct net_device *dev;
+	unsigned short     added;
+};
+
+/* protected by RTNL */
+static LIST_HEAD(asnfwd_headroom_list);
+
+static struct asnfwd_headroom *asnfwd_headroom_find(const struct net_device *dev)
+{
+	struct asnfwd_headroom *hr;
+
+	list_for_each_entry(hr, &asnfwd_headroom_list, list)
+	{
+		if (hr->dev == dev)
+			return hr;
+	}
+
+	return NULL;
+}
+
+/* 20 bytes in IPIP format, 8 in OPTIONS and SHIM formats */
+static unsigned short asnfwd_headroom_needed(struct net *net)
+{
+	const struct asnfwd_config *cfg;
+	unsigned short needed;
+
+	rcu_read_lock();
+	cfg = asnfwd_config(net);
+	needed = asnfwd_format_overhead(cfg->format);
+	rcu_read_unlock();
+
+	return needed;
+}
+
+/* must be called with RTNL held */
+static void asnfwd_headroom_set(struct net_device *dev)
+{
+	struct asnfwd_headroom *hr;
+	unsigned short needed;
+
+	/* packets to lo are not encapsulated */
+	if (dev->flags & IFF_LOOPBACK)
+		return;
+
+	needed = asnfwd_headroom_needed(dev_net(dev));
+
+	hr = asnfwd_headroom_find(dev);
+	if (!hr)
+	{
+		hr = kzalloc(sizeof(*hr), GFP_KERNEL);
+		if (!hr)
+			return;
+
+		hr->dev = dev;
+		list_add(&hr->list, &asnfwd_headroom_list);
+	}
+
+	/* someone else may have lowered it meanwhile */
+	if (dev->needed_headroom + needed < hr->added)
+		dev->needed_headroom = 0;
+	else
+		dev->needed_headroom += needed - hr->added;
+
+	hr->added = needed;
+}
+
+/* must be called with RTNL held */
+static void asnfwd_headroom_clear(struct net_device *dev)
+{
+	struct asnfwd_headroom *hr = asnfwd_headroom_find(dev);
+
+	if (!hr)
+		return;
+
+	if (dev->needed_headroom >= hr->added)
+		dev->needed_headroom -= hr->added;
+
+	list_del(&hr->list);
+	kfree(hr);
+}
+
+/**
+ * asnfwd_headroom_update - follow a format change of a namespace
+ * @net: the network namespace
+ */
+void asnfwd_headroom_update(struct net *net)
+{
+	struct net_device *dev;
+
+	rtnl_lock();
+
+	for_each_netdev(net, dev)
+		asnfwd_headroom_set(dev);
+
+	rtnl_unlock();
+}
+
+/* registering the notifier replays NETDEV_REGISTER for the existing
+   devices, and unregistering it replays NETDEV_UNREGISTER */
+static int asnfwd_headroom_netdev_event(struct notifier_block *nb,
+                                        unsigned long event,
+                                        void *ptr)
+{
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+
+	if (event == NETDEV_REGISTER)
+		asnfwd_headroom_set(dev);
+	else if (event == NETDEV_UNREGISTER)
+		asnfwd_headroom_clear(dev);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block asnfwd_headroom_notifier = {
+	.notifier_call = asnfwd_headroom_netdev_event,
+};
+
+int asnfwd_headroom_init(void)
+{
+	return register_netdevice_notifier(&asnfwd_headroom_notifier);
+}
+
+void asnfwd_headroom_exit(void)
+{
+	unregister_netdevice_notifier(&asnfwd_headroom_notifier);
+}
@@ -0,0 +1,10 @@
+#ifndef _ASN_FWD_HEADROOM_H
+#define _ASN_FWD_HEADROOM_H
+
+#include <net/net_namespace.h>     // included for struct net
+
+void asnfwd_headroom_update(struct net *net);
+int asnfwd_headroom_init(void);
+void asnfwd_headroom_exit(void);
+
+#endif /* _ASN_FWD_HEADROOM_H */
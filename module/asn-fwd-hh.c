@@ -0,0 +1,322 @@
+#include <linux/slab.h>            // included for kzalloc_node and kmalloc
+#include <linux/percpu.h>          // included for DEFINE_PER_CPU and get_cpu
+#include <linux/jhash.h>           // included for jhash_1word
+#include <linux/random.h>          // included for get_random_bytes
+#include <linux/mutex.h>           // included for DEFINE_MUTEX
+#include <linux/seq_file.h>        // included for seq_printf and single_open
+#include <linux/uaccess.h>         // included for copy_from_user
+#include "asn-fwd-hh.h"
+#include "asn-fwd-stats.h"
+
+#define ASNFWD_HH_DEPTH 4     /* rows of the count-min sketch */
+#define ASNFWD_HH_WIDTH 512   /* counters per row, a power of 2 */
+#define ASNFWD_HH_SETS  64    /* candidate sets, a power of 2 */
+#define ASNFWD_HH_WAYS  4     /* candidates per set */
+#define ASNFWD_HH_TOP   16    /* addresses reported per sketch */
+
+struct asnfwd_hh_cand {
+	__be32 addr;
+	u32    count;  /* estimate of the sketch when last seen, 0 for a free slot */
+};
+
+/*
+ * Count-min sketch of the packets per address, with the addresses whose
+ * estimate is the largest of their set kept as candidates, since the
+ * sketch can't be enumerated. Both have a fixed size: memory is bounded
+ * and each packet costs ASNFWD_HH_DEPTH hashes and ASNFWD_HH_WAYS compares.
+ */
+struct asnfwd_hh_sketch {
+	u32                   row[ASNFWD_HH_DEPTH][ASNFWD_HH_WIDTH];
+	struct asnfwd_hh_cand cand[ASNFWD_HH_SETS][ASNFWD_HH_WAYS];
+};
+
+struct asnfwd_hh {
+	struct asnfwd_hh_sketch sketch[ASNFWD_HH_SKETCHES];
+};
+
+static const char *asnfwd_hh_name[ASNFWD_HH_SKETCHES] = {
+	[ASNFWD_HH_HIT_DST]  = "hit_dst",
+	[ASNFWD_HH_HIT_GW]   = "hit_gw",
+	[ASNFWD_HH_MISS_DST] = "miss_dst",
+};
+
+struct static_key asnfwd_hh_key = STATIC_KEY_INIT_FALSE;
+
+/* too large for the module per CPU area, allocated on the node of each CPU */
+static DEFINE_PER_CPU(struct asnfwd_hh *, asnfwd_hh);
+
+static u32 asnfwd_hh_seed[ASNFWD_HH_DEPTH];
+
+/* serializes the debugfs writers */
+static DEFINE_MUTEX(asnfwd_hh_mutex);
+static bool asnfwd_hh_enabled;
+
+/**
+ * asnfwd_hh_add - count a packet of an address
+ * @sketch: one of ASNFWD_HH_*
+ * @addr: the destination or gateway address
+ *
+ * Only preemption is disabled: a softirq interrupting a local sender on
+ * the same CPU may lose a count or mix a candidate, acceptable for an
+ * estimate.
+ */
+void asnfwd_hh_add(unsigned int sketch, __be32 addr)
+{
+	struct asnfwd_hh_sketch *s;
+	struct asnfwd_hh_cand *set, *min;
+	u32 est = U32_MAX, h = 0, c;
+	int i;
+
+	s = &per_cpu(asnfwd_hh, get_cpu())->sketch[sketch];
+
+	for (i = 0; i < ASNFWD_HH_DEPTH; i++)
+	{
+		h = jhash_1word((__force u32) addr, asnfwd_hh_seed[i]);
+		c = ++s->row[i][h & (ASNFWD_HH_WIDTH - 1)];
+		if (c < est)
+			est = c;
+	}
+
+	/* the bits above the last row index pick the set */
+	set = s->cand[(h >> 16) & (ASNFWD_HH_SETS - 1)];
+	min = &set[0];
+
+	for (i = 0; i < ASNFWD_HH_WAYS; i++)
+	{
+		if (set[i].addr == addr && set[i].count)
+		{
+			set[i].count = est;
+			goto out;
+		}
+
+		if (set[i].count < min->count)
+			min = &set[i];
+	}
+
+	if (est > min->count)
+	{
+		min->addr = addr;
+		min->count = est;
+	}
+
+out:
+	put_cpu();
+}
+
+/* estimate of the merged sketch, the smallest counter of the address */
+static u32 asnfwd_hh_estimate(u32 (*row)[ASNFWD_HH_WIDTH], __be32 addr)
+{
+	u32 est = U32_MAX, h;
+	int i;
+
+	for (i = 0; i < ASNFWD_HH_DEPTH; i++)
+	{
+		h = jhash_1word((__force u32) addr, asnfwd_hh_seed[i]);
+		est = min(est, row[i][h & (ASNFWD_HH_WIDTH - 1)]);
+	}
+
+	return est;
+}
+
+/**
+ * asnfwd_hh_top - merge the per CPU copies of a sketch and report its top
+ * @m: the seq file
+ * @sketch: one of ASNFWD_HH_*
+ * @row: room for the merged counters
+ *
+ * The candidates of every CPU are estimated against the sum of all the
+ * sketches, so an address spread over CPUs is counted in full.
+ */
+static void asnfwd_hh_top(struct seq_file *m, unsigned int sketch, u32 (*row)[ASNFWD_HH_WIDTH])
+{
+	struct asnfwd_hh_cand top[ASNFWD_HH_TOP];
+	const struct asnfwd_hh_sketch *s;
+	const struct asnfwd_hh_cand *c;
+	__be32 addr;
+	u32 est;
+	int cpu, i, j, k, n = 0;
+
+	memset(row, 0, sizeof(u32) * ASNFWD_HH_DEPTH * ASNFWD_HH_WIDTH);
+
+	for_each_possible_cpu(cpu)
+	{
+		s = &per_cpu(asnfwd_hh, cpu)->sketch[sketch];
+
+		for (i = 0; i < ASNFWD_HH_DEPTH; i++)
+			for (j = 0; j < ASNFWD_HH_WIDTH; j++)
+				row[i][j] += ACCESS_ONCE(s->row[i][j]);
+	}
+
+	for_each_possible_cpu(cpu)
+	{
+		c = &per_cpu(asnfwd_hh, cpu)->sketch[sketch].cand[0][0];
+
+		for (i = 0; i < ASNFWD_HH_SETS * ASNFWD_HH_WAYS; i++)
+		{
+			if (!ACCESS_ONCE(c[i].count))
+				continue;
+
+			addr = ACCESS_ONCE(c[i].addr);
+
+			for (k = 0; k < n && top[k].addr != addr; k++)
+				;
+
+			if (k < n)
+				continue;
+
+			est = asnfwd_hh_estimate(row, addr);
+
+			/* insertion into the top, kept sorted */
+			if (n < ASNFWD_HH_TOP)
+				n++;
+			else if (est <= top[n - 1].count)
+				continue;
+
+			for (k = n - 1; k > 0 && top[k - 1].count < est; k--)
+				top[k] = top[k - 1];
+
+			top[k].addr = addr;
+			top[k].count = est;
+		}
+	}
+
+	seq_printf(m, "%s\n", asnfwd_hh_name[sketch]);
+
+	for (k = 0; k < n; k++)
+		seq_printf(m, "  %-15pI4 %u\n", &top[k].addr, top[k].count);
+}
+
+static int asnfwd_hh_show(struct seq_file *m, void *v)
+{
+	u32 (*row)[ASNFWD_HH_WIDTH];
+	int i;
+
+	seq_printf(m, "enabled %u\n", asnfwd_hh_enabled);
+
+	row = kmalloc(sizeof(u32) * ASNFWD_HH_DEPTH * ASNFWD_HH_WIDTH, GFP_KERNEL);
+	if (!row)
+		return -ENOMEM;
+
+	for (i = 0; i < ASNFWD_HH_SKETCHES; i++)
+		asnfwd_hh_top(m, i, row);
+
+	kfree(row);
+
+	return 0;
+}
+
+static int asnfwd_hh_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, asnfwd_hh_show, NULL);
+}
+
+/* "on", "off" or "reset", counts are kept while off */
+static ssize_t asnfwd_hh_write(struct file *file,
+                               const char __user *ubuf,
+                               size_t count,
+                               loff_t *ppos)
+{
+	char buf[16], *cmd;
+	ssize_t ret = count;
+	int cpu;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+
+	buf[count] = '\0';
+	cmd = strim(buf);
+
+	mutex_lock(&asnfwd_hh_mutex);
+
+	if (strcmp(cmd, "on") == 0)
+	{
+		if (!asnfwd_hh_enabled)
+			static_key_slow_inc(&asnfwd_hh_key);
+		asnfwd_hh_enabled = true;
+	}
+	else if (strcmp(cmd, "off") == 0)
+	{
+		if (asnfwd_hh_enabled)
+			static_key_slow_dec(&asnfwd_hh_key);
+		asnfwd_hh_enabled = false;
+	}
+	else if (strcmp(cmd, "reset") == 0)
+	{
+		/* packets counted meanwhile may leave a few stale counts */
+		for_each_possible_cpu(cpu)
+			memset(per_cpu(asnfwd_hh, cpu), 0, sizeof(struct asnfwd_hh));
+	}
+	else
+	{
+		ret = -EINVAL;
+	}
+
+	mutex_unlock(&asnfwd_hh_mutex);
+
+	return ret;
+}
+
+static const struct file_operations asnfwd_hh_fops = {
+	.owner   = THIS_MODULE,
+	.open    = asnfwd_hh_open,
+	.read    = seq_read,
+	.write   = asnfwd_hh_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+static void asnfwd_hh_free(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		kfree(per_cpu(asnfwd_hh, cpu));
+		per_cpu(asnfwd_hh, cpu) = NULL;
+	}
+}
+
+/**
+ * asnfwd_hh_init - allocate the sketches and create the debugfs file
+ *
+ * The sketches are off until "on" is written to asn-fwd/heavy_hitters,
+ * the report is read from the same file.
+ */
+int asnfwd_hh_init(void)
+{
+	int cpu;
+
+	if (!asnfwd_debugfs)
+		return -ENODEV;
+
+	for_each_possible_cpu(cpu)
+	{
+		per_cpu(asnfwd_hh, cpu) = kzalloc_node(sizeof(struct asnfwd_hh), GFP_KERNEL, cpu_to_node(cpu));
+		if (!per_cpu(asnfwd_hh, cpu))
+		{
+			asnfwd_hh_free();
+			return -ENOMEM;
+		}
+	}
+
+	get_random_bytes(asnfwd_hh_seed, sizeof(asnfwd_hh_seed));
+
+	debugfs_create_file("heavy_hitters", S_IRUSR | S_IWUSR, asnfwd_debugfs, NULL, &asnfwd_hh_fops);
+
+	return 0;
+}
+
+void asnfwd_hh_exit(void)
+{
+	/* the hooks are gone, nobody runs the patched code anymore */
+	mutex_lock(&asnfwd_hh_mutex);
+	if (asnfwd_hh_enabled)
+		static_key_slow_dec(&asnfwd_hh_key);
+	asnfwd_hh_enabled = false;
+	mutex_unlock(&asnfwd_hh_mutex);
+
+	asnfwd_hh_free();
+}
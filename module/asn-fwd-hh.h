@@ -0,0 +1,31 @@
+#ifndef _ASN_FWD_HH_H
+#define _ASN_FWD_HH_H
+
+#include <linux/types.h>           // included for __be32
+#include <linux/jump_label.h>      // included for struct static_key and static_key_false
+
+#define ASNFWD_HH_HIT_DST  0  /* destinations encapsulated to a gateway */
+#define ASNFWD_HH_HIT_GW   1  /* gateways packets were encapsulated to */
+#define ASNFWD_HH_MISS_DST 2  /* destinations with no ASN route, lookup on */
+#define ASNFWD_HH_SKETCHES 3
+
+extern struct static_key asnfwd_hh_key;
+
+void asnfwd_hh_add(unsigned int sketch, __be32 addr);
+int asnfwd_hh_init(void);
+void asnfwd_hh_exit(void);
+
+/* patched out jumps unless enabled through debugfs asn-fwd/heavy_hitters */
+#define ASNFWD_HH_HIT(daddr, gw) \
+	do { \
+		if (static_key_false(&asnfwd_hh_key)) \
+		{ \
+			asnfwd_hh_add(ASNFWD_HH_HIT_DST, daddr); \
+			asnfwd_hh_add(ASNFWD_HH_HIT_GW, gw); \
+		} \
+	} while (0)
+
+#define ASNFWD_HH_MISS(daddr) \
+	do { if (static_key_false(&asnfwd_hh_key)) asnfwd_hh_add(ASNFWD_HH_MISS_DST, daddr); } while (0)
+
+#endif /* _ASN_FWD_HH_H */
@@ -0,0 +1,161 @@
+#include <linux/firmware.h>        // included for request_firmware
+#include <linux/device.h>          // included for root_device_register
+#include <linux/vmalloc.h>         // included for vmalloc
+#include <linux/crc32.h>           // included for crc32_le
+#include <linux/seq_file.h>        // included for seq_printf and single_open
+#include <linux/uaccess.h>         // included for copy_from_user
+#include "asn-fwd-image.h"
+#include "asn-fwd-lpm.h"
+#include "asn-fwd-stats.h"
+
+char *image = "";
+
+static u64 asnfwd_image_serial;
+
+/**
+ * asnfwd_image_parse - check an image and publish its ranges
+ * @data: the image
+ * @size: size of the image
+ *
+ * The ranges are converted to host order and handed to the lookup as
+ * they are, no prefix has to be resolved at init.
+ */
+static int asnfwd_image_parse(const u8 *data, size_t size)
+{
+	const struct asnfwd_image_hdr *hdr = (const void *) data;
+	const struct asnfwd_image_range *ir;
+	struct asnfwd_lpm_range *r;
+	unsigned int hdr_len, count, i;
+	int err;
+
+	if (size < sizeof(*hdr) || ntohl(hdr->magic) != ASNFWD_IMAGE_MAGIC)
+		return -EINVAL;
+
+	if (ntohs(hdr->version) != ASNFWD_IMAGE_VERSION)
+		return -EPROTONOSUPPORT;
+
+	hdr_len = ntohs(hdr->hdr_len);
+	count = ntohl(hdr->count);
+
+	if (hdr_len < sizeof(*hdr) || hdr_len > size ||
+	    (size - hdr_len) / sizeof(*ir) != count || (size - hdr_len) % sizeof(*ir) != 0)
+		return -EINVAL;
+
+	ir = (const void *) (data + hdr_len);
+
+	if ((crc32_le(~0, (const void *) ir, count * sizeof(*ir)) ^ ~0) != ntohl(hdr->crc))
+		return -EBADMSG;
+
+	r = vmalloc(max(count, 1U) * sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++)
+	{
+		r[i].start = ntohl(ir[i].start);
+		r[i].end = ntohl(ir[i].end);
+		r[i].gw = ir[i].gw;
+
+		/* the lookup is a binary search, the ranges must be sorted and disjoint */
+		if (r[i].start > r[i].end || (i > 0 && r[i].start <= r[i - 1].end))
+		{
+			vfree(r);
+			return -EINVAL;
+		}
+	}
+
+	err = asnfwd_lpm_image_set(r, count);
+	vfree(r);
+
+	if (err == 0)
+		asnfwd_image_serial = be64_to_cpu(hdr->serial);
+
+	return err;
+}
+
+static int asnfwd_image_show(struct seq_file *m, void *v)
+{
+	seq_printf(m, "image %s\n", image[0] ? image : "none");
+	seq_printf(m, "serial %llu\n", asnfwd_image_serial);
+	seq_printf(m, "ranges %u\n", asnfwd_lpm_image_ranges());
+
+	return 0;
+}
+
+static int asnfwd_image_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, asnfwd_image_show, NULL);
+}
+
+/* "drop", once the control plane pushed the whole table */
+static ssize_t asnfwd_image_write(struct file *file,
+                                  const char __user *ubuf,
+                                  size_t count,
+                                  loff_t *ppos)
+{
+	char buf[16];
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+
+	buf[count] = '\0';
+
+	if (strcmp(strim(buf), "drop") != 0)
+		return -EINVAL;
+
+	asnfwd_lpm_image_drop();
+	printk(KERN_INFO "[ASN-FWD] Prebuilt table dropped\n");
+
+	return count;
+}
+
+static const struct file_operations asnfwd_image_fops = {
+	.owner   = THIS_MODULE,
+	.open    = asnfwd_image_open,
+	.read    = seq_read,
+	.write   = asnfwd_image_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * The copies of the image are freed by asnfwd_lpm_exit. Not fatal when
+ * the image is missing or broken: the box forwards with the routes the
+ * control plane pushes, as without an image.
+ */
+int asnfwd_image_init(void)
+{
+	const struct firmware *fw;
+	struct device *dev;
+	int err;
+
+	if (asnfwd_debugfs)
+		debugfs_create_file("image", S_IRUSR | S_IWUSR, asnfwd_debugfs, NULL, &asnfwd_image_fops);
+
+	if (!image[0])
+		return 0;
+
+	/* request_firmware wants a device */
+	dev = root_device_register("asn-fwd");
+	if (IS_ERR(dev))
+		return PTR_ERR(dev);
+
+	err = request_firmware(&fw, image, dev);
+	if (err == 0)
+	{
+		err = asnfwd_image_parse(fw->data, fw->size);
+		release_firmware(fw);
+	}
+
+	root_device_unregister(dev);
+
+	if (err != 0)
+		printk(KERN_WARNING "[ASN-FWD] Cannot load prebuilt table %s: %d\n", image, err);
+	else
+		printk(KERN_INFO "[ASN-FWD] Prebuilt table %s loaded, %u ranges\n", image, asnfwd_lpm_image_ranges());
+
+	return err;
+}
@@ -0,0 +1,37 @@
+#ifndef _ASN_FWD_IMAGE_H
+#define _ASN_FWD_IMAGE_H
+
+#include <linux/types.h>           // included for __be32 and friends, shared with mktable/
+
+/*
+ * Prebuilt ASN table, compiled by mktable and loaded at init through
+ * request_firmware. All fields are in network order. The header is
+ * followed by count sorted disjoint ranges, the layout the lookup uses.
+ */
+#define ASNFWD_IMAGE_MAGIC   0x41534e54  /* "ASNT" */
+#define ASNFWD_IMAGE_VERSION 1
+
+struct asnfwd_image_hdr {
+	__be32 magic;
+	__be16 version;
+	__be16 hdr_len;    /* ranges start at this offset */
+	__be32 count;      /* number of ranges */
+	__be32 crc;        /* crc32 (zlib) of the ranges */
+	__be64 serial;     /* set by mktable, seconds since the epoch */
+};
+
+struct asnfwd_image_range {
+	__be32 start;
+	__be32 end;
+	__be32 gw;         /* 0 if the most specific route has no ASN */
+};
+
+#ifdef __KERNEL__
+
+extern char *image;
+
+int asnfwd_image_init(void);
+
+#endif /* __KERNEL__ */
+
+#endif /* _ASN_FWD_IMAGE_H */
@@ -1,33 +1,33 @@
+#include <net/route.h>             // included for inet_addr_type
 #include "asn-fwd-ipip.h"
 #include "asn-fwd-common.h"
-
-/*
-181		 if (unlikely(skb_headroom(skb) < hh_len && dev->header_ops)) {
-182				 struct sk_buff *skb2;
-183 
-184				 skb2 = skb_realloc_headroom(skb, LL_RESERVED_SPACE(dev));
-185				 if (skb2 == NULL) {
-186						 kfree_skb(skb);
-187						 return -ENOMEM;
-188				 }
-189				 if (skb->sk)
-190						 skb_set_owner_w(skb2, skb->sk);
-191				 consume_skb(skb);
-192				 skb = skb2;
-193		 }
-*/
+#include "asn-fwd-skcache.h"
+#include "asn-fwd-latency.h"
+#include "asn-fwd-stats.h"
+#include "asn-fwd-ecn.h"
+#include "asn-fwd-drop.h"
+#include "asn-fwd-hh.h"
 
 /**
  * asnfwd_add_header - add the outer ANSFWD IPv4 header
  * @skb: the socket buffer
- * @addr: the ASN destination address
+ * @tun: the tunnel of the ASN destination address
+ * @cfg: configuration of the packet namespace
  *
  * This function adds the outer IPv4 header with the destination address
- * set to the ASN looked at the ASNFWD_TABLE
+ * set to the ASN looked at the ASNFWD_TABLE. The header is copied from
+ * the tunnel template, only the fields taken from the inner header are
+ * set per packet. Packets without enough headroom are reallocated,
+ * which the headroom reserved on the egress devices should avoid.
+ * With cfg->std_ipip on, the outer protocol is IPPROTO_IPIP and the packet
+ * is marked as encapsulated, so the stock IPIP GSO and the NIC tunnel
+ * offloads segment and checksum it.
  */
-int asnfwd_add_header(struct sk_buff *skb, __be32 addr)
+int asnfwd_add_header(struct sk_buff *skb,
+                      const struct asnfwd_tunnel *tun,
+                      const struct asnfwd_config *cfg)
 {
-	struct iphdr *iph = ip_hdr(skb);
+	struct iphdr *iph;
 	struct iphdr *orig_iph;
 	int err = 0;
 
@@ -35,8 +35,33 @@ int asnfwd_add_header(struct sk_buff *skb, __be32 addr)
 	if (skb_headroom(skb) < sizeof(struct iphdr))
 	{
 		PRINTK("No space to add header. SKB headroom = %d\n", skb_headroom(skb));
-		err = ENOMEM;
-		goto end;
+		ASNFWD_INC(headroom_realloc);
+
+		if (skb_cow_head(skb, sizeof(struct iphdr)))
+		{
+			err = -ENOBUFS;
+			goto end;
+		}
+	}
+
+	if (cfg->std_ipip == ASNFWD_STD_IPIP_ON)
+	{
+		/* gso_type is in the shared info, it can't be shared with a clone */
+		if (skb_is_gso(skb) && skb_unclone(skb, GFP_ATOMIC))
+		{
+			err = -ENOMEM;
+			goto end;
+		}
+
+		/* same as iptunnel_handle_offloads, before the outer header is pushed */
+		if (!skb->encapsulation)
+		{
+			skb_reset_inner_headers(skb);
+			skb->encapsulation = 1;
+		}
+
+		if (skb_is_gso(skb))
+			skb_shinfo(skb)->gso_type |= SKB_GSO_IPIP;
 	}
 
 	/* push data a few bytes right to make room for ASN-FWD header */
@@ -46,26 +71,24 @@ int asnfwd_add_header(struct sk_buff *skb, __be32 addr)
 	skb_reset_network_header(skb);
 	skb_set_transport_header(skb, sizeof(struct iphdr));
 
-	/* clear the new space */
-	memset((void *) ip_hdr(skb), 0, sizeof(struct iphdr));
-
 	/* update iph pointer */
 	iph = ip_hdr(skb);
 
 	/* set orig_iph pointer */
 	orig_iph = ipip_hdr(skb);
 
-	/* fill the ASN-FWD option struct and copy it to the end of the IP header */
-	iph->version = IPVERSION;
-	iph->ihl = sizeof(struct iphdr) >> 2;
-	iph->tos = orig_iph->tos;
+	/* version, ihl, protocol and daddr come from the template */
+	memcpy(iph, &tun->tmpl, sizeof(struct iphdr));
+
+	if (cfg->std_ipip == ASNFWD_STD_IPIP_ON)
+		iph->protocol = IPPROTO_IPIP;
+
+	iph->tos = asnfwd_ecn_encap(orig_iph->tos, cfg);
 	iph->tot_len = htons(ntohs(orig_iph->tot_len) + sizeof(struct iphdr));
 	iph->id = orig_iph->id;
 	iph->frag_off = orig_iph->frag_off;
 	iph->ttl = orig_iph->ttl;
-	iph->protocol = ASNFWD_PROTOCOL;
 	iph->saddr = orig_iph->saddr;
-	iph->daddr = addr;
 
 	/* checksum will be recalculated in asnfwd_hook */
 
@@ -76,17 +99,33 @@ end:
 /**
  * ansfwd_remove_header - remove the outer ASNFWD IPv4 header
  * @skb: the socket buffer
+ * @cfg: configuration of the packet namespace
  *
- * This function removes the outer IPv4 header added previously by the ASN-FWD-Box
+ * This function removes the outer IPv4 header added previously by the ASN-FWD-Box.
+ * The TTL and the ECN marks of the outer header are copied to the inner one.
+ * Returns -ENODATA if the packet is truncated and -EINVAL if its ECN marks
+ * make it a drop, see asnfwd_ecn_decap.
  */
-void asnfwd_remove_header(struct sk_buff *skb)
+int asnfwd_remove_header(struct sk_buff *skb, const struct asnfwd_config *cfg)
 {
 	struct iphdr *iph = ip_hdr(skb);
 	__u8 ttl = iph->ttl;
+	__u8 tos = iph->tos;
+	__u8 inner_tos;
+
+	/* not a ASNFWD packet, see asnfwd_is_ipip */
+	if (iph->protocol != ASNFWD_PROTOCOL && iph->protocol != IPPROTO_IPIP)
+		return 0;
+
+	if (!pskb_may_pull(skb, iph->ihl * 4 + sizeof(struct iphdr)))
+		return -ENODATA;
 
-	/* not a ASNFWD packet */
-	if (iph->protocol != ASNFWD_PROTOCOL)
-		return;
+	/* the outer header may have moved */
+	iph = ip_hdr(skb);
+
+	inner_tos = ((struct iphdr *) ((void *) iph + iph->ihl * 4))->tos;
+	if (asnfwd_ecn_decap(tos, &inner_tos, cfg) != 0)
+		return -EINVAL;
 
 	/* pull buffer data pointer to overwrite ASN-FWD header */
 	skb_pull(skb, iph->ihl * 4);
@@ -97,20 +136,54 @@ void asnfwd_remove_header(struct sk_buff *skb)
 	/* update iph pointer */
 	iph = ip_hdr(skb);
 
-	/* copy outer TTL to inner IP header */
+	/* copy outer TTL and ECN marks to inner IP header */
 	iph->ttl = ttl;
+	iph->tos = inner_tos;
 
 	/* checksum will be recalculated in asnfwd_hook */
+
+	return 0;
+}
+
+/**
+ * asnfwd_is_ipip - tell whether an IPIP format packet is to be decapsulated
+ * @iph: IP header
+ * @in: The input device, NULL for locally generated packets
+ * @cfg: configuration of the packet namespace
+ *
+ * Protocol 4 is also used by tunnels that have nothing to do with the
+ * ASN-FWD-Box: it is only taken, with std_ipip on, for packets received
+ * for one of our addresses. Transit IPIP and the output of the stock
+ * ipip devices of the box are left alone.
+ */
+bool asnfwd_is_ipip(const struct iphdr *iph,
+                    const struct net_device *in,
+                    const struct asnfwd_config *cfg)
+{
+	if (iph->protocol == ASNFWD_PROTOCOL)
+		return true;
+
+	if (iph->protocol != IPPROTO_IPIP || cfg->std_ipip == ASNFWD_STD_IPIP_OFF || !in)
+		return false;
+
+	return inet_addr_type(dev_net(in), iph->daddr) == RTN_LOCAL;
 }
 
 unsigned int asnfwd_hook_ipip(const struct nf_hook_ops *ops,
                               struct sk_buff *skb,
                               const struct net_device *in,
                               const struct net_device *out,
-                              int (*okfn)(struct sk_buff *))
+                              int (*okfn)(struct sk_buff *),
+                              const struct asnfwd_config *cfg,
+                              struct asnfwd_tunnel **tunp,
+                              int *reason)
 {
 	struct iphdr *iph = ip_hdr(skb);
+	struct asnfwd_tunnel *tun;
 	__be32 addr = 0;
+	bool decap = asnfwd_is_ipip(iph, in, cfg);
+	u64 start;
+	int err;
 
 #if 0
 	/* lets begin with ICMP packets, to have some flow control */
@@ -118,26 +191,53 @@ unsigned int asnfwd_hook_ipip(const struct nf_hook_ops *ops,
 		return ASNFWD_SKIPPED;
 #endif // 0
 
-	if (iph->protocol == ASNFWD_PROTOCOL)
+	if (decap)
 	{
 		PRINTK("Is ASNFWD protocol\n");
 
-		asnfwd_remove_header(skb);
+		start = ASNFWD_LAT_START();
+		err = asnfwd_remove_header(skb, cfg);
+		ASNFWD_LAT_END(ASNFWD_LAT_ENCAP, start);
+
+		if (err != 0)
+		{
+			*reason = asnfwd_drop_reason(err);
+			return ASNFWD_BAD; /* truncated or CE marked without ECN support */
+		}
 	}
 	else
 	{
-		if ((addr = asnfwd_find_route(iph, in, out)) != 0)
+		if ((addr = asnfwd_sk_route(skb, in, out, cfg)) != 0)
 		{
 			PRINTK("Route found\n");
 
-			if (asnfwd_add_header(skb, addr) != 0)
+			tun = asnfwd_tunnel_get(dev_net(in ? in : out), addr);
+			if (!tun)
+			{
+				*reason = ASNFWD_DROP_NOMEM;
+				return ASNFWD_BAD; /* out of memory, better drop the packet */
+			}
+
+			start = ASNFWD_LAT_START();
+			err = asnfwd_add_header(skb, tun, cfg);
+			ASNFWD_LAT_END(ASNFWD_LAT_ENCAP, start);
+
+			if (err != 0)
+			{
+				asnfwd_tunnel_put(tun);
+				*reason = asnfwd_drop_reason(err);
 				return ASNFWD_BAD; /* something went wrong, better drop the packet */
+			}
+
+			*tunp = tun;
 		}
 		/* no table found, no route found or incomplete route found */
+		else if (cfg->lookup)
+			ASNFWD_HH_MISS(iph->daddr);
 	}
 
-	/* packet changed in some way */
-	if (iph->protocol == ASNFWD_PROTOCOL || addr)
+	/* packet changed in some way, iph is stale if the head was reallocated */
+	if (addr || decap)
 	{
 		/* update iph pointer, may have changed above */
 		iph = ip_hdr(skb);
@@ -146,7 +246,7 @@ unsigned int asnfwd_hook_ipip(const struct nf_hook_ops *ops,
 
 		/* no need to recalculate checksum for transport protocol,
 		   but the new IP header needs a new checksum */
-		skb->ip_summed = CHECKSUM_NONE;
+		asnfwd_reset_csum(skb);
 
 		/* recalculate IP checksum */
 		ip_send_check(iph);
@@ -4,15 +4,41 @@
 #include <linux/skbuff.h>          // included for struct sk_buff and related functions
 #include <linux/ip.h>              // included for struct iphdr, ntohs, htons and others
 #include <net/ip.h>                // included for ip_send_check
+#include "asn-fwd-config.h"
+#include "asn-fwd-tunnel.h"
 
 #define ASNFWD_PROTOCOL 254 // experimental
 
-int asnfwd_add_header(struct sk_buff *skb, __be32 addr);
-void asnfwd_remove_header(struct sk_buff *skb);
+/* outer protocol of the IPIP format, see asnfwd_config.std_ipip */
+#define ASNFWD_STD_IPIP_OFF 0  /* send and receive ASNFWD_PROTOCOL only */
+#define ASNFWD_STD_IPIP_RX  1  /* send ASNFWD_PROTOCOL, receive IPPROTO_IPIP sent to the box as well */
+#define ASNFWD_STD_IPIP_ON  2  /* send IPPROTO_IPIP, receive both */
+
+/*
+ * The IP header changed, a CHECKSUM_COMPLETE sum is no longer valid.
+ * Standard IPIP packets keep CHECKSUM_PARTIAL, the stock IPIP offloads
+ * finish the inner transport checksum.
+ */
+static inline void asnfwd_reset_csum(struct sk_buff *skb)
+{
+	if (!skb->encapsulation || skb->ip_summed != CHECKSUM_PARTIAL)
+		skb->ip_summed = CHECKSUM_NONE;
+}
+
+int asnfwd_add_header(struct sk_buff *skb,
+                      const struct asnfwd_tunnel *tun,
+                      const struct asnfwd_config *cfg);
+int asnfwd_remove_header(struct sk_buff *skb, const struct asnfwd_config *cfg);
+bool asnfwd_is_ipip(const struct iphdr *iph,
+                    const struct net_device *in,
+                    const struct asnfwd_config *cfg);
 unsigned int asnfwd_hook_ipip(const struct nf_hook_ops *ops,
                               struct sk_buff *skb,
                               const struct net_device *in,
                               const struct net_device *out,
-                              int (*okfn)(struct sk_buff *));
+                              int (*okfn)(struct sk_buff *),
+                              const struct asnfwd_config *cfg,
+                              struct asnfwd_tunnel **tun,
+                              int *reason);
 
 #endif /* _ASN_FWD_IPIP_H */
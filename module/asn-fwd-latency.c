@@ -0,0 +1,197 @@
+#include <linux/slab.h>            // included for kcalloc
+#include <linux/seq_file.h>        // included for seq_printf and single_open
+#include <linux/uaccess.h>         // included for copy_from_user
+#include <linux/log2.h>            // included for ilog2
+#include <linux/mutex.h>           // included for DEFINE_MUTEX
+#include "asn-fwd-latency.h"
+#include "asn-fwd-stats.h"
+
+struct static_key asnfwd_lat_key = STATIC_KEY_INIT_FALSE;
+
+static DEFINE_PER_CPU(struct asnfwd_lat, asnfwd_lat);
+
+/* serializes enabling and disabling the static key */
+static DEFINE_MUTEX(asnfwd_lat_mutex);
+static bool asnfwd_lat_enabled;
+
+static const char *asnfwd_lat_stage_name[ASNFWD_LAT_STAGES] = {
+	"lookup", "encap", "checksum",
+};
+
+static unsigned int asnfwd_lat_bucket(u64 ns)
+{
+	unsigned int e;
+
+	if (ns < (1 << ASNFWD_LAT_SUB_BITS))
+		return ns;
+
+	if (ns >= (1ULL << ASNFWD_LAT_MAX_BITS))
+		return ASNFWD_LAT_BUCKETS - 1;
+
+	e = ilog2(ns);
+
+	return ((e - ASNFWD_LAT_SUB_BITS + 1) << ASNFWD_LAT_SUB_BITS) +
+	       ((ns >> (e - ASNFWD_LAT_SUB_BITS)) & ((1 << ASNFWD_LAT_SUB_BITS) - 1));
+}
+
+/* lowest value that goes in a bucket */
+static u64 asnfwd_lat_value(unsigned int bucket)
+{
+	unsigned int e, m;
+
+	if (bucket < (1 << ASNFWD_LAT_SUB_BITS))
+		return bucket;
+
+	e = (bucket >> ASNFWD_LAT_SUB_BITS) + ASNFWD_LAT_SUB_BITS - 1;
+	m = bucket & ((1 << ASNFWD_LAT_SUB_BITS) - 1);
+
+	return (1ULL << e) | ((u64) m << (e - ASNFWD_LAT_SUB_BITS));
+}
+
+/**
+ * asnfwd_lat_record - account the time spent in a stage
+ * @stage: the stage, ASNFWD_LAT_*
+ * @start: local_clock at the start of the stage, see ASNFWD_LAT_START
+ *
+ * local_clock is only monotonic per CPU, which is fine since the hook
+ * does not sleep nor migrate.
+ */
+void asnfwd_lat_record(int stage, u64 start)
+{
+	u64 now = local_clock();
+
+	this_cpu_inc(asnfwd_lat.hist[stage][asnfwd_lat_bucket(now > start ? now - start : 0)]);
+}
+
+static int asnfwd_lat_show(struct seq_file *m, void *v)
+{
+	static const unsigned int pct[] = { 50, 90, 99, 999 };
+	u64 *sum;
+	u64 total, acc;
+	int stage, cpu, b, i;
+
+	sum = kcalloc(ASNFWD_LAT_BUCKETS, sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+
+	seq_printf(m, "instrumentation %s\n", asnfwd_lat_enabled ? "on" : "off");
+
+	for (stage = 0; stage < ASNFWD_LAT_STAGES; stage++)
+	{
+		memset(sum, 0, ASNFWD_LAT_BUCKETS * sizeof(*sum));
+		total = 0;
+
+		for_each_possible_cpu(cpu)
+		{
+			for (b = 0; b < ASNFWD_LAT_BUCKETS; b++)
+				sum[b] += per_cpu(asnfwd_lat, cpu).hist[stage][b];
+		}
+
+		for (b = 0; b < ASNFWD_LAT_BUCKETS; b++)
+			total += sum[b];
+
+		seq_printf(m, "\n%s: %llu samples", asnfwd_lat_stage_name[stage], total);
+
+		/* p999 is per mille, the rest per cent */
+		for (i = 0, acc = 0, b = 0; total && i < ARRAY_SIZE(pct); i++)
+		{
+			u64 rank = pct[i] < 100 ? div_u64(total * pct[i], 100) : div_u64(total * pct[i], 1000);
+
+			for ( ; b < ASNFWD_LAT_BUCKETS && acc + sum[b] <= rank; b++)
+				acc += sum[b];
+
+			seq_printf(m, " p%u %lluns", pct[i], asnfwd_lat_value(min(b, ASNFWD_LAT_BUCKETS - 1)));
+		}
+
+		seq_printf(m, "\n");
+
+		for (b = 0; b < ASNFWD_LAT_BUCKETS; b++)
+		{
+			if (sum[b])
+				seq_printf(m, "  >= %10lluns %llu\n", asnfwd_lat_value(b), sum[b]);
+		}
+	}
+
+	kfree(sum);
+
+	return 0;
+}
+
+static int asnfwd_lat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, asnfwd_lat_show, NULL);
+}
+
+/* "on", "off" or "reset" */
+static ssize_t asnfwd_lat_write(struct file *file,
+                                const char __user *ubuf,
+                                size_t count,
+                                loff_t *ppos)
+{
+	ssize_t ret = count;
+	char buf[16];
+	int cpu;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+
+	buf[count] = '\0';
+	strim(buf);
+
+	mutex_lock(&asnfwd_lat_mutex);
+
+	if (strcmp(buf, "on") == 0)
+	{
+		if (!asnfwd_lat_enabled)
+			static_key_slow_inc(&asnfwd_lat_key);
+		asnfwd_lat_enabled = true;
+	}
+	else if (strcmp(buf, "off") == 0)
+	{
+		if (asnfwd_lat_enabled)
+			static_key_slow_dec(&asnfwd_lat_key);
+		asnfwd_lat_enabled = false;
+	}
+	else if (strcmp(buf, "reset") == 0)
+	{
+		/* racing with the hook only loses a few samples */
+		for_each_possible_cpu(cpu)
+			memset(&per_cpu(asnfwd_lat, cpu), 0, sizeof(struct asnfwd_lat));
+	}
+	else
+		ret = -EINVAL;
+
+	mutex_unlock(&asnfwd_lat_mutex);
+
+	return ret;
+}
+
+static const struct file_operations asnfwd_lat_fops = {
+	.owner   = THIS_MODULE,
+	.open    = asnfwd_lat_open,
+	.read    = seq_read,
+	.write   = asnfwd_lat_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+int asnfwd_lat_init(void)
+{
+	if (asnfwd_debugfs)
+		debugfs_create_file("latency", S_IRUSR | S_IWUSR, asnfwd_debugfs, NULL, &asnfwd_lat_fops);
+
+	return 0;
+}
+
+void asnfwd_lat_exit(void)
+{
+	/* the hooks are gone, nobody runs the patched code anymore */
+	mutex_lock(&asnfwd_lat_mutex);
+	if (asnfwd_lat_enabled)
+		static_key_slow_dec(&asnfwd_lat_key);
+	asnfwd_lat_enabled = false;
+	mutex_unlock(&asnfwd_lat_mutex);
+}
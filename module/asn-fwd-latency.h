@@ -0,0 +1,40 @@
+#ifndef _ASN_FWD_LATENCY_H
+#define _ASN_FWD_LATENCY_H
+
+#include <linux/percpu.h>          // included for DECLARE_PER_CPU and this_cpu_inc
+#include <linux/jump_label.h>      // included for struct static_key and static_key_false
+#include <linux/sched.h>           // included for local_clock
+
+enum {
+	ASNFWD_LAT_LOOKUP,  /* asnfwd_find_route */
+	ASNFWD_LAT_ENCAP,   /* adding or removing the ASN-FWD header or option */
+	ASNFWD_LAT_CSUM,    /* IP checksum of the modified header */
+	ASNFWD_LAT_STAGES,
+};
+
+/*
+ * Log-linear buckets: 2^ASNFWD_LAT_SUB_BITS linear buckets per power of
+ * two, so every bucket is within 25% of its value. Times of 2^40 ns and
+ * more go in the last bucket.
+ */
+#define ASNFWD_LAT_SUB_BITS 2
+#define ASNFWD_LAT_MAX_BITS 40
+#define ASNFWD_LAT_BUCKETS  ((ASNFWD_LAT_MAX_BITS - ASNFWD_LAT_SUB_BITS + 1) << ASNFWD_LAT_SUB_BITS)
+
+struct asnfwd_lat {
+	u64 hist[ASNFWD_LAT_STAGES][ASNFWD_LAT_BUCKETS];
+};
+
+extern struct static_key asnfwd_lat_key;
+
+void asnfwd_lat_record(int stage, u64 start);
+int asnfwd_lat_init(void);
+void asnfwd_lat_exit(void);
+
+/* a patched out jump unless instrumentation is enabled through debugfs */
+#define ASNFWD_LAT_START() (static_key_false(&asnfwd_lat_key) ? local_clock() : 0)
+
+#define ASNFWD_LAT_END(stage, start) \
+	do { if (static_key_false(&asnfwd_lat_key) && (start)) asnfwd_lat_record(stage, start); } while (0)
+
+#endif /* _ASN_FWD_LATENCY_H */
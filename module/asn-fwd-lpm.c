@@ -0,0 +1,720 @@
+#include <linux/slab.h>            // included for kmalloc_node and krealloc
+#include <linux/vmalloc.h>         // included for vmalloc_node
+#include <linux/sort.h>            // included for sort
+#include <linux/net.h>             // included for sock_create_kern and kernel_sendmsg
+#include <linux/workqueue.h>       // included for the rebuild work
+#include <linux/topology.h>        // included for numa_node_id
+#include <linux/nodemask.h>        // included for for_each_online_node
+#include <linux/mutex.h>           // included for DEFINE_MUTEX
+#include <linux/rtnetlink.h>       // included for RTM_GETROUTE, struct rtmsg and RTNLGRP_IPV4_ROUTE
+#include <linux/if_link.h>         // included for struct ifinfomsg
+#include <net/netlink.h>           // included for nlmsg_parse
+#include <net/sock.h>              // included for sk_change_net and sk_release_kernel
+#include <net/netns/generic.h>     // included for net_generic
+#include "asn-fwd-lpm.h"
+#include "asn-fwd-common.h"
+#include "asn-fwd-stats.h"
+
+#define ASNFWD_LPM_BUFSIZE 16384
+
+/* while the table changes, the copies are rebuilt at most this often */
+#define ASNFWD_LPM_DELAY   (HZ / 10)
+
+/*
+ * Read-only copy of the ASN table, with overlapping prefixes resolved
+ * into sorted disjoint ranges, so a lookup is a binary search over a
+ * compact array allocated on the node of the CPUs reading it.
+ */
+struct asnfwd_lpm {
+	unsigned int            cfg_gen;  /* asnfwd_config generation it was built for */
+	unsigned int            table_gen; /* asnfwd_lpm_net table_gen when it was built */
+	unsigned int            n;
+	struct asnfwd_lpm_range r[];
+};
+
+struct asnfwd_lpm_prefix {
+	u32    addr;
+	u8     len;
+	__be32 gw;
+	u32    seq;   /* dump order, sort() is not stable */
+};
+
+struct asnfwd_lpm_net {
+	struct net                 *net;
+	struct delayed_work         work;
+	struct socket              *monitor;   /* route and link notifications */
+	atomic_t                    table_gen; /* changes with the routes of the table */
+	struct asnfwd_lpm __rcu   **node;  /* one copy per NUMA node, nr_node_ids entries */
+};
+
+static int asnfwd_lpm_net_id __read_mostly;
+
+/* prebuilt table of the initial namespace, one copy per NUMA node */
+static struct asnfwd_lpm __rcu **asnfwd_lpm_image;
+static DEFINE_MUTEX(asnfwd_lpm_image_mutex);
+static atomic_t asnfwd_lpm_image_gen = ATOMIC_INIT(0);
+
+static u32 asnfwd_lpm_prefix_end(const struct asnfwd_lpm_prefix *p)
+{
+	return p->addr | (p->len ? (u32) ((1ULL << (32 - p->len)) - 1) : 0xffffffff);
+}
+
+/* shorter prefixes first on the same start address, then dump order */
+static int asnfwd_lpm_prefix_cmp(const void *a, const void *b)
+{
+	const struct asnfwd_lpm_prefix *pa = a, *pb = b;
+
+	if (pa->addr != pb->addr)
+		return pa->addr < pb->addr ? -1 : 1;
+
+	if (pa->len != pb->len)
+		return (int) pa->len - (int) pb->len;
+
+	return pa->seq < pb->seq ? -1 : pa->seq > pb->seq;
+}
+
+static void asnfwd_lpm_emit(struct asnfwd_lpm *lpm, u64 start, u32 end, __be32 gw)
+{
+	struct asnfwd_lpm_range *last = lpm->n ? &lpm->r[lpm->n - 1] : NULL;
+
+	if (start > end)
+		return;
+
+	/* merge with the previous range when contiguous and same gateway */
+	if (last && last->gw == gw && (u64) last->end + 1 == start)
+	{
+		last->end = end;
+		return;
+	}
+
+	lpm->r[lpm->n].start = start;
+	lpm->r[lpm->n].end = end;
+	lpm->r[lpm->n].gw = gw;
+	lpm->n++;
+}
+
+/**
+ * asnfwd_lpm_build - resolve overlapping prefixes into disjoint ranges
+ * @p: the prefixes of the table, sorted in place
+ * @n: number of prefixes
+ *
+ * The most specific prefix wins, as in the FIB lookup. Of duplicated
+ * prefixes, the first one dumped is kept, as mktable keeps the first one
+ * read. Same algorithm as xdp/lpm-build.c.
+ */
+static struct asnfwd_lpm *asnfwd_lpm_build(struct asnfwd_lpm_prefix *p, size_t n)
+{
+	struct asnfwd_lpm_prefix *stack[33];
+	struct asnfwd_lpm *lpm;
+	u64 cur = 0;
+	size_t i;
+	int top = 0;
+
+	/* each prefix splits at most one enclosing range in two */
+	lpm = vmalloc(sizeof(*lpm) + (2 * n + 1) * sizeof(struct asnfwd_lpm_range));
+	if (!lpm)
+		return NULL;
+
+	lpm->n = 0;
+
+	for (i = 0; i < n; i++)
+		p[i].addr &= p[i].len ? ~(u32) 0 << (32 - p[i].len) : 0;
+
+	sort(p, n, sizeof(*p), asnfwd_lpm_prefix_cmp, NULL);
+
+	for (i = 0; i < n; i++)
+	{
+		/* duplicated prefix (different metric or TOS), only one is kept */
+		if (i > 0 && p[i].addr == p[i - 1].addr && p[i].len == p[i - 1].len)
+			continue;
+
+		/* close the enclosing prefixes that end before this one */
+		while (top > 0 && asnfwd_lpm_prefix_end(stack[top - 1]) < p[i].addr)
+		{
+			top--;
+			asnfwd_lpm_emit(lpm, cur, asnfwd_lpm_prefix_end(stack[top]), stack[top]->gw);
+			cur = (u64) asnfwd_lpm_prefix_end(stack[top]) + 1;
+		}
+
+		if (top > 0 && p[i].addr > cur)
+			asnfwd_lpm_emit(lpm, cur, p[i].addr - 1, stack[top - 1]->gw);
+
+		cur = p[i].addr;
+		stack[top++] = &p[i];
+	}
+
+	while (top > 0)
+	{
+		top--;
+		asnfwd_lpm_emit(lpm, cur, asnfwd_lpm_prefix_end(stack[top]), stack[top]->gw);
+		cur = (u64) asnfwd_lpm_prefix_end(stack[top]) + 1;
+	}
+
+	return lpm;
+}
+
+static void asnfwd_lpm_free(struct asnfwd_lpm *lpm)
+{
+	if (is_vmalloc_addr(lpm))
+		vfree(lpm);
+	else
+		kfree(lpm);
+}
+
+/* table of a route message, RT_TABLE_UNSPEC if not a valid IPv4 route */
+static unsigned int asnfwd_lpm_table(struct nlmsghdr *nh, struct nlattr **tb)
+{
+	struct rtmsg *rtm = nlmsg_data(nh);
+
+	if (nlmsg_parse(nh, sizeof(*rtm), tb, RTA_MAX, NULL) < 0 || rtm->rtm_family != AF_INET)
+		return RT_TABLE_UNSPEC;
+
+	return tb[RTA_TABLE] ? nla_get_u32(tb[RTA_TABLE]) : rtm->rtm_table;
+}
+
+/* prefix of a route message, false if not a route of @table */
+static bool asnfwd_lpm_parse(struct nlmsghdr *nh, unsigned int table, struct asnfwd_lpm_prefix *p)
+{
+	struct rtmsg *rtm = nlmsg_data(nh);
+	struct nlattr *tb[RTA_MAX + 1];
+
+	if (asnfwd_lpm_table(nh, tb) != table)
+		return false;
+
+	p->len = rtm->rtm_dst_len;
+	p->addr = tb[RTA_DST] ? ntohl(nla_get_be32(tb[RTA_DST])) : 0;
+	p->gw = 0;
+
+	/* routes without ASN are kept, they hide the less specific ones */
+	if (rtm->rtm_type != RTN_UNICAST)
+		return true;
+
+	if (tb[RTA_GATEWAY])
+	{
+		p->gw = nla_get_be32(tb[RTA_GATEWAY]);
+	}
+	else if (tb[RTA_MULTIPATH])
+	{
+		/* same as asnfwd_find_route, the first next hop is the ASN */
+		struct rtnexthop *rtnh = nla_data(tb[RTA_MULTIPATH]);
+		struct nlattr *attrs[RTA_MAX + 1];
+
+		if (nla_len(tb[RTA_MULTIPATH]) >= sizeof(*rtnh) && rtnh->rtnh_len > sizeof(*rtnh) &&
+		    nla_parse(attrs, RTA_MAX, rtnh_attrs(rtnh), rtnh->rtnh_len - sizeof(*rtnh), NULL) == 0 &&
+		    attrs[RTA_GATEWAY])
+			p->gw = nla_get_be32(attrs[RTA_GATEWAY]);
+	}
+
+	return true;
+}
+
+/**
+ * asnfwd_lpm_dump - read the prefixes of a table through rtnetlink
+ * @net: the network namespace
+ * @table: the table
+ * @pp: the prefixes, to be freed with kfree
+ *
+ * Returns the number of prefixes or a negative error.
+ */
+static int asnfwd_lpm_dump(struct net *net, unsigned int table, struct asnfwd_lpm_prefix **pp)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct rtmsg    rtm;
+	} req;
+	struct asnfwd_lpm_prefix *p = NULL, *tmp;
+	struct socket *sock;
+	struct msghdr msg;
+	struct kvec iov;
+	struct nlmsghdr *nh;
+	void *buf;
+	int n = 0, max = 0, len, err;
+	bool done = false;
+
+	buf = kmalloc(ASNFWD_LPM_BUFSIZE, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	err = sock_create_kern(PF_NETLINK, SOCK_RAW, NETLINK_ROUTE, &sock);
+	if (err < 0)
+		goto out_free;
+
+	sk_change_net(sock->sk, net);
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = sizeof(req);
+	req.nh.nlmsg_type = RTM_GETROUTE;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.rtm.rtm_family = AF_INET;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &req;
+	iov.iov_len = sizeof(req);
+
+	err = kernel_sendmsg(sock, &msg, &iov, 1, sizeof(req));
+	if (err < 0)
+		goto out_release;
+
+	while (!done)
+	{
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = buf;
+		iov.iov_len = ASNFWD_LPM_BUFSIZE;
+
+		len = kernel_recvmsg(sock, &msg, &iov, 1, ASNFWD_LPM_BUFSIZE, 0);
+		if (len < 0)
+		{
+			err = len;
+			goto out_release;
+		}
+
+		for (nh = buf; nlmsg_ok(nh, len); nh = nlmsg_next(nh, &len))
+		{
+			if (nh->nlmsg_type == NLMSG_DONE)
+			{
+				done = true;
+				break;
+			}
+
+			if (nh->nlmsg_type == NLMSG_ERROR)
+			{
+				err = -EIO;
+				goto out_release;
+			}
+
+			if (nh->nlmsg_type != RTM_NEWROUTE)
+				continue;
+
+			if (n == max)
+			{
+				max = max ? 2 * max : 256;
+				tmp = krealloc(p, max * sizeof(*p), GFP_KERNEL);
+				if (!tmp)
+				{
+					err = -ENOMEM;
+					goto out_release;
+				}
+				p = tmp;
+			}
+
+			if (asnfwd_lpm_parse(nh, table, &p[n]))
+			{
+				p[n].seq = n;
+				n++;
+			}
+		}
+	}
+
+	*pp = p;
+	p = NULL;
+	err = n;
+
+out_release:
+	sk_release_kernel(sock->sk);
+out_free:
+	kfree(p);
+	kfree(buf);
+	return err;
+}
+
+/* copy of @lpm on @node, NULL if out of memory */
+static struct asnfwd_lpm *asnfwd_lpm_copy(const struct asnfwd_lpm *lpm, int node)
+{
+	size_t size = sizeof(*lpm) + lpm->n * sizeof(struct asnfwd_lpm_range);
+	struct asnfwd_lpm *copy;
+
+	copy = kmalloc_node(size, GFP_KERNEL | __GFP_NOWARN, node);
+	if (!copy)
+		copy = vmalloc_node(size, node);
+
+	if (copy)
+		memcpy(copy, lpm, size);
+
+	return copy;
+}
+
+/**
+ * asnfwd_lpm_publish - replace the copies of every node
+ * @copies: the per node copies, nr_node_ids entries
+ * @lpm: the new table, copied
+ * @lock: whether the caller holds the lock protecting @copies
+ *
+ * Nodes whose copy can't be allocated keep the old one. Must be called in
+ * process context, the old copies are freed after a grace period.
+ */
+static void asnfwd_lpm_publish(struct asnfwd_lpm __rcu **copies, const struct asnfwd_lpm *lpm, bool lock)
+{
+	struct asnfwd_lpm *copy, *old;
+	int node;
+
+	for_each_online_node(node)
+	{
+		copy = lpm ? asnfwd_lpm_copy(lpm, node) : NULL;
+		if (lpm && !copy)
+			continue;
+
+		old = rcu_dereference_protected(copies[node], lock);
+		rcu_assign_pointer(copies[node], copy);
+
+		if (old)
+		{
+			synchronize_rcu();
+			asnfwd_lpm_free(old);
+		}
+	}
+}
+
+/* rebuilds the copies of a namespace, in process context */
+static void asnfwd_lpm_rebuild(struct work_struct *work)
+{
+	struct asnfwd_lpm_net *ln = container_of(to_delayed_work(work), struct asnfwd_lpm_net, work);
+	struct asnfwd_lpm_prefix *p = NULL;
+	struct asnfwd_lpm *lpm;
+	unsigned int table, cfg_gen, table_gen;
+	int n;
+
+	rcu_read_lock();
+	table = asnfwd_config(ln->net)->table;
+	cfg_gen = asnfwd_config(ln->net)->gen;
+	rcu_read_unlock();
+
+	/* read first, a change during the dump makes the copies stale again */
+	table_gen = atomic_read(&ln->table_gen);
+
+	ASNFWD_INC(lpm_rebuild);
+
+	n = asnfwd_lpm_dump(ln->net, table, &p);
+	if (n < 0)
+	{
+		printk(KERN_WARNING "[ASN-FWD] Cannot read table %u: %d\n", table, n);
+		return;
+	}
+
+	lpm = asnfwd_lpm_build(p, n);
+	kfree(p);
+
+	if (!lpm)
+		return;
+
+	lpm->cfg_gen = cfg_gen;
+	lpm->table_gen = table_gen;
+
+	/* only this work writes them, it is never run concurrently */
+	asnfwd_lpm_publish(ln->node, lpm, 1);
+
+	PRINTK("Table %u copied, %u ranges\n", table, lpm->n);
+
+	vfree(lpm);
+}
+
+/* the copies of the namespace are stale, rebuild them once the changes settle */
+static void asnfwd_lpm_changed(struct asnfwd_lpm_net *ln)
+{
+	atomic_inc(&ln->table_gen);
+	schedule_delayed_work(&ln->work, ASNFWD_LPM_DELAY);
+}
+
+/**
+ * asnfwd_lpm_monitor - notifications received by the monitor socket
+ * @sk: the monitor socket
+ * @bytes: unused
+ *
+ * Called right after the change, by the sender of the notification. Only
+ * the routes of the ASN table make the copies stale, changes to the other
+ * tables are ignored. Routes through a device going down or away are
+ * removed without a route notification, so these link changes count too.
+ * The queue is emptied on every call and never overruns.
+ */
+static void asnfwd_lpm_monitor(struct sock *sk, int bytes)
+{
+	struct asnfwd_lpm_net *ln = sk->sk_user_data;
+	struct nlattr *tb[RTA_MAX + 1];
+	struct ifinfomsg *ifi;
+	struct nlmsghdr *nh;
+	struct sk_buff *skb;
+	unsigned int table;
+	bool changed = false;
+	int len;
+
+	rcu_read_lock();
+	table = asnfwd_config(ln->net)->table;
+	rcu_read_unlock();
+
+	while ((skb = skb_dequeue(&sk->sk_receive_queue)) != NULL)
+	{
+		len = skb->len;
+
+		for (nh = nlmsg_hdr(skb); nlmsg_ok(nh, len); nh = nlmsg_next(nh, &len))
+		{
+			switch (nh->nlmsg_type)
+			{
+			case RTM_NEWROUTE:
+			case RTM_DELROUTE:
+				if (asnfwd_lpm_table(nh, tb) == table)
+					changed = true;
+				break;
+			case RTM_NEWLINK:
+				ifi = nlmsg_data(nh);
+				if (nh->nlmsg_len >= nlmsg_msg_size(sizeof(*ifi)) && !(ifi->ifi_flags & IFF_UP))
+					changed = true;
+				break;
+			case RTM_DELLINK:
+				changed = true;
+				break;
+			}
+		}
+
+		kfree_skb(skb);
+	}
+
+	if (changed)
+		asnfwd_lpm_changed(ln);
+}
+
+/* whether @addr is covered by a route of @lpm, whose ASN is put in @gw */
+static bool asnfwd_lpm_search(const struct asnfwd_lpm *lpm, u32 addr, __be32 *gw)
+{
+	unsigned int lo = 0, hi, mid;
+
+	if (lpm->n == 0)
+		return false;
+
+	/* last range starting at or before addr */
+	hi = lpm->n;
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+
+		if (lpm->r[mid].start <= addr)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (lpm->r[lo].start <= addr && addr <= lpm->r[lo].end)
+	{
+		*gw = lpm->r[lo].gw;
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * asnfwd_lpm_image_lookup - find an ASN-FWD route in the prebuilt table
+ * @net: the network namespace
+ * @daddr: the destination address
+ * @gw: the ASN, left alone if the image has no route
+ *
+ * Only used for destinations without any route in the table, so the
+ * routes pushed by the control plane win over the image.
+ */
+void asnfwd_lpm_image_lookup(struct net *net, __be32 daddr, __be32 *gw)
+{
+	const struct asnfwd_lpm *lpm;
+
+	if (!net_eq(net, &init_net))
+		return;
+
+	lpm = rcu_dereference(asnfwd_lpm_image[numa_node_id()]);
+	if (lpm)
+		asnfwd_lpm_search(lpm, ntohl(daddr), gw);
+}
+
+/**
+ * asnfwd_lpm_image_set - publish a prebuilt table for the initial namespace
+ * @r: sorted disjoint ranges
+ * @n: number of ranges
+ */
+int asnfwd_lpm_image_set(const struct asnfwd_lpm_range *r, unsigned int n)
+{
+	struct asnfwd_lpm *lpm;
+
+	lpm = vmalloc(sizeof(*lpm) + n * sizeof(*r));
+	if (!lpm)
+		return -ENOMEM;
+
+	lpm->cfg_gen = 0;
+	lpm->table_gen = 0;
+	lpm->n = n;
+	memcpy(lpm->r, r, n * sizeof(*r));
+
+	mutex_lock(&asnfwd_lpm_image_mutex);
+	asnfwd_lpm_publish(asnfwd_lpm_image, lpm, lockdep_is_held(&asnfwd_lpm_image_mutex));
+	atomic_inc(&asnfwd_lpm_image_gen);
+	mutex_unlock(&asnfwd_lpm_image_mutex);
+
+	vfree(lpm);
+
+	return 0;
+}
+
+/* once the control plane pushed the table, the image is not needed anymore */
+void asnfwd_lpm_image_drop(void)
+{
+	mutex_lock(&asnfwd_lpm_image_mutex);
+	asnfwd_lpm_publish(asnfwd_lpm_image, NULL, lockdep_is_held(&asnfwd_lpm_image_mutex));
+	atomic_inc(&asnfwd_lpm_image_gen);
+	mutex_unlock(&asnfwd_lpm_image_mutex);
+}
+
+/* changes after the image is replaced or dropped, for the caches of lookup results */
+unsigned int asnfwd_lpm_image_generation(void)
+{
+	return atomic_read(&asnfwd_lpm_image_gen);
+}
+
+/* ranges of the image on the local node, 0 if none */
+unsigned int asnfwd_lpm_image_ranges(void)
+{
+	const struct asnfwd_lpm *lpm;
+	unsigned int n = 0;
+
+	rcu_read_lock();
+	lpm = rcu_dereference(asnfwd_lpm_image[numa_node_id()]);
+	if (lpm)
+		n = lpm->n;
+	rcu_read_unlock();
+
+	return n;
+}
+
+/**
+ * asnfwd_lpm_lookup - find an ASN-FWD route in the copy of the local node
+ * @net: the network namespace
+ * @cfg: configuration of the packet namespace
+ * @daddr: the destination address
+ * @gw: the ASN, 0 if there is no ASN route
+ *
+ * Returns -EAGAIN when the copy is missing or stale, the ASN table changed
+ * or the configuration did, and schedules a rebuild. The caller has to
+ * walk the table in the meantime. Changes to the other tables leave the
+ * copy valid.
+ */
+int asnfwd_lpm_lookup(struct net *net,
+                      const struct asnfwd_config *cfg,
+                      __be32 daddr,
+                      __be32 *gw)
+{
+	struct asnfwd_lpm_net *ln = net_generic(net, asnfwd_lpm_net_id);
+	const struct asnfwd_lpm *lpm;
+
+	lpm = rcu_dereference(ln->node[numa_node_id()]);
+	if (!lpm || lpm->cfg_gen != cfg->gen || lpm->table_gen != atomic_read(&ln->table_gen))
+	{
+		ASNFWD_INC(lpm_stale);
+		schedule_delayed_work(&ln->work, ASNFWD_LPM_DELAY);
+		return -EAGAIN;
+	}
+
+	*gw = 0;
+
+	if (!asnfwd_lpm_search(lpm, ntohl(daddr), gw))
+		asnfwd_lpm_image_lookup(net, daddr, gw);
+
+	return 0;
+}
+
+/* listens to the route and link notifications of the namespace, as "ip monitor" does */
+static int asnfwd_lpm_monitor_open(struct asnfwd_lpm_net *ln)
+{
+	struct sockaddr_nl addr;
+	struct sock *sk;
+	int err;
+
+	err = sock_create_kern(PF_NETLINK, SOCK_RAW, NETLINK_ROUTE, &ln->monitor);
+	if (err < 0)
+		return err;
+
+	sk = ln->monitor->sk;
+	sk_change_net(sk, ln->net);
+
+	write_lock_bh(&sk->sk_callback_lock);
+	sk->sk_user_data = ln;
+	sk->sk_data_ready = asnfwd_lpm_monitor;
+	write_unlock_bh(&sk->sk_callback_lock);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1 << (RTNLGRP_IPV4_ROUTE - 1) | 1 << (RTNLGRP_LINK - 1);
+
+	err = kernel_bind(ln->monitor, (struct sockaddr *) &addr, sizeof(addr));
+	if (err < 0)
+		sk_release_kernel(sk);
+
+	return err;
+}
+
+static int __net_init asnfwd_lpm_net_init(struct net *net)
+{
+	struct asnfwd_lpm_net *ln = net_generic(net, asnfwd_lpm_net_id);
+	int err;
+
+	ln->net = net;
+	atomic_set(&ln->table_gen, 0);
+	INIT_DELAYED_WORK(&ln->work, asnfwd_lpm_rebuild);
+
+	ln->node = kcalloc(nr_node_ids, sizeof(*ln->node), GFP_KERNEL);
+	if (!ln->node)
+		return -ENOMEM;
+
+	err = asnfwd_lpm_monitor_open(ln);
+	if (err < 0)
+	{
+		kfree(ln->node);
+		return err;
+	}
+
+	return 0;
+}
+
+static void __net_exit asnfwd_lpm_net_exit(struct net *net)
+{
+	struct asnfwd_lpm_net *ln = net_generic(net, asnfwd_lpm_net_id);
+	struct asnfwd_lpm *lpm;
+	int node;
+
+	/* no notification schedules the work anymore */
+	sk_release_kernel(ln->monitor->sk);
+	cancel_delayed_work_sync(&ln->work);
+
+	/* no packet of the namespace is left, no reader either */
+	for (node = 0; node < nr_node_ids; node++)
+	{
+		lpm = rcu_dereference_protected(ln->node[node], 1);
+		if (lpm)
+			asnfwd_lpm_free(lpm);
+	}
+
+	kfree(ln->node);
+}
+
+static struct pernet_operations asnfwd_lpm_net_ops = {
+	.init = asnfwd_lpm_net_init,
+	.exit = asnfwd_lpm_net_exit,
+	.id   = &asnfwd_lpm_net_id,
+	.size = sizeof(struct asnfwd_lpm_net),
+};
+
+int asnfwd_lpm_init(void)
+{
+	int err;
+
+	asnfwd_lpm_image = kcalloc(nr_node_ids, sizeof(*asnfwd_lpm_image), GFP_KERNEL);
+	if (!asnfwd_lpm_image)
+		return -ENOMEM;
+
+	err = register_pernet_subsys(&asnfwd_lpm_net_ops);
+	if (err != 0)
+		kfree(asnfwd_lpm_image);
+
+	return err;
+}
+
+void asnfwd_lpm_exit(void)
+{
+	unregister_pernet_subsys(&asnfwd_lpm_net_ops);
+
+	asnfwd_lpm_image_drop();
+	kfree(asnfwd_lpm_image);
+}
@@ -0,0 +1,26 @@
+#ifndef _ASN_FWD_LPM_H
+#define _ASN_FWD_LPM_H
+
+#include <linux/types.h>           // included for __be32
+#include <net/net_namespace.h>     // included for struct net
+#include "asn-fwd-config.h"
+
+struct asnfwd_lpm_range {
+	u32    start;  /* host order */
+	u32    end;
+	__be32 gw;     /* 0 if the most specific route has no ASN */
+};
+
+int asnfwd_lpm_lookup(struct net *net,
+                      const struct asnfwd_config *cfg,
+                      __be32 daddr,
+                      __be32 *gw);
+void asnfwd_lpm_image_lookup(struct net *net, __be32 daddr, __be32 *gw);
+int asnfwd_lpm_image_set(const struct asnfwd_lpm_range *r, unsigned int n);
+void asnfwd_lpm_image_drop(void);
+unsigned int asnfwd_lpm_image_ranges(void);
+unsigned int asnfwd_lpm_image_generation(void);
+int asnfwd_lpm_init(void);
+void asnfwd_lpm_exit(void);
+
+#endif /* _ASN_FWD_LPM_H */
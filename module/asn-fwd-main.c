@@ -8,23 +8,65 @@
 #include <linux/ip.h>              // included for struct iphdr, ntohs, htons and others
 #include <net/ip.h>                // included for ip_send_check
 #include "asn-fwd-common.h"
+#include "asn-fwd-config.h"
 #include "asn-fwd-ipip.h"
 #include "asn-fwd-options.h"
+#include "asn-fwd-shim.h"
+#include "asn-fwd-tunnel.h"
+#include "asn-fwd-flow.h"
+#include "asn-fwd-stats.h"
+#include "asn-fwd-latency.h"
+#include "asn-fwd-headroom.h"
+#include "asn-fwd-gro.h"
+#include "asn-fwd-sample.h"
+#include "asn-fwd-dev.h"
+#include "asn-fwd-lpm.h"
+#include "asn-fwd-image.h"
+#include "asn-fwd-drop.h"
+#include "asn-fwd-hh.h"
+#include "asn-fwd-skcache.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Fabio Sabai");
 MODULE_DESCRIPTION("Allows IP routing based on ASN");
 
-module_param(table, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+/* table, format, keep_padding, lookup, dscp, dscp_decap and std_ipip are the initial
+   configuration of each namespace, change them at runtime through
+   /proc/net/asn-fwd */
+module_param(table, int, S_IRUSR | S_IRGRP);
 MODULE_PARM_DESC(table, "Routing table where to lookup for ASN's");
 
-module_param(format, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
-MODULE_PARM_DESC(format, "Header format: 0 - IPIP, 1 - OPTIONS");
+module_param(format, int, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(format, "Header format: 0 - IPIP, 1 - OPTIONS, 2 - SHIM");
 
 module_param(debug, int, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
 MODULE_PARM_DESC(debug, "Enable/disable debug");
 
-char format_name[2][8] = {"IPIP", "OPTIONS"};
+module_param(keep_padding, uint, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(keep_padding, "OPTIONS format: leave NOOP padding in place of a removed option");
+
+module_param(lookup, uint, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(lookup, "Look up the ASN table in the hook, 0 to route only through asnfwd devices");
+
+module_param(dscp, uint, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(dscp, "DSCP of the outer header, 64 copies the DSCP of the packet");
+
+module_param(dscp_decap, uint, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(dscp_decap, "Keep the outer DSCP on decapsulation instead of the original one");
+
+module_param(std_ipip, uint, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(std_ipip, "IPIP format outer protocol: 0 - 254, 1 - 254, accept 4 too, 2 - 4 (IPPROTO_IPIP), accept 254 too");
+
+module_param(image, charp, S_IRUSR | S_IRGRP);
+MODULE_PARM_DESC(image, "Prebuilt ASN table loaded at init from the firmware directory, see mktable");
+
+module_param(flow_max, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+MODULE_PARM_DESC(flow_max, "Maximum number of offloaded flows, 0 disables offloading");
+
+module_param(flow_timeout, uint, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+MODULE_PARM_DESC(flow_timeout, "Seconds an idle offloaded flow is kept");
+
+char format_name[ASNFWD_FORMATS][8] = {"IPIP", "OPTIONS", "SHIM"};
 
 unsigned int asnfwd_hook(const struct nf_hook_ops *ops,
                          struct sk_buff *skb,
@@ -33,7 +75,15 @@ unsigned int asnfwd_hook(const struct nf_hook_ops *ops,
                          int (*okfn)(struct sk_buff *))
 {
 	struct iphdr *iph;
+	struct net *net;
+	const struct asnfwd_config *cfg;
+	struct asnfwd_flow_key key;
+	struct asnfwd_flow *flow;
+	struct asnfwd_optinfo info;
+	struct asnfwd_tunnel *tun = NULL;
 	int ret = 0;
+	int reason = 0;
+	u64 start;
 
 	/* sanity check */
 	if (!skb)
@@ -47,13 +97,31 @@ unsigned int asnfwd_hook(const struct nf_hook_ops *ops,
 	PRINTK("Hook is %s\n", (in ? "pre-routing" : "local-out"));
 	PRINTK("(Ogirinal) From %pI4 to %pI4.\n", &iph->saddr, &iph->daddr);
 
-	switch (format)
+	/* read the configuration once, the whole packet is handled with it */
+	net = dev_net(in ? in : out);
+	cfg = asnfwd_config(net);
+
+	/* packets of offloaded flows skip the ASN lookup and the routing stack */
+	asnfwd_flow_key(skb, in, &key);
+	flow = asnfwd_flow_find(net, &key, cfg);
+	if (flow)
+	{
+		if (asnfwd_flow_usable(flow, skb, in, &info))
+			return asnfwd_flow_xmit(flow, skb, in, &info, cfg);
+
+		ASNFWD_INC(flow_fallback);
+	}
+
+	switch (cfg->format)
 	{
 		case ASNFWD_FORMAT_IPIP:
-			ret = asnfwd_hook_ipip(ops, skb, in, out, okfn);
+			ret = asnfwd_hook_ipip(ops, skb, in, out, okfn, cfg, &tun, &reason);
 			break;
 		case ASNFWD_FORMAT_OPTIONS:
-			ret = asnfwd_hook_options(ops, skb, in, out, okfn);
+			ret = asnfwd_hook_options(ops, skb, in, out, okfn, cfg, &tun, &reason);
+			break;
+		case ASNFWD_FORMAT_SHIM:
+			ret = asnfwd_hook_shim(ops, skb, in, out, okfn, cfg, &tun, &reason);
 			break;
 		default:
 			// invalid option - should never reach
@@ -66,19 +134,41 @@ unsigned int asnfwd_hook(const struct nf_hook_ops *ops,
 		/* update iph pointer, may have changed above */
 		iph = ip_hdr(skb);
 
-		PRINTK("(Modified using %s) From %pI4 to %pI4.\n", format_name[format], &iph->saddr, &iph->daddr);
+		PRINTK("(Modified using %s) From %pI4 to %pI4.\n", format_name[cfg->format], &iph->saddr, &iph->daddr);
 
 		/* no need to recalculate checksum for transport protocol,
 		   but the new IP header needs a new checksum */
-		skb->ip_summed = CHECKSUM_NONE;
+		asnfwd_reset_csum(skb);
 
 		/* recalculate IP checksum */
+		start = ASNFWD_LAT_START();
 		ip_send_check(iph);
+		ASNFWD_LAT_END(ASNFWD_LAT_CSUM, start);
+
+		/* packet was encapsulated, send it to the gateway and offload the rest of its flow */
+		if (tun)
+		{
+			ASNFWD_SAMPLE(ASNFWD_SAMPLE_ENCAP, skb, in, tun->gw, cfg->format);
+			ASNFWD_HH_HIT(key.daddr, tun->gw);
+
+			ret = asnfwd_tunnel_xmit(tun, skb, in);
+
+			if (!flow && flow_max)
+				asnfwd_flow_add(net, &key, tun, cfg);
+
+			asnfwd_tunnel_put(tun);
+
+			return ret;
+		}
+
+		ASNFWD_SAMPLE(ASNFWD_SAMPLE_DECAP, skb, in, 0, cfg->format);
 	}
 	/* packet is no good */
 	else if (ret == ASNFWD_BAD)
 	{
-		return NF_DROP;
+		ASNFWD_SAMPLE(ASNFWD_SAMPLE_DROP, skb, in, 0, cfg->format);
+
+		return asnfwd_drop(skb, in, reason);
 	}
 
 accept:
@@ -103,12 +193,14 @@ static int __init init_main(void)
 {
 #ifdef CONFIG_IP_MULTIPLE_TABLES
 	unsigned long sym_addr;
+	int err;
 
-	if (format != ASNFWD_FORMAT_IPIP && format != ASNFWD_FORMAT_OPTIONS)
+	if (format >= ASNFWD_FORMATS)
 	{
-		printk(KERN_ERR "[ASN-FWD] Invalid format: %d. Valid formats are %d (%s) and %d (%s)\n", format,
+		printk(KERN_ERR "[ASN-FWD] Invalid format: %d. Valid formats are %d (%s), %d (%s) and %d (%s)\n", format,
 		                          ASNFWD_FORMAT_IPIP, format_name[ASNFWD_FORMAT_IPIP],
-								  ASNFWD_FORMAT_OPTIONS, format_name[ASNFWD_FORMAT_OPTIONS]);
+		                          ASNFWD_FORMAT_OPTIONS, format_name[ASNFWD_FORMAT_OPTIONS],
+		                          ASNFWD_FORMAT_SHIM, format_name[ASNFWD_FORMAT_SHIM]);
 		return -EINVAL;
 	}
 
@@ -121,12 +213,97 @@ static int __init init_main(void)
 
 	my_fib_get_table = (fib_get_table_t) sym_addr;
 
+	err = asnfwd_config_init();
+	if (err != 0)
+	{
+		printk(KERN_ERR "[ASN-FWD] Configuration initialization failed: %d\n", err);
+		return err;
+	}
+
+	asnfwd_stats_init();
+	asnfwd_lat_init();
+
+	/* not fatal, only sampling is unavailable */
+	if (asnfwd_sample_init() != 0)
+		printk(KERN_WARNING "[ASN-FWD] Packet sampling unavailable\n");
+
+	/* not fatal, only the heavy hitters report is unavailable */
+	if (asnfwd_hh_init() != 0)
+		printk(KERN_WARNING "[ASN-FWD] Heavy hitters sketches unavailable\n");
+
+	err = asnfwd_lpm_init();
+	if (err != 0)
+	{
+		printk(KERN_ERR "[ASN-FWD] Table copies initialization failed: %d\n", err);
+		goto err_lpm;
+	}
+
+	/* not fatal, the box waits for the control plane as without an image */
+	asnfwd_image_init();
+
+	err = asnfwd_tunnel_init();
+	if (err != 0)
+	{
+		printk(KERN_ERR "[ASN-FWD] Tunnel initialization failed: %d\n", err);
+		goto err_tunnel;
+	}
+
+	err = asnfwd_flow_init();
+	if (err != 0)
+	{
+		printk(KERN_ERR "[ASN-FWD] Flow offload initialization failed: %d\n", err);
+		goto err_flow;
+	}
+
+	err = asnfwd_sk_init();
+	if (err != 0)
+	{
+		printk(KERN_ERR "[ASN-FWD] Socket cache initialization failed: %d\n", err);
+		goto err_sk;
+	}
+
+	err = asnfwd_headroom_init();
+	if (err != 0)
+	{
+		printk(KERN_ERR "[ASN-FWD] Headroom initialization failed: %d\n", err);
+		goto err_headroom;
+	}
+
+	err = asnfwd_dev_init();
+	if (err != 0)
+	{
+		printk(KERN_ERR "[ASN-FWD] Device registration failed: %d\n", err);
+		goto err_dev;
+	}
+
+	/* not fatal, packets are just hashed by their outer header */
+	if (asnfwd_gro_init() != 0)
+		printk(KERN_WARNING "[ASN-FWD] Protocol %d GRO handler already registered\n", ASNFWD_PROTOCOL);
+
 	nf_register_hook(&ops_prerouting); // always returns 0
 	nf_register_hook(&ops_output); // always returns 0
 
 	printk(KERN_INFO "[ASN-FWD] Netfilter hook added. table = %d, format = %s, debug is %s\n", table, format_name[format], (debug ? "on" : "off"));
 
 	return 0;
+
+err_dev:
+	asnfwd_headroom_exit();
+err_headroom:
+	asnfwd_sk_exit();
+err_sk:
+	asnfwd_flow_exit();
+err_flow:
+	asnfwd_tunnel_exit();
+err_tunnel:
+	asnfwd_lpm_exit();
+err_lpm:
+	asnfwd_hh_exit();
+	asnfwd_sample_exit();
+	asnfwd_lat_exit();
+	asnfwd_stats_exit();
+	asnfwd_config_exit();
+	return err;
 #else
 	/* we need multiple tables support */
 
@@ -141,6 +318,19 @@ static void __exit cleanup_main(void)
 	nf_unregister_hook(&ops_prerouting);
 	nf_unregister_hook(&ops_output);
 
+	asnfwd_gro_exit();
+	asnfwd_dev_exit();
+	asnfwd_headroom_exit();
+	asnfwd_sk_exit();
+	asnfwd_flow_exit();
+	asnfwd_tunnel_exit();
+	asnfwd_lpm_exit();
+	asnfwd_hh_exit();
+	asnfwd_sample_exit();
+	asnfwd_lat_exit();
+	asnfwd_stats_exit();
+	asnfwd_config_exit();
+
 	printk(KERN_INFO "[ASN-FWD] Netfilter hook removed.\n");
 }
 
@@ -1,125 +1,125 @@
 #include "asn-fwd-options.h"
 #include "asn-fwd-common.h"
+#include "asn-fwd-skcache.h"
+#include "asn-fwd-latency.h"
+#include "asn-fwd-stats.h"
+#include "asn-fwd-ecn.h"
+#include "asn-fwd-drop.h"
+#include "asn-fwd-hh.h"
 
 static int ip_opt_len(const struct iphdr *iph)
 {
 	return (iph->ihl * 4) - sizeof(struct iphdr);
 }
 
-static void asnfwd_replace_eol(struct iphdr *iph)
+/**
+ * asnfwd_find_padding - find a run of IPOPT_NOOP bytes the option fits in
+ * @iph: IP header, whose options asnfwd_parse_options found valid
+ *
+ * The run is compared as a single word. Returns the offset of the first
+ * such run in the IP header, 0 if none.
+ */
+static unsigned char asnfwd_find_padding(const struct iphdr *iph)
 {
-	unsigned char *optptr = (unsigned char *) &(iph[1]);
+	const unsigned char *optptr = (const unsigned char *) &(iph[1]);
 	int optlen = ip_opt_len(iph);
-	int len;
+	int off;
 
-	for ( ; optlen > 0; )
+	for (off = 0; off <= optlen - (int) IPOPT_ASNFWD_LEN; )
 	{
-		switch (*optptr)
+		switch (optptr[off])
 		{
-		case IPOPT_END:
-			*optptr = IPOPT_NOOP;
-			PRINTK("Replaced IPOPT_END\n");
-			/* pass through */
 		case IPOPT_NOOP:
-			optlen--;
-			optptr++;
+			if (get_unaligned((const u64 *) (optptr + off)) == 0x0101010101010101ULL)
+				return sizeof(struct iphdr) + off;
+			/* pass through */
+		case IPOPT_END:
+			off++;
 			continue;
 		}
 
-		/* already validated in asnfwd_find_option */
-		len = optptr[1];
-		optlen -= len;
-		optptr += len;
+		off += optptr[off + 1];
 	}
+
+	return 0;
 }
 
-/**
- * asnfwd_find_option - find the ASN FWD option in IP header
- * @iph: IP header 
- * @opt: pointer to ASN FWD option, if found, NULL otherwise
- *
- * This function looks for ASN FWD option the IP header. If found,
- * set the @opt parameter to the start of the option. Returns true
- * if everything is ok (true not means an option was found, just
- * that no errors occurred). In case an ASN FWD option is found and
- * is not ok, i.e., incorrect lenght, etc, returns a non-zero value.
- */
-int asnfwd_find_option(struct iphdr *iph, struct asnfwd_opt **opt)
+/* routers stop parsing at IPOPT_END, so it can't come before the ASN-FWD option */
+static void asnfwd_replace_eol(struct iphdr *iph, u64 eol)
 {
-	unsigned char *optptr;
-	int optlen;
-	int len;
-	int err = 0;
-
-	*opt = NULL;
+	unsigned char *optptr = (unsigned char *) &(iph[1]);
 
-	if (iph->ihl > 5)
+	for ( ; eol; eol &= eol - 1)
 	{
-		optlen = ip_opt_len(iph);
-		optptr = (unsigned char *) &(iph[1]);
-		for ( ; optlen > 0; )
-		{
-			switch (*optptr)
-			{
-			case IPOPT_NOOP:
-			case IPOPT_END:
-				optlen--;
-				optptr++;
-				continue;
-			}
-
-			if (unlikely(optlen < 2))
-				goto end; /* invalid option, has no length */
-
-			len = optptr[1];
-			if (len < 2 || len > optlen)
-				goto end; /* invalid option, invalid length */	
-
-			if (*optptr == IPOPT_ASNFWD_TYPE)
-			{
-				*opt = (struct asnfwd_opt *) optptr;
-				if ((*opt)->len < IPOPT_ASNFWD_LEN)
-					err = -EPROTO;
-
-				goto end;
-			}
-			else
-			{
-				optlen -= len;
-				optptr += len;
-			}
-		}
+		optptr[__ffs64(eol)] = IPOPT_NOOP;
+		PRINTK("Replaced IPOPT_END\n");
 	}
-
-end:
-	return err;
 }
 
 /**
  * asnfwd_save_dst_to_option - save the original destination address in the options field 
  * @skb: the socket buffer 
+ * @info: the options layout, see asnfwd_parse_options
  *
  * This function saves the original destination address in the IP packet options field,
- * using the ASN-FWD option type and class.
+ * using the ASN-FWD option type and class. When the sender reserved room for it with
+ * IPOPT_NOOP padding, the option is written there and the header keeps its size.
+ * Returns -ENOSPC if the header has no room left for the option and -ENOBUFS
+ * if making room at the head of the buffer failed.
  */
-static int asnfwd_save_dst_to_options(struct sk_buff *skb)
+static int asnfwd_save_dst_to_options(struct sk_buff *skb, const struct asnfwd_optinfo *info)
 {
 	struct iphdr *iph = ip_hdr(skb);
 	struct asnfwd_opt opt;
+	unsigned char noop = 0;
 	int err = 0;
 
-	/* we need IPOPT_ASNFWD_LEN bytes at the start of the buffer
-           and we need space in the IP header */
-	if (skb_headroom(skb) < IPOPT_ASNFWD_LEN || MAX_IPOPTLEN - ip_opt_len(iph) < IPOPT_ASNFWD_LEN)
+	/* fill the ASN-FWD option struct */
+	opt.type = IPOPT_ASNFWD_TYPE;
+	opt.len = IPOPT_ASNFWD_LEN;
+	opt.addr = iph->daddr;
+	opt.pad1 = IPOPT_NOOP;
+	opt.pad2 = IPOPT_END;
+
+	if (info->pad >= IPOPT_ASNFWD_LEN)
+		noop = asnfwd_find_padding(iph);
+
+	if (noop)
 	{
-		PRINTK("No space to add option. SKB headroom = %d, options length = %d\n",
-				skb_headroom(skb), ip_opt_len(iph));
-		err = ENOMEM;
+		/* other options may follow the padding */
+		opt.pad2 = IPOPT_NOOP;
+
+		asnfwd_replace_eol(iph, info->eol);
+		memcpy((void *) iph + noop, (void *) &opt, sizeof(opt));
+
 		goto end;
 	}
 
+	/* we need space in the IP header */
+	if (info->free < IPOPT_ASNFWD_LEN)
+	{
+		PRINTK("No space to add option. Options length = %d\n", ip_opt_len(iph));
+		err = -ENOSPC;
+		goto end;
+	}
+
+	/* and we need IPOPT_ASNFWD_LEN bytes at the start of the buffer */
+	if (skb_headroom(skb) < IPOPT_ASNFWD_LEN)
+	{
+		PRINTK("No space to add option. SKB headroom = %d\n", skb_headroom(skb));
+		ASNFWD_INC(headroom_realloc);
+
+		if (skb_cow_head(skb, IPOPT_ASNFWD_LEN))
+		{
+			err = -ENOBUFS;
+			goto end;
+		}
+
+		iph = ip_hdr(skb);
+	}
+
 	/* replace any IPOPT_END that may appear before ASN-FWD option */
-	asnfwd_replace_eol(iph);
+	asnfwd_replace_eol(iph, info->eol);
 
 	/* push IP header to make room for ASN-FWD option */
 	skb_push(skb, IPOPT_ASNFWD_LEN);
@@ -135,13 +135,7 @@ static int asnfwd_save_dst_to_options(struct sk_buff *skb)
 	/* update iph pointer */
 	iph = ip_hdr(skb);
 
-	/* fill the ASN-FWD option struct and copy it to the end of the IP header */
-	opt.type = IPOPT_ASNFWD_TYPE;
-	opt.len = IPOPT_ASNFWD_LEN;
-	opt.addr = iph->daddr;
-	opt.pad1 = IPOPT_NOOP;
-	opt.pad2 = IPOPT_END;
-
+	/* copy the option to the end of the IP header */
 	memcpy((void *) iph + (iph->ihl * 4), (void *) &opt, sizeof(opt));
 
 	/* update ihl and tot_len fields */
@@ -157,14 +151,25 @@ end:
 /**
  * asnfwd_remove_option - remove ASN-FWD option from IP header
  * @skb: the socket buffer 
- * @opt: pointer to ASN-FWD option in IP header
+ * @info: the options layout, see asnfwd_parse_options
+ * @keep_padding: overwrite the option instead of removing it
  *
- * This function removes the ASN_FWD option from the IP header
+ * This function removes the ASN_FWD option from the IP header. With @keep_padding
+ * set, the option is overwritten with IPOPT_NOOP bytes instead, so the next
+ * ASN-FWD box can write its option in place.
  */
-static void asnfwd_remove_option(struct sk_buff *skb, struct asnfwd_opt *opt)
+static void asnfwd_remove_option(struct sk_buff *skb,
+                                 const struct asnfwd_optinfo *info,
+                                 unsigned int keep_padding)
 {
 	struct iphdr *iph = ip_hdr(skb);
 
+	if (keep_padding)
+	{
+		memset((void *) iph + info->asn, IPOPT_NOOP, IPOPT_ASNFWD_LEN);
+		return;
+	}
+
 	/* pull IP header to overwrite ASN-FWD option */
 	skb_pull(skb, IPOPT_ASNFWD_LEN);
 
@@ -174,8 +179,8 @@ static void asnfwd_remove_option(struct sk_buff *skb, struct asnfwd_opt *opt)
 	/* move IP header to its new location 
 	   ip_hdr(skb) -> new location
        iph -> old location 
-	   opt - iph -> number of IP header bytes before ASN-FWD options */
-	memmove((void *) ip_hdr(skb), (void *) iph, (void *) opt - (void *) iph);
+	   info->asn -> number of IP header bytes before ASN-FWD options */
+	memmove((void *) ip_hdr(skb), (void *) iph, info->asn);
 
 	/* update iph pointer */
 	iph = ip_hdr(skb);
@@ -190,20 +195,21 @@ static void asnfwd_remove_option(struct sk_buff *skb, struct asnfwd_opt *opt)
 /**
  * asnfwd_set_dst_from_table - set the destination field based on the routing table
  * @skb: the socket buffer 
- * @in: device where packet came from
+ * @addr: the ASN destination address
+ * @info: the options layout, see asnfwd_parse_options
  *
  * This function executes a lookup in the ASN-FWD table and, if an entry
  * is found, replaces the destionation field of the IP packet by the one
  * found in the table. The original destination address is saved as an
  * option in the IP packet.
  */
-int asnfwd_set_dst_from_table(struct sk_buff *skb, __be32 addr)
+int asnfwd_set_dst_from_table(struct sk_buff *skb, __be32 addr, const struct asnfwd_optinfo *info)
 {
 	struct iphdr *iph = ip_hdr(skb);
 	int err = 0;
 
 	/* save destination address to IPv4 options */
-	err = asnfwd_save_dst_to_options(skb);
+	err = asnfwd_save_dst_to_options(skb, info);
     if (err != 0)
 		goto end;
 
@@ -222,23 +228,27 @@ end:
 /**
  * asnfwd_set_dst_from_option - set the destination field based on ASN-FWD option 
  * @skb: the socket buffer 
- * @opt: pointer to ASN-FWD option in IP header
+ * @info: the options layout, see asnfwd_parse_options
+ * @keep_padding: leave IPOPT_NOOP padding in place of the option
  *
  * This function replaces the destination address by the one set in ASN-FWD option
- * and removes the ASN-FWD option from the IP header. @opt will be no more valid
+ * and removes the ASN-FWD option from the IP header. @info will be no more valid
  * after this function executes
  */
-void asnfwd_set_dst_from_option(struct sk_buff *skb, struct asnfwd_opt *opt)
+void asnfwd_set_dst_from_option(struct sk_buff *skb,
+                                const struct asnfwd_optinfo *info,
+                                unsigned int keep_padding)
 {
 	struct iphdr *iph = ip_hdr(skb);
+	struct asnfwd_opt *opt = (void *) iph + info->asn;
 
 	/* set new destionation address */
 	iph->daddr = opt->addr;
 
 	/* remove ASN-FWD option */
-	asnfwd_remove_option(skb, opt);
+	asnfwd_remove_option(skb, info, keep_padding);
 
-	/* opt is no more valid */
+	/* opt and info are no more valid */
 	
 	/* checksum will be recalculated in asnfwd_hook */
 }
@@ -247,11 +257,17 @@ unsigned int asnfwd_hook_options(const struct nf_hook_ops *ops,
                                  struct sk_buff *skb,
                                  const struct net_device *in,
                                  const struct net_device *out,
-                                 int (*okfn)(struct sk_buff *))
+                                 int (*okfn)(struct sk_buff *),
+                                 const struct asnfwd_config *cfg,
+                                 struct asnfwd_tunnel **tunp,
+                                 int *reason)
 {
 	struct iphdr *iph = ip_hdr(skb);
+	struct asnfwd_tunnel *tun;
 	__be32 addr = 0;
-	struct asnfwd_opt *opt;
+	struct asnfwd_optinfo info;
+	u64 start;
+	int err;
 
 #if 0
 	/* lets begin with ICMP packets, to have some flow control */
@@ -259,29 +275,57 @@ unsigned int asnfwd_hook_options(const struct nf_hook_ops *ops,
 		return ASNFWD_SKIPPED;
 #endif // 0
 
-	if (asnfwd_find_option(iph, &opt) != 0)
+	if (asnfwd_parse_options(iph, &info) != 0)
+	{
+		*reason = ASNFWD_DROP_MALFORMED;
 		return ASNFWD_BAD; /* has option, but is invalid. Packet is not useful */
+	}
 
-	if (opt)
+	if (info.asn)
 	{
 		PRINTK("Option found\n");
 
-		asnfwd_set_dst_from_option(skb, opt);
+		/* the marks are already in the only header, nothing to propagate */
+		if (INET_ECN_is_ce(iph->tos))
+			ASNFWD_INC(ecn_ce);
+
+		start = ASNFWD_LAT_START();
+		asnfwd_set_dst_from_option(skb, &info, cfg->keep_padding);
+		ASNFWD_LAT_END(ASNFWD_LAT_ENCAP, start);
 	}
 	else
 	{
-		if ((addr = asnfwd_find_route(iph, in, out)) != 0)
+		if ((addr = asnfwd_sk_route(skb, in, out, cfg)) != 0)
 		{
 			PRINTK("Route found\n");
 
-			if (asnfwd_set_dst_from_table(skb, addr) != 0)
+			tun = asnfwd_tunnel_get(dev_net(in ? in : out), addr);
+			if (!tun)
+			{
+				*reason = ASNFWD_DROP_NOMEM;
+				return ASNFWD_BAD; /* out of memory, better drop the packet */
+			}
+
+			start = ASNFWD_LAT_START();
+			err = asnfwd_set_dst_from_table(skb, addr, &info);
+			ASNFWD_LAT_END(ASNFWD_LAT_ENCAP, start);
+
+			if (err != 0)
+			{
+				asnfwd_tunnel_put(tun);
+				*reason = asnfwd_drop_reason(err);
 				return ASNFWD_BAD; /* something went wrong, better drop the packet */
+			}
+
+			*tunp = tun;
 		}
 		/* no table found, no route found or incomplete route found */
+		else if (cfg->lookup)
+			ASNFWD_HH_MISS(iph->daddr);
 	}
 	
 	/* packet changed in some way */
-	if (opt || addr)
+	if (info.asn || addr)
 	{
 		/* update iph pointer, may have changed above */
 		iph = ip_hdr(skb);
@@ -4,6 +4,8 @@
 #include <linux/skbuff.h>          // included for struct sk_buff and related functions
 #include <linux/ip.h>              // included for struct iphdr, ntohs, htons and others
 #include <net/ip.h>                // included for ip_send_check
+#include <asm/unaligned.h>         // included for get_unaligned
+#include "asn-fwd-tunnel.h"
 
 #define IPOPT_ASNFWD_TYPE 222 /* 11011110 - copy:1 class:2 number:30 */
 #define IPOPT_ASNFWD_LEN  sizeof(struct asnfwd_opt)
@@ -16,13 +18,98 @@ struct __attribute__((packed)) asnfwd_opt {
 	unsigned char pad2;
 };
 
-int asnfwd_find_option(struct iphdr *iph, struct asnfwd_opt **opt);
-void asnfwd_set_dst_from_option(struct sk_buff *skb, struct asnfwd_opt *opt);
-int asnfwd_set_dst_from_table(struct sk_buff *skb, __be32 addr);
+/* options layout of a packet, see asnfwd_parse_options */
+struct asnfwd_optinfo {
+	u64           eol;   /* bitmap of the IPOPT_END bytes, by offset in the options */
+	unsigned char asn;   /* offset of the ASN-FWD option in the IP header, 0 if none */
+	unsigned char pad;   /* IPOPT_NOOP and IPOPT_END bytes, see asnfwd_find_padding */
+	unsigned char free;  /* room left for options in the IP header */
+};
+
+/**
+ * asnfwd_parse_options - parse the IP header options once
+ * @iph: IP header
+ * @info: the options layout, filled for the insert and remove functions
+ *
+ * This function walks the options a single time, recording where the
+ * ASN-FWD option is, where the IPOPT_END bytes are, how much room is
+ * left in the header and how many padding bytes there are. Where the
+ * padding is, is only looked for when the option is inserted, see
+ * asnfwd_find_padding. Returns 0 if everything is ok (which does not
+ * mean an option was found).
+ * In case an ASN-FWD option is found and is not ok, i.e., its length is
+ * not IPOPT_ASNFWD_LEN, returns a non-zero value.
+ * It is inlined, as it runs on every packet and mostly has one option or
+ * none to look at.
+ */
+static inline int asnfwd_parse_options(const struct iphdr *iph, struct asnfwd_optinfo *info)
+{
+	const unsigned char *opts = (const unsigned char *) &(iph[1]);
+	const unsigned char *optptr = opts;
+	int optlen = (iph->ihl * 4) - sizeof(struct iphdr);
+	int len, pad = optlen;
+	u64 eol = 0;
+
+	info->eol = 0;
+	info->asn = 0;
+	info->pad = 0;
+	info->free = MAX_IPOPTLEN - optlen;
+
+	/* padding reserved by our hosts comes first, skip it a word at a time */
+	if (optlen >= IPOPT_ASNFWD_LEN && *optptr == IPOPT_NOOP &&
+	    get_unaligned((const u64 *) optptr) == 0x0101010101010101ULL)
+	{
+		optlen -= IPOPT_ASNFWD_LEN;
+		optptr += IPOPT_ASNFWD_LEN;
+	}
+
+	while (optlen > 0)
+	{
+		if (*optptr <= IPOPT_NOOP)
+		{
+			if (*optptr == IPOPT_END)
+				eol |= 1ULL << (optptr - opts);
+			optlen--;
+			optptr++;
+			continue;
+		}
+
+		if (optlen < 2 || (len = optptr[1]) < 2 || len > optlen)
+		{
+			/* invalid option, leave the header alone, nothing found before is kept */
+			info->free = 0;
+			return 0;
+		}
+
+		if (*optptr == IPOPT_ASNFWD_TYPE)
+		{
+			/* the option is removed or padded over as IPOPT_ASNFWD_LEN bytes */
+			info->asn = sizeof(struct iphdr) + (optptr - opts);
+			return len != IPOPT_ASNFWD_LEN ? -EPROTO : 0;
+		}
+
+		pad -= len;
+		optlen -= len;
+		optptr += len;
+	}
+
+	info->eol = eol;
+	info->pad = pad;
+
+	return 0;
+}
+
+void asnfwd_set_dst_from_option(struct sk_buff *skb,
+                                const struct asnfwd_optinfo *info,
+                                unsigned int keep_padding);
+int asnfwd_set_dst_from_table(struct sk_buff *skb, __be32 addr, const struct asnfwd_optinfo *info);
 unsigned int asnfwd_hook_options(const struct nf_hook_ops *ops,
                                  struct sk_buff *skb,
                                  const struct net_device *in,
                                  const struct net_device *out,
-                                 int (*okfn)(struct sk_buff *));
+                                 int (*okfn)(struct sk_buff *),
+                                 const struct asnfwd_config *cfg,
+                                 struct asnfwd_tunnel **tun,
+                                 int *reason);
 
 #endif /* _ASN_FWD_OPTIONS_H */
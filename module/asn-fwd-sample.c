@@ -0,0 +1,253 @@
+#include <linux/relay.h>           // included for relay_open and relay_write
+#include <linux/random.h>          // included for prandom_u32
+#include <linux/seq_file.h>        // included for seq_printf and single_open
+#include <linux/uaccess.h>         // included for copy_from_user
+#include <linux/mutex.h>           // included for DEFINE_MUTEX
+#include <linux/ktime.h>           // included for ktime_get_real
+#include <linux/bottom_half.h>     // included for local_bh_disable
+#include "asn-fwd-sample.h"
+#include "asn-fwd-stats.h"
+
+#define ASNFWD_SAMPLE_SUBBUF_SIZE (sizeof(struct asnfwd_sample) * 64)
+#define ASNFWD_SAMPLE_SUBBUFS     32
+
+struct static_key asnfwd_sample_key = STATIC_KEY_INIT_FALSE;
+
+struct asnfwd_sample_cpu {
+	u32 skip[ASNFWD_SAMPLE_OUTCOMES];  /* packets left before the next sample */
+	u64 pool[ASNFWD_SAMPLE_OUTCOMES];
+};
+
+static DEFINE_PER_CPU(struct asnfwd_sample_cpu, asnfwd_sample_cpu);
+
+static unsigned int asnfwd_sample_rate[ASNFWD_SAMPLE_OUTCOMES];
+static struct rchan *asnfwd_sample_chan;
+
+/* serializes the rate changes and enabling the static key */
+static DEFINE_MUTEX(asnfwd_sample_mutex);
+static bool asnfwd_sample_enabled;
+
+static const char *asnfwd_sample_name[ASNFWD_SAMPLE_OUTCOMES] = {
+	"encap", "decap", "drop",
+};
+
+/* random skip averaging rate, so periodic traffic is not aliased */
+static u32 asnfwd_sample_skip(unsigned int rate)
+{
+	return rate > 1 ? 1 + prandom_u32() % (2 * rate - 1) : 1;
+}
+
+/**
+ * asnfwd_sample - export 1 in N packets of an outcome
+ * @outcome: what the hook did with the packet, ASNFWD_SAMPLE_*
+ * @skb: the socket buffer, as it leaves the hook
+ * @in: The input device, if incoming packet
+ * @gw: the ASN gateway the packet is sent to, 0 if none
+ * @format: the header format, ASNFWD_FORMAT_*
+ *
+ * Only called through ASNFWD_SAMPLE. Records are dropped, and counted in
+ * sample_lost, when the reader does not keep up. The LOCAL_OUT hook runs
+ * in process context, BHs are disabled so the per-CPU skip and pool
+ * counters are neither migrated nor interrupted by the receive path.
+ */
+void asnfwd_sample(int outcome,
+                   const struct sk_buff *skb,
+                   const struct net_device *in,
+                   __be32 gw,
+                   unsigned int format)
+{
+	struct asnfwd_sample_cpu *sc;
+	struct asnfwd_sample s;
+	unsigned int rate = ACCESS_ONCE(asnfwd_sample_rate[outcome]);
+	int len;
+
+	if (rate == 0)
+		return;
+
+	local_bh_disable();
+
+	sc = this_cpu_ptr(&asnfwd_sample_cpu);
+	sc->pool[outcome]++;
+
+	if (sc->skip[outcome] > 1)
+	{
+		sc->skip[outcome]--;
+		goto out;
+	}
+
+	sc->skip[outcome] = asnfwd_sample_skip(rate);
+
+	len = skb->len - skb_network_offset(skb);
+	if (len < 0)
+		goto out;
+
+	s.tstamp  = ktime_to_ns(ktime_get_real());
+	s.pool    = sc->pool[outcome];
+	s.rate    = rate;
+	s.ifindex = in ? in->ifindex : 0;
+	s.gw      = gw;
+	s.pkt_len = len;
+	s.cpu     = smp_processor_id();
+	s.outcome = outcome;
+	s.format  = format;
+	s.hdr_len = min(len, ASNFWD_SAMPLE_HDR);
+	s.pad     = 0;
+
+	if (skb_copy_bits(skb, skb_network_offset(skb), s.hdr, s.hdr_len) != 0)
+		goto out;
+
+	memset(s.hdr + s.hdr_len, 0, ASNFWD_SAMPLE_HDR - s.hdr_len);
+
+	relay_write(asnfwd_sample_chan, &s, sizeof(s));
+
+out:
+	local_bh_enable();
+}
+
+/* no overwrite: keep the unread records, lose the new ones */
+static int asnfwd_sample_subbuf_start(struct rchan_buf *buf,
+                                      void *subbuf,
+                                      void *prev_subbuf,
+                                      size_t prev_padding)
+{
+	if (relay_buf_full(buf))
+	{
+		ASNFWD_INC(sample_lost);
+		return 0;
+	}
+
+	return 1;
+}
+
+static struct dentry *asnfwd_sample_create_buf_file(const char *filename,
+                                                    struct dentry *parent,
+                                                    umode_t mode,
+                                                    struct rchan_buf *buf,
+                                                    int *is_global)
+{
+	return debugfs_create_file(filename, S_IRUSR, parent, buf, &relay_file_operations);
+}
+
+static int asnfwd_sample_remove_buf_file(struct dentry *dentry)
+{
+	debugfs_remove(dentry);
+
+	return 0;
+}
+
+static struct rchan_callbacks asnfwd_sample_callbacks = {
+	.subbuf_start    = asnfwd_sample_subbuf_start,
+	.create_buf_file = asnfwd_sample_create_buf_file,
+	.remove_buf_file = asnfwd_sample_remove_buf_file,
+};
+
+static int asnfwd_sample_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	for (i = 0; i < ASNFWD_SAMPLE_OUTCOMES; i++)
+		seq_printf(m, "%s %u\n", asnfwd_sample_name[i], asnfwd_sample_rate[i]);
+
+	return 0;
+}
+
+static int asnfwd_sample_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, asnfwd_sample_show, NULL);
+}
+
+/* "<outcome> <rate>", e.g. echo "encap 1000" > sample_rate, 0 disables */
+static ssize_t asnfwd_sample_write(struct file *file,
+                                   const char __user *ubuf,
+                                   size_t count,
+                                   loff_t *ppos)
+{
+	char buf[32], *val;
+	unsigned int v;
+	bool enable = false;
+	int i, err;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+
+	buf[count] = '\0';
+
+	val = strchr(buf, ' ');
+	if (!val)
+		return -EINVAL;
+
+	*val++ = '\0';
+
+	err = kstrtouint(strim(val), 0, &v);
+	if (err != 0)
+		return err;
+
+	for (i = 0; i < ASNFWD_SAMPLE_OUTCOMES; i++)
+	{
+		if (strcmp(buf, asnfwd_sample_name[i]) == 0)
+			break;
+	}
+
+	if (i == ASNFWD_SAMPLE_OUTCOMES)
+		return -EINVAL;
+
+	mutex_lock(&asnfwd_sample_mutex);
+
+	ACCESS_ONCE(asnfwd_sample_rate[i]) = v;
+
+	for (i = 0; i < ASNFWD_SAMPLE_OUTCOMES; i++)
+		enable |= asnfwd_sample_rate[i] != 0;
+
+	if (enable && !asnfwd_sample_enabled)
+		static_key_slow_inc(&asnfwd_sample_key);
+	else if (!enable && asnfwd_sample_enabled)
+		static_key_slow_dec(&asnfwd_sample_key);
+
+	asnfwd_sample_enabled = enable;
+
+	mutex_unlock(&asnfwd_sample_mutex);
+
+	return count;
+}
+
+static const struct file_operations asnfwd_sample_fops = {
+	.owner   = THIS_MODULE,
+	.open    = asnfwd_sample_open,
+	.read    = seq_read,
+	.write   = asnfwd_sample_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+int asnfwd_sample_init(void)
+{
+	if (!asnfwd_debugfs)
+		return -ENODEV;
+
+	asnfwd_sample_chan = relay_open("sample", asnfwd_debugfs,
+	                                ASNFWD_SAMPLE_SUBBUF_SIZE, ASNFWD_SAMPLE_SUBBUFS,
+	                                &asnfwd_sample_callbacks, NULL);
+	if (!asnfwd_sample_chan)
+		return -ENOMEM;
+
+	debugfs_create_file("sample_rate", S_IRUSR | S_IWUSR, asnfwd_debugfs, NULL, &asnfwd_sample_fops);
+
+	return 0;
+}
+
+void asnfwd_sample_exit(void)
+{
+	/* the hooks are gone, nobody runs the patched code anymore */
+	mutex_lock(&asnfwd_sample_mutex);
+	if (asnfwd_sample_enabled)
+		static_key_slow_dec(&asnfwd_sample_key);
+	asnfwd_sample_enabled = false;
+	mutex_unlock(&asnfwd_sample_mutex);
+
+	if (asnfwd_sample_chan)
+		relay_close(asnfwd_sample_chan);
+	asnfwd_sample_chan = NULL;
+}
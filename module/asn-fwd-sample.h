@@ -0,0 +1,57 @@
+#ifndef _ASN_FWD_SAMPLE_H
+#define _ASN_FWD_SAMPLE_H
+
+#include <linux/types.h>           // included for __u32 and friends, shared with sample/
+
+enum {
+	ASNFWD_SAMPLE_ENCAP,  /* packet encapsulated to a gateway */
+	ASNFWD_SAMPLE_DECAP,  /* ASN-FWD header or option removed */
+	ASNFWD_SAMPLE_DROP,   /* packet dropped as malformed */
+	ASNFWD_SAMPLE_OUTCOMES,
+};
+
+#define ASNFWD_SAMPLE_HDR 128
+
+/*
+ * One record per sampled packet, written to the relay buffer of the CPU
+ * that handled it (debugfs asn-fwd/sample<cpu>). Records never straddle
+ * sub-buffers, so readers get whole records.
+ */
+struct asnfwd_sample {
+	__u64 tstamp;     /* CLOCK_REALTIME, ns */
+	__u64 pool;       /* packets seen with this outcome on this CPU while sampling */
+	__u32 rate;       /* 1 in rate packets of this outcome are sampled */
+	__u32 ifindex;    /* input device, 0 for locally generated packets */
+	__be32 gw;        /* ASN gateway for ENCAP, 0 otherwise */
+	__u32 pkt_len;    /* IP length of the packet */
+	__u16 cpu;
+	__u8  outcome;    /* ASNFWD_SAMPLE_* */
+	__u8  format;     /* ASNFWD_FORMAT_* */
+	__u16 hdr_len;    /* bytes of hdr used */
+	__u16 pad;
+	__u8  hdr[ASNFWD_SAMPLE_HDR]; /* the packet from its IP header, as sent */
+};
+
+#ifdef __KERNEL__
+
+#include <linux/skbuff.h>          // included for struct sk_buff
+#include <linux/netdevice.h>       // included for struct net_device
+#include <linux/jump_label.h>      // included for struct static_key and static_key_false
+
+extern struct static_key asnfwd_sample_key;
+
+void asnfwd_sample(int outcome,
+                   const struct sk_buff *skb,
+                   const struct net_device *in,
+                   __be32 gw,
+                   unsigned int format);
+int asnfwd_sample_init(void);
+void asnfwd_sample_exit(void);
+
+/* a patched out jump unless a sampling rate is set through debugfs */
+#define ASNFWD_SAMPLE(outcome, skb, in, gw, format) \
+	do { if (static_key_false(&asnfwd_sample_key)) asnfwd_sample(outcome, skb, in, gw, format); } while (0)
+
+#endif /* __KERNEL__ */
+
+#endif /* _ASN_FWD_SAMPLE_H */
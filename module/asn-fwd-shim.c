@@ -0,0 +1,194 @@
+#include "asn-fwd-shim.h"
+#include "asn-fwd-ipip.h"
+#include "asn-fwd-common.h"
+#include "asn-fwd-skcache.h"
+#include "asn-fwd-latency.h"
+#include "asn-fwd-stats.h"
+#include "asn-fwd-ecn.h"
+#include "asn-fwd-drop.h"
+#include "asn-fwd-hh.h"
+
+/**
+ * asnfwd_add_shim - insert the ASN-FWD shim after the IP header
+ * @skb: the socket buffer
+ * @tun: the tunnel of the ASN destination address
+ * @cfg: configuration of the packet namespace
+ *
+ * This function moves the IP header ASNFWD_SHIM_LEN bytes left, saves
+ * the original destination and protocol in the room left between the
+ * header and the payload and sends the packet to the ASN gateway. The
+ * payload is not moved.
+ */
+int asnfwd_add_shim(struct sk_buff *skb,
+                    const struct asnfwd_tunnel *tun,
+                    const struct asnfwd_config *cfg)
+{
+	struct iphdr *iph = ip_hdr(skb);
+	struct asnfwd_shim *shim;
+	int hlen = iph->ihl * 4;
+
+	if (ntohs(iph->tot_len) + ASNFWD_SHIM_LEN > IP_MAX_MTU)
+		return -EMSGSIZE;
+
+	if (skb_headroom(skb) < ASNFWD_SHIM_LEN)
+	{
+		PRINTK("No space to add shim. SKB headroom = %d\n", skb_headroom(skb));
+		ASNFWD_INC(headroom_realloc);
+	}
+
+	/* the header is rewritten in place, it can't be shared with a clone */
+	if (skb_cow_head(skb, ASNFWD_SHIM_LEN))
+		return -ENOBUFS;
+
+	/* update iph pointer, may have changed above */
+	iph = ip_hdr(skb);
+
+	skb_push(skb, ASNFWD_SHIM_LEN);
+	memmove(skb->data, iph, hlen);
+
+	/* it's necessary to reset the pointer, the transport header stays in place */
+	skb_reset_network_header(skb);
+
+	iph = ip_hdr(skb);
+	shim = (void *) iph + hlen;
+
+	shim->version = ASNFWD_SHIM_VERSION;
+	shim->protocol = iph->protocol;
+	shim->tos = iph->tos;
+	shim->reserved = 0;
+	shim->daddr = iph->daddr;
+
+	iph->tos = asnfwd_ecn_encap(iph->tos, cfg);
+	iph->protocol = ASNFWD_PROTOCOL;
+	iph->daddr = tun->gw;
+	iph->tot_len = htons(ntohs(iph->tot_len) + ASNFWD_SHIM_LEN);
+
+	/* checksum will be recalculated in asnfwd_hook */
+
+	return 0;
+}
+
+/**
+ * asnfwd_remove_shim - restore the original destination and protocol
+ * @skb: the socket buffer
+ * @cfg: configuration of the packet namespace
+ *
+ * This function removes the shim added previously by the ASN-FWD-Box.
+ * The original TOS is restored with the ECN marks the packet got along
+ * the way. Returns -EPROTO if the packet carries no shim, e.g. an IPIP
+ * packet, -ENODATA if it is truncated and -EINVAL if its ECN marks make
+ * it a drop.
+ */
+int asnfwd_remove_shim(struct sk_buff *skb, const struct asnfwd_config *cfg)
+{
+	struct iphdr *iph = ip_hdr(skb);
+	struct asnfwd_shim shim;
+	int hlen = iph->ihl * 4;
+
+	if (!pskb_may_pull(skb, hlen + ASNFWD_SHIM_LEN))
+		return -ENODATA;
+
+	if (skb_cow_head(skb, 0))
+		return -ENOMEM;
+
+	/* update iph pointer, may have changed above */
+	iph = ip_hdr(skb);
+
+	memcpy(&shim, (void *) iph + hlen, sizeof(shim));
+	if (shim.version != ASNFWD_SHIM_VERSION)
+		return -EPROTO;
+
+	if (asnfwd_ecn_decap(iph->tos, &shim.tos, cfg) != 0)
+		return -EINVAL;
+
+	memmove((void *) iph + ASNFWD_SHIM_LEN, iph, hlen);
+	skb_pull(skb, ASNFWD_SHIM_LEN);
+
+	/* it's necessary to reset the pointers, because the header pointer changed */
+	skb_reset_network_header(skb);
+	skb_set_transport_header(skb, hlen);
+
+	iph = ip_hdr(skb);
+	iph->tos = shim.tos;
+	iph->protocol = shim.protocol;
+	iph->daddr = shim.daddr;
+	iph->tot_len = htons(ntohs(iph->tot_len) - ASNFWD_SHIM_LEN);
+
+	/* checksum will be recalculated in asnfwd_hook */
+
+	return 0;
+}
+
+unsigned int asnfwd_hook_shim(const struct nf_hook_ops *ops,
+                              struct sk_buff *skb,
+                              const struct net_device *in,
+                              const struct net_device *out,
+                              int (*okfn)(struct sk_buff *),
+                              const struct asnfwd_config *cfg,
+                              struct asnfwd_tunnel **tunp,
+                              int *reason)
+{
+	struct iphdr *iph = ip_hdr(skb);
+	struct asnfwd_tunnel *tun;
+	__be32 addr = 0;
+	u64 start;
+	int err;
+
+	if (iph->protocol == ASNFWD_PROTOCOL)
+	{
+		PRINTK("Is ASNFWD protocol\n");
+
+		start = ASNFWD_LAT_START();
+		err = asnfwd_remove_shim(skb, cfg);
+		ASNFWD_LAT_END(ASNFWD_LAT_ENCAP, start);
+
+		if (err == -EPROTO)
+			return ASNFWD_SKIPPED; /* not a shim, leave it to the stack */
+
+		if (err != 0)
+		{
+			*reason = asnfwd_drop_reason(err);
+			return ASNFWD_BAD; /* truncated, out of memory or CE marked without ECN support */
+		}
+	}
+	else
+	{
+		if ((addr = asnfwd_sk_route(skb, in, out, cfg)) == 0)
+		{
+			if (cfg->lookup)
+				ASNFWD_HH_MISS(iph->daddr);
+
+			return ASNFWD_SKIPPED; /* no table found, no route found or incomplete route found */
+		}
+
+		PRINTK("Route found\n");
+
+		tun = asnfwd_tunnel_get(dev_net(in ? in : out), addr);
+		if (!tun)
+		{
+			*reason = ASNFWD_DROP_NOMEM;
+			return ASNFWD_BAD; /* out of memory, better drop the packet */
+		}
+
+		start = ASNFWD_LAT_START();
+		err = asnfwd_add_shim(skb, tun, cfg);
+		ASNFWD_LAT_END(ASNFWD_LAT_ENCAP, start);
+
+		if (err != 0)
+		{
+			asnfwd_tunnel_put(tun);
+			*reason = asnfwd_drop_reason(err);
+			return ASNFWD_BAD; /* something went wrong, better drop the packet */
+		}
+
+		*tunp = tun;
+	}
+
+	/* update iph pointer, changed above */
+	iph = ip_hdr(skb);
+
+	PRINTK("(Modified) From %pI4 to %pI4.\n", &iph->saddr, &iph->daddr);
+
+	/* the IP checksum is recalculated in asnfwd_hook */
+	return ASNFWD_MODIFIED;
+}
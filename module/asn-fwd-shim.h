@@ -0,0 +1,39 @@
+#ifndef _ASN_FWD_SHIM_H
+#define _ASN_FWD_SHIM_H
+
+#include <linux/skbuff.h>          // included for struct sk_buff and related functions
+#include <linux/ip.h>              // included for struct iphdr, ntohs, htons and others
+#include <net/ip.h>                // included for ip_send_check
+#include "asn-fwd-tunnel.h"
+
+/*
+ * SHIM format: the ASN gateway replaces the destination of the IP header,
+ * whose protocol becomes ASNFWD_PROTOCOL, and the original destination
+ * and protocol follow the header. The version sets the shim apart from
+ * the inner header of IPIP packets, whose first nibble is 4.
+ */
+#define ASNFWD_SHIM_VERSION 1
+#define ASNFWD_SHIM_LEN     sizeof(struct asnfwd_shim)
+
+struct __attribute__((packed)) asnfwd_shim {
+	unsigned char version;
+	unsigned char protocol;  /* original protocol */
+	unsigned char tos;       /* original TOS, restored with the ECN marks of the header */
+	unsigned char reserved;
+	__be32        daddr;     /* original destination */
+};
+
+int asnfwd_add_shim(struct sk_buff *skb,
+                    const struct asnfwd_tunnel *tun,
+                    const struct asnfwd_config *cfg);
+int asnfwd_remove_shim(struct sk_buff *skb, const struct asnfwd_config *cfg);
+unsigned int asnfwd_hook_shim(const struct nf_hook_ops *ops,
+                              struct sk_buff *skb,
+                              const struct net_device *in,
+                              const struct net_device *out,
+                              int (*okfn)(struct sk_buff *),
+                              const struct asnfwd_config *cfg,
+                              struct asnfwd_tunnel **tun,
+                              int *reason);
+
+#endif /* _ASN_FWD_SHIM_H */
@@ -0,0 +1,242 @@
+#include <linux/hashtable.h>       // included for DEFINE_HASHTABLE and the hash_* helpers
+#include <linux/workqueue.h>       // included for the garbage collector work
+#include <net/sock.h>              // included for struct sock
+#include <net/tcp_states.h>        // included for TCP_ESTABLISHED
+#include <net/net_namespace.h>     // included for rt_genid_ipv4 and register_pernet_subsys
+#include "asn-fwd-skcache.h"
+#include "asn-fwd-common.h"
+#include "asn-fwd-lpm.h"
+#include "asn-fwd-stats.h"
+
+#define ASNFWD_SK_BITS    10
+#define ASNFWD_SK_MAX     (16 << ASNFWD_SK_BITS)
+#define ASNFWD_SK_TIMEOUT (10 * HZ)
+
+/*
+ * Result of the ASN lookup of the last packet of a socket, one entry per
+ * socket. 3.13 has no storage of its own for modules in struct sock, so
+ * entries are found by the socket address and dropped once idle. The
+ * result only depends on the destination and the generations, the socket
+ * is just the key: an entry left by a freed socket whose memory is reused
+ * is still right for the same destination. Entries are never modified,
+ * a new result replaces the entry.
+ */
+struct asnfwd_sk_entry {
+	struct hlist_node  node;
+	struct rcu_head    rcu;
+	const struct sock *sk;
+	struct net        *net;
+	__be32             daddr;
+	__be32             gw;         /* 0 for no ASN route */
+	unsigned int       cfg_gen;    /* asnfwd_config generation of the lookup */
+	int                genid;      /* rt_genid_ipv4 before the lookup */
+	unsigned int       image_gen;  /* asnfwd_lpm_image_generation before the lookup */
+	unsigned long      last_used;
+};
+
+static DEFINE_HASHTABLE(asnfwd_sk_table, ASNFWD_SK_BITS);
+static DEFINE_SPINLOCK(asnfwd_sk_lock);
+static atomic_t asnfwd_sk_count = ATOMIC_INIT(0);
+
+static void asnfwd_sk_gc(struct work_struct *work);
+static DECLARE_DELAYED_WORK(asnfwd_sk_gc_work, asnfwd_sk_gc);
+
+static void asnfwd_sk_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct asnfwd_sk_entry, rcu));
+}
+
+/* must be called with asnfwd_sk_lock held */
+static void __asnfwd_sk_del(struct asnfwd_sk_entry *e)
+{
+	hash_del_rcu(&e->node);
+	atomic_dec(&asnfwd_sk_count);
+	call_rcu(&e->rcu, asnfwd_sk_free_rcu);
+}
+
+static struct asnfwd_sk_entry *__asnfwd_sk_find(const struct sock *sk)
+{
+	struct asnfwd_sk_entry *e;
+
+	hash_for_each_possible_rcu(asnfwd_sk_table, e, node, (unsigned long) sk)
+	{
+		if (e->sk == sk)
+			return e;
+	}
+
+	return NULL;
+}
+
+/* remember the result of a lookup, replacing the previous one of the socket */
+static void asnfwd_sk_store(const struct sock *sk,
+                            struct net *net,
+                            __be32 daddr,
+                            __be32 gw,
+                            const struct asnfwd_config *cfg,
+                            int genid,
+                            unsigned int image_gen)
+{
+	struct asnfwd_sk_entry *e, *old;
+
+	e = kmalloc(sizeof(*e), GFP_ATOMIC);
+	if (!e)
+		return;
+
+	e->sk = sk;
+	e->net = net;
+	e->daddr = daddr;
+	e->gw = gw;
+	e->cfg_gen = cfg->gen;
+	e->genid = genid;
+	e->image_gen = image_gen;
+	e->last_used = jiffies;
+
+	spin_lock_bh(&asnfwd_sk_lock);
+
+	old = __asnfwd_sk_find(sk);
+	if (old)
+	{
+		hlist_replace_rcu(&old->node, &e->node);
+		call_rcu(&old->rcu, asnfwd_sk_free_rcu);
+	}
+	else if (atomic_read(&asnfwd_sk_count) < ASNFWD_SK_MAX)
+	{
+		hash_add_rcu(asnfwd_sk_table, &e->node, (unsigned long) sk);
+		atomic_inc(&asnfwd_sk_count);
+	}
+	else
+	{
+		/* full, the socket is looked up as usual until entries expire */
+		spin_unlock_bh(&asnfwd_sk_lock);
+		kfree(e);
+		return;
+	}
+
+	spin_unlock_bh(&asnfwd_sk_lock);
+}
+
+/**
+ * asnfwd_sk_route - find an ASN-FWD route, cached per socket
+ * @skb: the socket buffer
+ * @in: The input device, if incoming packet
+ * @out: The output device, if local outgoing packet
+ * @cfg: configuration of the packet namespace
+ *
+ * Locally generated packets of a connected socket (TCP, or UDP after
+ * connect) reuse the result of the previous packet, positive or not, until
+ * the table, the configuration or the prebuilt table changes. Other packets
+ * are looked up as usual. Must be called under rcu_read_lock, which
+ * netfilter hooks already hold.
+ */
+__be32 asnfwd_sk_route(struct sk_buff *skb,
+                       const struct net_device *in,
+                       const struct net_device *out,
+                       const struct asnfwd_config *cfg)
+{
+	struct iphdr *iph = ip_hdr(skb);
+	struct asnfwd_sk_entry *e;
+	struct net *net;
+	unsigned int image_gen;
+	int genid;
+	__be32 gw;
+
+	/* forwarded packets have no socket, unconnected ones change destination */
+	if (in || !out || !skb->sk || skb->sk->sk_state != TCP_ESTABLISHED)
+		return asnfwd_find_route(iph, in, out, cfg);
+
+	net = dev_net(out);
+	genid = rt_genid_ipv4(net);
+	image_gen = asnfwd_lpm_image_generation();
+
+	e = __asnfwd_sk_find(skb->sk);
+	if (e && net_eq(e->net, net) && e->daddr == iph->daddr && e->cfg_gen == cfg->gen &&
+	    e->genid == genid && e->image_gen == image_gen)
+	{
+		if (e->last_used != jiffies)
+			e->last_used = jiffies;
+
+		ASNFWD_INC(sk_hits);
+
+		return e->gw;
+	}
+
+	gw = asnfwd_find_route(iph, in, out, cfg);
+
+	asnfwd_sk_store(skb->sk, net, iph->daddr, gw, cfg, genid, image_gen);
+
+	return gw;
+}
+
+/**
+ * asnfwd_sk_flush - remove socket entries
+ * @net: only remove entries of this namespace, NULL for all
+ */
+static void asnfwd_sk_flush(struct net *net)
+{
+	struct asnfwd_sk_entry *e;
+	struct hlist_node *tmp;
+	int bkt;
+
+	spin_lock_bh(&asnfwd_sk_lock);
+
+	hash_for_each_safe(asnfwd_sk_table, bkt, tmp, e, node)
+	{
+		if (!net || net_eq(e->net, net))
+			__asnfwd_sk_del(e);
+	}
+
+	spin_unlock_bh(&asnfwd_sk_lock);
+}
+
+static void asnfwd_sk_gc(struct work_struct *work)
+{
+	struct asnfwd_sk_entry *e;
+	struct hlist_node *tmp;
+	int bkt;
+
+	spin_lock_bh(&asnfwd_sk_lock);
+
+	hash_for_each_safe(asnfwd_sk_table, bkt, tmp, e, node)
+	{
+		if (time_after(jiffies, e->last_used + ASNFWD_SK_TIMEOUT))
+			__asnfwd_sk_del(e);
+	}
+
+	spin_unlock_bh(&asnfwd_sk_lock);
+
+	schedule_delayed_work(&asnfwd_sk_gc_work, HZ);
+}
+
+/* the namespace address may be reused, drop its entries with it */
+static void __net_exit asnfwd_sk_net_exit(struct net *net)
+{
+	asnfwd_sk_flush(net);
+}
+
+static struct pernet_operations asnfwd_sk_net_ops = {
+	.exit = asnfwd_sk_net_exit,
+};
+
+int asnfwd_sk_init(void)
+{
+	int err;
+
+	err = register_pernet_subsys(&asnfwd_sk_net_ops);
+	if (err != 0)
+		return err;
+
+	schedule_delayed_work(&asnfwd_sk_gc_work, HZ);
+
+	return 0;
+}
+
+void asnfwd_sk_exit(void)
+{
+	cancel_delayed_work_sync(&asnfwd_sk_gc_work);
+	unregister_pernet_subsys(&asnfwd_sk_net_ops);
+
+	asnfwd_sk_flush(NULL);
+
+	/* wait for the entries to be freed before the module goes away */
+	rcu_barrier();
+}
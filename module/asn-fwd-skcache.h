@@ -0,0 +1,15 @@
+#ifndef _ASN_FWD_SKCACHE_H
+#define _ASN_FWD_SKCACHE_H
+
+#include <linux/skbuff.h>          // included for struct sk_buff
+#include <linux/netdevice.h>       // included for struct net_device
+#include "asn-fwd-config.h"
+
+__be32 asnfwd_sk_route(struct sk_buff *skb,
+                       const struct net_device *in,
+                       const struct net_device *out,
+                       const struct asnfwd_config *cfg);
+int asnfwd_sk_init(void);
+void asnfwd_sk_exit(void);
+
+#endif /* _ASN_FWD_SKCACHE_H */
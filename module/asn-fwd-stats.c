@@ -0,0 +1,88 @@
+#include <linux/seq_file.h>        // included for seq_printf and single_open
+#include "asn-fwd-stats.h"
+
+DEFINE_PER_CPU(struct asnfwd_stats, asnfwd_stats);
+
+struct dentry *asnfwd_debugfs;
+
+/**
+ * asnfwd_stats_sum - sum a counter over all CPUs
+ * @off: offset of the counter in struct asnfwd_stats
+ */
+static u64 asnfwd_stats_sum(size_t off)
+{
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += *(u64 *) ((char *) &per_cpu(asnfwd_stats, cpu) + off);
+
+	return sum;
+}
+
+#define ASNFWD_STAT_SHOW(m, field) \
+	seq_printf(m, "%-24s %llu\n", #field, asnfwd_stats_sum(offsetof(struct asnfwd_stats, field)))
+
+static int asnfwd_stats_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	ASNFWD_STAT_SHOW(m, flow_hits);
+	ASNFWD_STAT_SHOW(m, flow_fallback);
+	ASNFWD_STAT_SHOW(m, flow_added);
+	ASNFWD_STAT_SHOW(m, flow_removed);
+	ASNFWD_STAT_SHOW(m, flow_full);
+	ASNFWD_STAT_SHOW(m, headroom_realloc);
+	ASNFWD_STAT_SHOW(m, sample_lost);
+	ASNFWD_STAT_SHOW(m, ecn_ce);
+	ASNFWD_STAT_SHOW(m, ecn_ce_propagated);
+	ASNFWD_STAT_SHOW(m, ecn_drop);
+	ASNFWD_STAT_SHOW(m, lpm_stale);
+	ASNFWD_STAT_SHOW(m, lpm_rebuild);
+	ASNFWD_STAT_SHOW(m, sk_hits);
+
+	for (i = 0; i < ASNFWD_DROP_REASONS; i++)
+		seq_printf(m, "drop_%-19s %llu\n", asnfwd_drop_name[i],
+		           asnfwd_stats_sum(offsetof(struct asnfwd_stats, drop[i])));
+
+	return 0;
+}
+
+static int asnfwd_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, asnfwd_stats_show, NULL);
+}
+
+static const struct file_operations asnfwd_stats_fops = {
+	.owner   = THIS_MODULE,
+	.open    = asnfwd_stats_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * asnfwd_stats_init - create the debugfs directory and the stats file
+ *
+ * Counters are still kept when debugfs is not available, they are
+ * just not exported.
+ */
+int asnfwd_stats_init(void)
+{
+	asnfwd_debugfs = debugfs_create_dir("asn-fwd", NULL);
+	if (IS_ERR_OR_NULL(asnfwd_debugfs))
+	{
+		asnfwd_debugfs = NULL;
+		return 0;
+	}
+
+	debugfs_create_file("stats", S_IRUSR, asnfwd_debugfs, NULL, &asnfwd_stats_fops);
+
+	return 0;
+}
+
+void asnfwd_stats_exit(void)
+{
+	debugfs_remove_recursive(asnfwd_debugfs);
+	asnfwd_debugfs = NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef _ASN_FWD_STATS_H
+#define _ASN_FWD_STATS_H
+
+#include <linux/percpu.h>          // included for DECLARE_PER_CPU and this_cpu_inc
+#include <linux/debugfs.h>         // included for struct dentry
+#include "asn-fwd-drop.h"
+
+struct asnfwd_stats {
+	u64 flow_hits;      /* packets encapsulated through an offloaded flow */
+	u64 flow_fallback;  /* offloaded flow found, packet left to the slow path */
+	u64 flow_added;     /* flows offloaded */
+	u64 flow_removed;   /* flows expired, invalidated or flushed */
+	u64 flow_full;      /* flows not offloaded because the table was full */
+	u64 headroom_realloc; /* packets reallocated to make room for the header or option */
+	u64 sample_lost;    /* sampled packets not exported, the reader is too slow */
+	u64 ecn_ce;         /* packets decapsulated with a CE mark */
+	u64 ecn_ce_propagated; /* CE marks of the outer header copied to the inner one */
+	u64 ecn_drop;       /* packets dropped, CE marked but not ECN capable */
+	u64 lpm_stale;      /* lookups done in the table, its NUMA local copy being rebuilt */
+	u64 lpm_rebuild;    /* ASN table dumps to rebuild the NUMA local copies */
+	u64 sk_hits;        /* local packets whose ASN lookup result was cached for their socket */
+	u64 drop[ASNFWD_DROP_REASONS]; /* packets dropped, by ASNFWD_DROP_* reason */
+};
+
+DECLARE_PER_CPU(struct asnfwd_stats, asnfwd_stats);
+
+#define ASNFWD_INC(field) this_cpu_inc(asnfwd_stats.field)
+
+extern struct dentry *asnfwd_debugfs;
+
+int asnfwd_stats_init(void);
+void asnfwd_stats_exit(void);
+
+#endif /* _ASN_FWD_STATS_H */
@@ -0,0 +1,61 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM asnfwd
+
+#if !defined(_ASN_FWD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _ASN_FWD_TRACE_H
+
+#include <linux/tracepoint.h>      // included for TRACE_EVENT
+#include <linux/skbuff.h>          // included for struct sk_buff
+#include <linux/ip.h>              // included for struct iphdr
+#include "asn-fwd-drop.h"
+
+TRACE_EVENT(asnfwd_drop,
+
+	TP_PROTO(struct sk_buff *skb, int reason),
+
+	TP_ARGS(skb, reason),
+
+	TP_STRUCT__entry(
+		__field(const void *, skbaddr)
+		__field(int,          reason)
+		__field(int,          ifindex)
+		__field(unsigned int, len)
+		__field(__be32,       saddr)
+		__field(__be32,       daddr)
+		__field(__u8,         protocol)
+	),
+
+	TP_fast_assign(
+		__entry->skbaddr = skb;
+		__entry->reason = reason;
+		__entry->ifindex = skb->dev ? skb->dev->ifindex : 0;
+		__entry->len = skb->len;
+		__entry->saddr = ip_hdr(skb)->saddr;
+		__entry->daddr = ip_hdr(skb)->daddr;
+		__entry->protocol = ip_hdr(skb)->protocol;
+	),
+
+	TP_printk("skbaddr=%p reason=%s ifindex=%d len=%u saddr=%pI4 daddr=%pI4 protocol=%u",
+	          __entry->skbaddr,
+	          __print_symbolic(__entry->reason,
+	                           { ASNFWD_DROP_MALFORMED,    "MALFORMED" },
+	                           { ASNFWD_DROP_TRUNCATED,    "TRUNCATED" },
+	                           { ASNFWD_DROP_ECN,          "ECN" },
+	                           { ASNFWD_DROP_NO_OPT_SPACE, "NO_OPT_SPACE" },
+	                           { ASNFWD_DROP_NO_HEADROOM,  "NO_HEADROOM" },
+	                           { ASNFWD_DROP_TOO_BIG,      "TOO_BIG" },
+	                           { ASNFWD_DROP_NOMEM,        "NOMEM" },
+	                           { ASNFWD_DROP_NO_ROUTE,     "NO_ROUTE" },
+	                           { ASNFWD_DROP_OTHER,        "OTHER" }),
+	          __entry->ifindex, __entry->len,
+	          &__entry->saddr, &__entry->daddr, __entry->protocol)
+);
+
+#endif /* _ASN_FWD_TRACE_H */
+
+/* the module is built out of tree, the header is found through -I$(src) */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE asn-fwd-trace
+#include <trace/define_trace.h>
@@ -0,0 +1,447 @@
+#include <linux/hashtable.h>       // included for DEFINE_HASHTABLE and the hash_* helpers
+#include <linux/workqueue.h>       // included for the garbage collector work
+#include <linux/seq_file.h>        // included for seq_printf and single_open
+#include <linux/inetdevice.h>      // included for IN_DEV_FORWARD
+#include <linux/netfilter.h>       // included for NF_ACCEPT and NF_STOLEN
+#include <net/route.h>             // included for ip_route_output_key and rt_tos2priority
+#include <net/netns/hash.h>        // included for net_hash_mix
+#include <net/net_namespace.h>     // included for register_pernet_subsys
+#include <net/xfrm.h>              // included for XFRM_POLICY_FWD
+#include "asn-fwd-tunnel.h"
+#include "asn-fwd-common.h"
+#include "asn-fwd-stats.h"
+#include "asn-fwd-ipip.h"
+#include "asn-fwd-options.h"
+#include "asn-fwd-drop.h"
+
+#define ASNFWD_TUNNEL_BITS    8
+#define ASNFWD_TUNNEL_TIMEOUT (60 * HZ)
+
+static DEFINE_HASHTABLE(asnfwd_tunnel_table, ASNFWD_TUNNEL_BITS);
+static DEFINE_SPINLOCK(asnfwd_tunnel_lock);
+
+static void asnfwd_tunnel_gc(struct work_struct *work);
+static DECLARE_DELAYED_WORK(asnfwd_tunnel_gc_work, asnfwd_tunnel_gc);
+
+static u32 asnfwd_tunnel_hash(struct net *net, __be32 gw)
+{
+	return (__force u32) gw ^ net_hash_mix(net);
+}
+
+static void asnfwd_tunnel_free_rcu(struct rcu_head *head)
+{
+	struct asnfwd_tunnel *tun = container_of(head, struct asnfwd_tunnel, rcu);
+
+	dst_release(rcu_dereference_raw(tun->dst));
+	kfree(tun);
+}
+
+void asnfwd_tunnel_put(struct asnfwd_tunnel *tun)
+{
+	if (atomic_dec_and_test(&tun->refcnt))
+		call_rcu(&tun->rcu, asnfwd_tunnel_free_rcu);
+}
+
+/*
+ * must be called with asnfwd_tunnel_lock held, @dead when the table
+ * reference was the last one and the count was already taken to 0
+ */
+static void __asnfwd_tunnel_del(struct asnfwd_tunnel *tun, bool dead)
+{
+	hash_del_rcu(&tun->node);
+
+	if (dead)
+		call_rcu(&tun->rcu, asnfwd_tunnel_free_rcu);
+	else
+		asnfwd_tunnel_put(tun); /* the table reference */
+}
+
+static struct asnfwd_tunnel *__asnfwd_tunnel_find(struct net *net, __be32 gw, u32 hash)
+{
+	struct asnfwd_tunnel *tun;
+
+	hash_for_each_possible_rcu(asnfwd_tunnel_table, tun, node, hash)
+	{
+		if (tun->gw == gw && net_eq(tun->net, net))
+			return tun;
+	}
+
+	return NULL;
+}
+
+/**
+ * asnfwd_tunnel_get - get the tunnel state of an ASN gateway
+ * @net: network namespace of the packet
+ * @gw: the ASN gateway
+ *
+ * Creates the state on first use. Returns it with a reference held, to
+ * be dropped with asnfwd_tunnel_put, or NULL if out of memory.
+ */
+struct asnfwd_tunnel *asnfwd_tunnel_get(struct net *net, __be32 gw)
+{
+	u32 hash = asnfwd_tunnel_hash(net, gw);
+	struct asnfwd_tunnel *tun, *old;
+
+	rcu_read_lock();
+	tun = __asnfwd_tunnel_find(net, gw, hash);
+	if (tun && !atomic_inc_not_zero(&tun->refcnt))
+		tun = NULL;
+	rcu_read_unlock();
+
+	if (tun)
+		return tun;
+
+	tun = kzalloc(sizeof(*tun), GFP_ATOMIC);
+	if (!tun)
+		return NULL;
+
+	atomic_set(&tun->refcnt, 2); /* the table and the caller */
+	tun->net = net;
+	tun->gw = gw;
+	tun->last_used = jiffies;
+	spin_lock_init(&tun->dst_lock);
+
+	/* everything asnfwd_add_header does not copy from the inner header */
+	tun->tmpl.version = IPVERSION;
+	tun->tmpl.ihl = sizeof(struct iphdr) >> 2;
+	tun->tmpl.protocol = ASNFWD_PROTOCOL;
+	tun->tmpl.daddr = gw;
+
+	spin_lock_bh(&asnfwd_tunnel_lock);
+
+	/* another CPU may have created it meanwhile */
+	old = __asnfwd_tunnel_find(net, gw, hash);
+	if (old)
+	{
+		asnfwd_tunnel_hold(old);
+		spin_unlock_bh(&asnfwd_tunnel_lock);
+		kfree(tun);
+		return old;
+	}
+
+	hash_add_rcu(asnfwd_tunnel_table, &tun->node, hash);
+
+	spin_unlock_bh(&asnfwd_tunnel_lock);
+
+	PRINTK("Tunnel to %pI4 created\n", &gw);
+
+	return tun;
+}
+
+static void asnfwd_tunnel_dst_set(struct asnfwd_tunnel *tun, struct dst_entry *dst)
+{
+	struct dst_entry *old;
+
+	/* routes not cached by the stack can't be kept under RCU, see ip_tunnel */
+	if (dst && (dst->flags & DST_NOCACHE))
+	{
+		dst_release(dst);
+		dst = NULL;
+	}
+
+	spin_lock_bh(&tun->dst_lock);
+	old = rcu_dereference_protected(tun->dst, lockdep_is_held(&tun->dst_lock));
+	rcu_assign_pointer(tun->dst, dst);
+	spin_unlock_bh(&tun->dst_lock);
+
+	dst_release(old);
+}
+
+/**
+ * asnfwd_tunnel_dst - get the route towards the gateway
+ * @tun: the tunnel
+ *
+ * The cached route is checked with dst_check and looked up again when
+ * the routing changed. Returns it with a reference held, or NULL if
+ * there is no unicast route towards the gateway.
+ */
+struct dst_entry *asnfwd_tunnel_dst(struct asnfwd_tunnel *tun)
+{
+	struct dst_entry *dst;
+	struct rtable *rt;
+	struct flowi4 fl4;
+
+	rcu_read_lock();
+	dst = rcu_dereference(tun->dst);
+	if (dst)
+		dst_hold(dst);
+	rcu_read_unlock();
+
+	if (dst && !dst_check(dst, 0))
+	{
+		asnfwd_tunnel_dst_set(tun, NULL);
+		dst_release(dst);
+		dst = NULL;
+	}
+
+	if (dst)
+		return dst;
+
+	memset(&fl4, 0, sizeof(fl4));
+	fl4.daddr = tun->gw;
+	rt = ip_route_output_key(tun->net, &fl4);
+	if (IS_ERR(rt))
+		return NULL;
+
+	if (rt->rt_type != RTN_UNICAST)
+	{
+		ip_rt_put(rt);
+		return NULL;
+	}
+
+	asnfwd_tunnel_dst_set(tun, dst_clone(&rt->dst));
+
+	return &rt->dst;
+}
+
+/*
+ * ip_forward runs the FORWARD chain and the IPsec forward policy check,
+ * sending from PRE_ROUTING skips both. Any FORWARD hook counts, even the
+ * empty chain of a loaded iptable_filter: the module can't tell whether
+ * a rule would match.
+ */
+static bool asnfwd_tunnel_forward_checked(struct net *net, const struct sk_buff *skb)
+{
+	if (!list_empty(&nf_hooks[NFPROTO_IPV4][NF_INET_FORWARD]))
+		return true;
+
+#ifdef CONFIG_XFRM
+	if (net->xfrm.policy_count[XFRM_POLICY_FWD] || skb->sp)
+		return true;
+#endif
+
+	return false;
+}
+
+/**
+ * asnfwd_tunnel_xmit - send an encapsulated packet towards its gateway
+ * @tun: the tunnel the packet was encapsulated to
+ * @skb: the socket buffer, with a valid IP checksum
+ * @in: The input device, if incoming packet
+ *
+ * Locally generated packets get the route towards the gateway and are
+ * accepted. Forwarded packets are sent right away, sparing the stack the
+ * route lookup of the new destination, and NF_STOLEN is returned, but
+ * only when nothing is registered on the forward path: otherwise they are
+ * accepted and routed by the stack, so the FORWARD chain and the IPsec
+ * policies apply to every packet. Those ip_forward has to answer with an
+ * ICMP error, or whose IP options it has to process, are accepted too.
+ */
+unsigned int asnfwd_tunnel_xmit(struct asnfwd_tunnel *tun,
+                                struct sk_buff *skb,
+                                const struct net_device *in)
+{
+	struct iphdr *iph = ip_hdr(skb);
+	struct in_device *in_dev;
+	struct dst_entry *dst;
+
+	if (tun->last_used != jiffies)
+		tun->last_used = jiffies;
+
+	dst = asnfwd_tunnel_dst(tun);
+	if (!dst)
+		return NF_ACCEPT;
+
+	if (!in)
+	{
+		skb_dst_drop(skb);
+		skb_dst_set(skb, dst);
+		return NF_ACCEPT;
+	}
+
+	if (asnfwd_tunnel_forward_checked(dev_net(in), skb))
+		goto slow;
+
+	in_dev = __in_dev_get_rcu(in);
+	if (!in_dev || !IN_DEV_FORWARD(in_dev) || skb->pkt_type != PACKET_HOST || iph->ttl <= 1)
+		goto slow;
+
+	/* options other than the ASN-FWD one */
+	if (iph->ihl * 4 > sizeof(struct iphdr) + IPOPT_ASNFWD_LEN)
+		goto slow;
+
+	if (!skb_is_gso(skb) && (iph->frag_off & htons(IP_DF)) && skb->len > dst_mtu(dst))
+		goto slow;
+
+	/* same as ip_forward, make room for the link layer header */
+	if (skb_cow(skb, LL_RESERVED_SPACE(dst->dev) + dst->header_len))
+	{
+		dst_release(dst);
+		return asnfwd_drop(skb, in, ASNFWD_DROP_NO_HEADROOM);
+	}
+
+	iph = ip_hdr(skb);
+	ip_decrease_ttl(iph);
+
+	skb->priority = rt_tos2priority(iph->tos);
+	IPCB(skb)->flags |= IPSKB_FORWARDED;
+
+	skb_dst_drop(skb);
+	skb_dst_set(skb, dst);
+
+	dst_output(skb);
+
+	return NF_STOLEN;
+
+slow:
+	dst_release(dst);
+	return NF_ACCEPT;
+}
+
+static void asnfwd_tunnel_gc(struct work_struct *work)
+{
+	struct asnfwd_tunnel *tun;
+	struct hlist_node *tmp;
+	int bkt;
+
+	spin_lock_bh(&asnfwd_tunnel_lock);
+
+	/*
+	 * only the table holds it and nobody sent through it for a while,
+	 * asnfwd_tunnel_get may take a reference without the lock, so the
+	 * count goes from 1 to 0 atomically and a tunnel at 0 is never taken
+	 */
+	hash_for_each_safe(asnfwd_tunnel_table, bkt, tmp, tun, node)
+	{
+		if (time_after(jiffies, tun->last_used + ASNFWD_TUNNEL_TIMEOUT) &&
+		    atomic_cmpxchg(&tun->refcnt, 1, 0) == 1)
+			__asnfwd_tunnel_del(tun, true);
+	}
+
+	spin_unlock_bh(&asnfwd_tunnel_lock);
+
+	schedule_delayed_work(&asnfwd_tunnel_gc_work, 10 * HZ);
+}
+
+/* cached routes hold their device, drop them before the device goes away */
+static int asnfwd_tunnel_netdev_event(struct notifier_block *nb,
+                                      unsigned long event,
+                                      void *ptr)
+{
+	struct net_device *dev = netdev_notifier_info_to_dev(ptr);
+	struct asnfwd_tunnel *tun;
+	struct dst_entry *dst;
+	int bkt;
+
+	if (event != NETDEV_DOWN && event != NETDEV_UNREGISTER)
+		return NOTIFY_DONE;
+
+	spin_lock_bh(&asnfwd_tunnel_lock);
+
+	hash_for_each(asnfwd_tunnel_table, bkt, tun, node)
+	{
+		dst = rcu_dereference_protected(tun->dst, 1);
+		if (dst && dst->dev == dev)
+			asnfwd_tunnel_dst_set(tun, NULL);
+	}
+
+	spin_unlock_bh(&asnfwd_tunnel_lock);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block asnfwd_tunnel_notifier = {
+	.notifier_call = asnfwd_tunnel_netdev_event,
+};
+
+/**
+ * asnfwd_tunnel_flush - remove tunnels from the table
+ * @net: only remove the tunnels of this namespace, NULL for all
+ *
+ * Tunnels still referenced by flows are freed with their last flow.
+ */
+static void asnfwd_tunnel_flush(struct net *net)
+{
+	struct asnfwd_tunnel *tun;
+	struct hlist_node *tmp;
+	int bkt;
+
+	spin_lock_bh(&asnfwd_tunnel_lock);
+
+	hash_for_each_safe(asnfwd_tunnel_table, bkt, tmp, tun, node)
+	{
+		if (!net || net_eq(tun->net, net))
+			__asnfwd_tunnel_del(tun, false);
+	}
+
+	spin_unlock_bh(&asnfwd_tunnel_lock);
+}
+
+static void __net_exit asnfwd_tunnel_net_exit(struct net *net)
+{
+	asnfwd_tunnel_flush(net);
+}
+
+static struct pernet_operations asnfwd_tunnel_net_ops = {
+	.exit = asnfwd_tunnel_net_exit,
+};
+
+static int asnfwd_tunnel_show(struct seq_file *m, void *v)
+{
+	struct asnfwd_tunnel *tun;
+	struct dst_entry *dst;
+	int bkt;
+
+	rcu_read_lock();
+
+	hash_for_each_rcu(asnfwd_tunnel_table, bkt, tun, node)
+	{
+		dst = rcu_dereference(tun->dst);
+		seq_printf(m, "%pI4 refcnt %d dev %s idle %ums\n",
+		           &tun->gw, atomic_read(&tun->refcnt),
+		           dst ? dst->dev->name : "-",
+		           jiffies_to_msecs(jiffies - tun->last_used));
+	}
+
+	rcu_read_unlock();
+
+	return 0;
+}
+
+static int asnfwd_tunnel_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, asnfwd_tunnel_show, NULL);
+}
+
+static const struct file_operations asnfwd_tunnel_fops = {
+	.owner   = THIS_MODULE,
+	.open    = asnfwd_tunnel_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+int asnfwd_tunnel_init(void)
+{
+	int err;
+
+	err = register_pernet_subsys(&asnfwd_tunnel_net_ops);
+	if (err != 0)
+		return err;
+
+	err = register_netdevice_notifier(&asnfwd_tunnel_notifier);
+	if (err != 0)
+	{
+		unregister_pernet_subsys(&asnfwd_tunnel_net_ops);
+		return err;
+	}
+
+	if (asnfwd_debugfs)
+		debugfs_create_file("tunnels", S_IRUSR, asnfwd_debugfs, NULL, &asnfwd_tunnel_fops);
+
+	schedule_delayed_work(&asnfwd_tunnel_gc_work, 10 * HZ);
+
+	return 0;
+}
+
+void asnfwd_tunnel_exit(void)
+{
+	cancel_delayed_work_sync(&asnfwd_tunnel_gc_work);
+	unregister_netdevice_notifier(&asnfwd_tunnel_notifier);
+	unregister_pernet_subsys(&asnfwd_tunnel_net_ops);
+
+	asnfwd_tunnel_flush(NULL);
+
+	/* wait for the tunnels to be freed before the module goes away */
+	rcu_barrier();
+}
@@ -0,0 +1,38 @@
+#ifndef _ASN_FWD_TUNNEL_H
+#define _ASN_FWD_TUNNEL_H
+
+#include <linux/skbuff.h>          // included for struct sk_buff and related functions
+#include <linux/ip.h>              // included for struct iphdr, ntohs, htons and others
+#include <net/dst.h>               // included for struct dst_entry and dst_check
+
+/*
+ * Per ASN gateway state, shared by every packet encapsulated to the
+ * gateway: the route towards it and the outer IPv4 header template.
+ */
+struct asnfwd_tunnel {
+	struct hlist_node          node;
+	struct rcu_head            rcu;
+	atomic_t                   refcnt;
+	struct net                *net;
+	__be32                     gw;
+	struct iphdr               tmpl;     /* outer header, per packet fields zeroed */
+	spinlock_t                 dst_lock;
+	struct dst_entry __rcu    *dst;      /* route towards gw, may be NULL */
+	unsigned long              last_used;
+};
+
+struct asnfwd_tunnel *asnfwd_tunnel_get(struct net *net, __be32 gw);
+void asnfwd_tunnel_put(struct asnfwd_tunnel *tun);
+struct dst_entry *asnfwd_tunnel_dst(struct asnfwd_tunnel *tun);
+unsigned int asnfwd_tunnel_xmit(struct asnfwd_tunnel *tun,
+                                struct sk_buff *skb,
+                                const struct net_device *in);
+int asnfwd_tunnel_init(void);
+void asnfwd_tunnel_exit(void);
+
+static inline void asnfwd_tunnel_hold(struct asnfwd_tunnel *tun)
+{
+	atomic_inc(&tun->refcnt);
+}
+
+#endif /* _ASN_FWD_TUNNEL_H */
@@ -28,6 +28,13 @@
 #include <errno.h>
 #include <sys/select.h>
 #include <sys/time.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <linux/filter.h>
+
+#include "pinglog.h"
 
 #include <sys/param.h>
 #include <sys/types.h>
@@ -50,6 +57,8 @@
 #define FLOOD		4	/* floodping flag */
 #define RECORDROUTE     8       /* add record route IP option */
 #define NOOP            16      /* add 4 NOOP IP options */
+#define RESERVE         32      /* add 8 NOOP IP options, room for the ASN-FWD option */
+#define ABTEST          64      /* interleave plain and ASN-FWD probes */
 #ifndef MAXHOSTNAMELEN
 #define MAXHOSTNAMELEN	64
 #endif
@@ -74,12 +83,61 @@ int preload = 0;		/* number of packets to "preload" */
 int ntransmitted = 0;		/* sequence # for outbound packets = #sent */
 int ident;
 
+/* A/B mode: even sequence numbers are sent plain, odd ones through the box */
+/* paced mode, -i or -R: probes are sent from a timerfd instead of SIGALRM */
+long long interval;		/* nsec between probes, 0 if not paced */
+struct timespec first_sent, last_sent;
+long long late;			/* probes sent late, to catch up with the schedule */
+
+/* binary result log, -w */
+FILE *logfp;
+struct pinglog_hdr loghdr;
+u_int32_t lastseq;		/* highest unwrapped sequence logged */
+
+/* multi-target mode, -T: probes go round-robin to every target of a list */
+struct target {
+	struct sockaddr_in addr;
+	char *name;
+	u_short seq;		/* sequence space of the target */
+	int ntransmitted, nreceived;
+	double tmin, tmax, tsum;	/* round-trip times, usec */
+};
+struct target *targets;
+int ntargets, next_target;
+int nunknown;			/* replies matching no probe: late, duplicated or not ours */
+
+/* probes in flight, open addressing on (address, sequence) */
+struct probe {
+	in_addr_t addr;
+	u_short seq;
+	u_short used;
+	int target;
+	time_t sent;
+};
+struct probe *probes;
+u_int pmask;
+#define PROBE_SCAN	8	/* slots looked at from the home slot */
+
+int s2 = -1;			/* socket of the ASN-FWD probes */
+struct sockaddr_in gateway;	/* ASN-FWD box decapsulating the probes, -I */
+struct in_addr source;		/* our address, for the inner header */
+double *rtt[2];			/* round-trip times of each stream, usec */
+int nrtt[2], artt[2];
+
 int nreceived = 0;		/* # of packets we got back */
 int timing = 0;
 int tmin = 999999999;
 int tmax = 0;
 int tsum = 0;			/* sum of all times, for doing average */
 void finish(int), catcher(int);
+int send_b(u_char *, int);
+void ab_record(int, double), ab_report(void);
+void paced(void);
+void attach_filter(void);
+void targets_read(char *), probes_alloc(void), probe_add(int, int), targets_report(void);
+int probe_match(in_addr_t, int);
+struct target *reply_target(struct ip *, struct icmp *, int);
+void log_open(char *), log_reply(struct ip *, struct icmp *, int, struct timeval *, struct timeval *), log_close(void);
 char *inet_ntoa();
 
 #define IPOPT_TYPE_NOP 0x01
@@ -95,6 +153,22 @@ struct ip_opt_rr {
 	unsigned char pad;
 };
 
+/* same layout as struct asnfwd_opt in the module */
+#define IPOPT_TYPE_ASNFWD 222
+#define ASNFWD_PROTOCOL   254
+
+struct ip_opt_asnfwd {
+	unsigned char type;
+	unsigned char len;
+	unsigned char addr[4];
+	unsigned char pad1;
+	unsigned char pad2;
+};
+
+#ifndef ICMP_FILTER
+#define ICMP_FILTER 1
+#endif
+
 /*
  * 			M A I N
  */
@@ -107,6 +181,10 @@ char *argv[];
 	int on = 1;
 	struct protoent *proto;
 	struct ip_opt_rr *rr;
+	struct ip_opt_asnfwd asnopt;
+	char *gwname = NULL;
+	char *listname = NULL;
+	u_int32_t filter = ~0;
 	int optlen;
 
 	argc--, av++;
@@ -118,6 +196,46 @@ char *argv[];
 			case 'n':
 				pingflags |= NOOP;
 				break;
+			case 'a':
+				pingflags |= RESERVE;
+				break;
+			case 'A':
+				pingflags |= ABTEST;
+				break;
+			case 'i':
+			case 'R':
+				if (argc < 2)
+					break;
+				if (*av[0] == 'i')
+					interval = atof(av[1]) * 1e9;
+				else if (atof(av[1]) > 0)
+					interval = 1e9 / atof(av[1]);
+				av++, argc--;
+				av[0] += strlen(av[0]) - 1;	/* end of this argument */
+				break;
+			case 'w':
+				if (argc < 2)
+					break;
+				pingflags |= QUIET;
+				log_open(*++av);
+				argc--;
+				av[0] += strlen(av[0]) - 1;	/* end of this argument */
+				break;
+			case 'T':
+				if (argc < 2)
+					break;
+				listname = *++av;
+				argc--;
+				av[0] += strlen(av[0]) - 1;	/* end of this argument */
+				break;
+			case 'I':
+				if (argc < 2)
+					break;
+				pingflags |= ABTEST;
+				gwname = *++av;
+				argc--;
+				av[0] += strlen(av[0]) - 1;	/* end of this argument */
+				break;
 			case 'v':
 				pingflags |= VERBOSE;
 				break;
@@ -130,31 +248,45 @@ char *argv[];
 		}
 		argc--, av++;
 	}
-	if(argc < 1 || argc > 4)  {
-		printf("Usage:  ping [-rnvqf] host [packetsize [count [preload]]]\n");
+	if (listname) {
+		/* the list replaces the host argument */
+		if (pingflags & ABTEST || logfp) {
+			fprintf(stderr, "ping: -T can't be used with -A, -I or -w\n");
+			exit(1);
+		}
+		targets_read(listname);
+	}
+	if(argc < (listname ? 0 : 1) || argc > (listname ? 3 : 4))  {
+		printf("Usage:  ping [-rnavqfA] [-I gateway] [-i interval | -R pps] [-w file] host [packetsize [count [preload]]]\n");
+		printf("        ping [-rnavqf] [-i interval | -R pps] -T file [packetsize [count [preload]]]\n");
 		exit(1);
 	}
 
 	bzero((char *)&whereto, sizeof(struct sockaddr) );
 	to->sin_family = AF_INET;
-	to->sin_addr.s_addr = inet_addr(av[0]);
-	if(to->sin_addr.s_addr != (unsigned)-1) {
-		strcpy(hnamebuf, av[0]);
-		hostname = hnamebuf;
+	if (listname) {
+		hostname = listname;
 	} else {
-		hp = gethostbyname(av[0]);
-		if (hp) {
-			to->sin_family = hp->h_addrtype;
-			bcopy(hp->h_addr, (caddr_t)&to->sin_addr, hp->h_length);
-			hostname = hp->h_name;
+		to->sin_addr.s_addr = inet_addr(av[0]);
+		if(to->sin_addr.s_addr != (unsigned)-1) {
+			strcpy(hnamebuf, av[0]);
+			hostname = hnamebuf;
 		} else {
-			printf("%s: unknown host %s\n", argv[0], av[0]);
-			exit(1);
+			hp = gethostbyname(av[0]);
+			if (hp) {
+				to->sin_family = hp->h_addrtype;
+				bcopy(hp->h_addr, (caddr_t)&to->sin_addr, hp->h_length);
+				hostname = hp->h_name;
+			} else {
+				printf("%s: unknown host %s\n", argv[0], av[0]);
+				exit(1);
+			}
 		}
+		argc--, av++;
 	}
 
-	if( argc >= 2 )
-		datalen = atoi( av[1] );
+	if( argc >= 1 )
+		datalen = atoi( av[0] );
 	else
 		datalen = 64-8;
 	if (datalen > MAXPACKET) {
@@ -164,11 +296,19 @@ char *argv[];
 	if (datalen >= sizeof(struct timeval))	/* can we time 'em? */
 		timing = 1;
 
-	if (argc >= 3)
-		npackets = atoi(av[2]);
+	if (argc >= 2)
+		npackets = atoi(av[1]);
 
-	if (argc == 4)
-		preload = atoi(av[3]);
+	if (argc == 3)
+		preload = atoi(av[2]);
+
+	if (ntargets) {
+		/* count is per target, sends are paced so a list doesn't burst */
+		npackets *= ntargets;
+		if (interval == 0 && !(pingflags & FLOOD))
+			interval = 10000000;	/* 10 ms, fping's default */
+		probes_alloc();
+	}
 
 	ident = getpid() & 0xFFFF;
 
@@ -181,7 +321,8 @@ char *argv[];
 		perror("ping: socket");
 		exit(5);
 	}
-	if (pingflags & (NOOP|RECORDROUTE)) {
+	attach_filter();
+	if (pingflags & (NOOP|RESERVE|RECORDROUTE)) {
 		optlen = 0;
 		if(pingflags & NOOP) {
 			if(pingflags & VERBOSE)
@@ -192,6 +333,12 @@ char *argv[];
 			ipopt[3] = IPOPT_TYPE_NOP;
 			optlen += 4;
 		}
+		if(pingflags & RESERVE) {
+			if(pingflags & VERBOSE)
+				printf("...reserve.\n");
+			memset(&ipopt[optlen], IPOPT_TYPE_NOP, 8);
+			optlen += 8;
+		}
 		if(pingflags & RECORDROUTE) {
 			if(pingflags & VERBOSE)
 				printf("...record route.\n");
@@ -210,7 +357,61 @@ char *argv[];
 		}
 	}
 
-	if(to->sin_family == AF_INET) {
+	if (pingflags & ABTEST) {
+		if (gwname) {
+			/* probes encapsulated by hand, decapsulated by the box */
+			struct sockaddr_in me;
+			int fd, melen = sizeof(me);
+
+			gateway.sin_family = AF_INET;
+			gateway.sin_addr.s_addr = inet_addr(gwname);
+			if (gateway.sin_addr.s_addr == (unsigned)-1) {
+				fprintf(stderr, "ping: bad gateway %s\n", gwname);
+				exit(1);
+			}
+
+			/* the target replies to the inner source, find ours */
+			fd = socket(AF_INET, SOCK_DGRAM, 0);
+			to->sin_port = htons(1025);
+			if (fd < 0 || connect(fd, &whereto, sizeof(whereto)) != 0 ||
+			    getsockname(fd, (struct sockaddr *) &me, &melen) != 0) {
+				perror("ping: source address");
+				exit(5);
+			}
+			to->sin_port = 0;
+			close(fd);
+			source = me.sin_addr;
+
+			if ((s2 = socket(AF_INET, SOCK_RAW, IPPROTO_RAW)) < 0) {
+				perror("ping: socket");
+				exit(5);
+			}
+		} else {
+			/* probes carrying the ASN-FWD option */
+			if ((s2 = socket(AF_INET, SOCK_RAW, proto->p_proto)) < 0) {
+				perror("ping: socket");
+				exit(5);
+			}
+
+			asnopt.type = IPOPT_TYPE_ASNFWD;
+			asnopt.len = sizeof(asnopt);
+			bcopy(&to->sin_addr, asnopt.addr, sizeof(asnopt.addr));
+			asnopt.pad1 = IPOPT_TYPE_NOP;
+			asnopt.pad2 = 0;
+			if (setsockopt(s2, IPPROTO_IP, IP_OPTIONS, (void *) &asnopt, sizeof(asnopt)) != 0) {
+				fprintf(stderr, "setsockopt: %s\n", strerror(errno));
+				exit(6);
+			}
+
+			/* replies are read from the first socket only */
+			setsockopt(s2, SOL_RAW, ICMP_FILTER, &filter, sizeof(filter));
+		}
+	}
+
+	if (ntargets) {
+		printf("PING %s (%d targets): %d data bytes\n", hostname,
+		  ntargets, datalen);
+	} else if(to->sin_family == AF_INET) {
 		printf("PING %s (%s): %d data bytes\n", hostname,
 		  inet_ntoa(to->sin_addr), datalen);	/* DFM */
 	} else {
@@ -225,6 +426,9 @@ char *argv[];
 	for(i=0; i < preload; i++)
 		pinger();
 
+	if (interval > 0)
+		paced();	/* never returns */
+
 	if(!(pingflags & FLOOD))
 		catcher(SIGALRM);	/* start things going */
 
@@ -289,6 +493,126 @@ void catcher(int sig)
 	}
 }
 
+/*
+ *			A T T A C H _ F I L T E R
+ *
+ * Have the kernel drop the ICMP packets that are not for us, instead of
+ * copying them all to pr_pack: echo replies with another ident, and with
+ * -q every other type, which pr_pack would not print.  pr_pack still
+ * checks, the filter is only a shortcut.
+ */
+void attach_filter(void)
+{
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),			/* X = IP header length */
+		BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),			/* A = ICMP type */
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ICMP_ECHOREPLY, 0, 2),
+		BPF_STMT(BPF_LD | BPF_H | BPF_IND, 4),			/* A = ICMP id */
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htons(ident), 1, 2),
+		BPF_STMT(BPF_RET | BPF_K, ~0U),				/* other types */
+		BPF_STMT(BPF_RET | BPF_K, ~0U),				/* accept */
+		BPF_STMT(BPF_RET | BPF_K, 0),				/* drop */
+	};
+	struct sock_fprog prog = { sizeof(code) / sizeof(code[0]), code };
+
+	/* other types are not printed anyway */
+	if (pingflags & QUIET)
+		code[5] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0);
+
+	if (setsockopt(s, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0)
+		fprintf(stderr, "ping: SO_ATTACH_FILTER: %s, filtering in userspace\n", strerror(errno));
+}
+
+/*
+ *			P A C E D
+ *
+ * Replaces catcher() when -i or -R is given.  Probes are sent from a
+ * periodic timerfd: the kernel counts its expirations against the start
+ * time, so a late wakeup sends the missed probes right away and never
+ * shifts the schedule, unlike alarm(1).
+ */
+void paced(void)
+{
+	struct itimerspec its;
+	struct sockaddr_in from;
+	struct timeval tv, *tvp;
+	struct timespec now, end;
+	uint64_t exp;
+	int tfd, fromlen, cc, n, waiting = 0;
+	fd_set fds;
+
+	if ((tfd = timerfd_create(CLOCK_MONOTONIC, 0)) < 0) {
+		perror("ping: timerfd_create");
+		exit(5);
+	}
+
+	its.it_interval.tv_sec = interval / 1000000000;
+	its.it_interval.tv_nsec = interval % 1000000000;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(tfd, 0, &its, NULL) != 0) {
+		perror("ping: timerfd_settime");
+		exit(5);
+	}
+
+	for (;;) {
+		FD_ZERO(&fds);
+		FD_SET(s, &fds);
+		tvp = NULL;
+
+		if (waiting) {
+			/* all probes sent, wait for the last replies */
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec > end.tv_sec ||
+			    (now.tv_sec == end.tv_sec && now.tv_nsec >= end.tv_nsec))
+				finish(SIGINT);
+			tv.tv_sec = end.tv_sec - now.tv_sec;
+			tv.tv_usec = (end.tv_nsec - now.tv_nsec) / 1000;
+			if (tv.tv_usec < 0) {
+				tv.tv_sec--;
+				tv.tv_usec += 1000000;
+			}
+			tvp = &tv;
+		} else
+			FD_SET(tfd, &fds);
+
+		n = select((s > tfd ? s : tfd) + 1, &fds, NULL, NULL, tvp);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("ping: select");
+			exit(5);
+		}
+
+		if (FD_ISSET(tfd, &fds) && read(tfd, &exp, sizeof(exp)) == sizeof(exp)) {
+			late += exp - 1;
+			for ( ; exp > 0 && (npackets == 0 || ntransmitted < npackets); exp--) {
+				pinger();
+				clock_gettime(CLOCK_MONOTONIC, &last_sent);
+				if (ntransmitted == 1)
+					first_sent = last_sent;
+			}
+			if (npackets && ntransmitted >= npackets) {
+				waiting = 1;
+				end = last_sent;
+				end.tv_sec += nreceived ? 2 * tmax / 1000 + 1 : MAXWAIT;
+			}
+		}
+
+		if (FD_ISSET(s, &fds)) {
+			fromlen = sizeof(from);
+			cc = recvfrom(s, packet, sizeof(packet), 0, (struct sockaddr *) &from, &fromlen);
+			if (cc < 0) {
+				if (errno != EINTR)
+					perror("ping: recvfrom");
+				continue;
+			}
+			pr_pack(packet, cc, &from);
+			if (npackets && nreceived >= npackets)
+				finish(SIGINT);
+		}
+	}
+}
+
 /*
  * 			P I N G E R
  * 
@@ -305,11 +629,21 @@ pinger()
 	int i, cc;
 	register struct timeval *tp = (struct timeval *) &outpack[8];
 	register u_char *datap = &outpack[8+sizeof(struct timeval)];
+	struct target *t = NULL;
+	int n;
 
 	icp->icmp_type = ICMP_ECHO;
 	icp->icmp_code = 0;
 	icp->icmp_cksum = 0;
-	icp->icmp_seq = ntransmitted++;
+	if (ntargets) {
+		/* round-robin, each target has its own sequence space */
+		n = next_target;
+		next_target = (next_target + 1) % ntargets;
+		t = &targets[n];
+		icp->icmp_seq = t->seq++;
+		ntransmitted++;
+	} else
+		icp->icmp_seq = ntransmitted++;
 	icp->icmp_id = ident;		/* ID */
 
 	cc = datalen+8;			/* skips ICMP portion */
@@ -324,13 +658,21 @@ pinger()
 	icp->icmp_cksum = in_cksum( icp, cc );
 
 	/* cc = sendto(s, msg, len, flags, to, tolen) */
-	i = sendto( s, outpack, cc, 0, &whereto, sizeof(struct sockaddr) );
+	if (t)
+		i = sendto( s, outpack, cc, 0, (struct sockaddr *) &t->addr, sizeof(t->addr) );
+	else if ((pingflags & ABTEST) && (icp->icmp_seq & 1))
+		i = send_b( outpack, cc );
+	else
+		i = sendto( s, outpack, cc, 0, &whereto, sizeof(struct sockaddr) );
 
 	if( i < 0 || i != cc )  {
 		if( i<0 )  perror("sendto");
 		printf("ping: wrote %s %d chars, ret=%d\n",
-			hostname, cc, i );
+			t ? t->name : hostname, cc, i );
 		fflush(stdout);
+	} else if (t) {
+		t->ntransmitted++;
+		probe_add(n, icp->icmp_seq);
 	}
 	if(pingflags == FLOOD) {
 		putchar('.');
@@ -338,6 +680,50 @@ pinger()
 	}
 }
 
+/*
+ *			S E N D _ B
+ *
+ * Transmit a probe of the ASN-FWD stream: through the socket carrying
+ * the ASN-FWD option, or encapsulated by hand to the gateway given with
+ * -I.  The kernel fills the outer source address, id and checksum.
+ */
+int send_b(u_char *icmp, int cc)
+{
+	static u_char encap[2 * sizeof(struct ip) + MAXPACKET];
+	struct ip *outer = (struct ip *) encap;
+	struct ip *inner = (struct ip *) &encap[sizeof(struct ip)];
+	int len = 2 * sizeof(struct ip) + cc;
+	int i;
+
+	if (!gateway.sin_addr.s_addr)
+		return sendto(s2, icmp, cc, 0, &whereto, sizeof(struct sockaddr));
+
+	bzero(encap, 2 * sizeof(struct ip));
+
+	outer->ip_v = IPVERSION;
+	outer->ip_hl = sizeof(struct ip) >> 2;
+	outer->ip_len = htons(len);
+	outer->ip_ttl = MAXTTL;
+	outer->ip_p = ASNFWD_PROTOCOL;
+	outer->ip_dst = gateway.sin_addr;
+
+	inner->ip_v = IPVERSION;
+	inner->ip_hl = sizeof(struct ip) >> 2;
+	inner->ip_len = htons(sizeof(struct ip) + cc);
+	inner->ip_id = htons(ntransmitted);
+	inner->ip_ttl = MAXTTL;
+	inner->ip_p = IPPROTO_ICMP;
+	inner->ip_src = source;
+	inner->ip_dst = ((struct sockaddr_in *) &whereto)->sin_addr;
+	inner->ip_sum = in_cksum(inner, sizeof(struct ip));
+
+	bcopy(icmp, &encap[2 * sizeof(struct ip)], cc);
+
+	i = sendto(s2, encap, len, 0, (struct sockaddr *) &gateway, sizeof(gateway));
+
+	return i == len ? cc : i;
+}
+
 /*
  * 			P R _ T Y P E
  *
@@ -390,8 +776,9 @@ struct sockaddr_in *from;
 	register struct icmp *icp;
 	register long *lp = (long *) packet;
 	register int i;
-	struct timeval tv;
+	struct timeval tv, recv;
 	struct timeval *tp;
+	struct target *t = NULL;
 	int hlen, triptime;
 
 	from->sin_addr.s_addr = ntohl( from->sin_addr.s_addr );
@@ -418,13 +805,31 @@ struct sockaddr_in *from;
 		}
 		return;
 	}
-	if( icp->icmp_id != ident )
+	if( icp->icmp_id != ident ||
+	    (ntargets && (t = reply_target(ip, icp, cc)) == NULL) )
 		return;			/* 'Twas not our ECHO */
 
+	if (t)
+		t->nreceived++;
+
 	if (timing) {
 		tp = (struct timeval *)&icp->icmp_data[0];
+		recv = tv;
+		if (logfp)
+			log_reply(ip, icp, cc, tp, &recv);
 		tvsub( &tv, tp );
 		triptime = tv.tv_sec*1000+(tv.tv_usec/1000);
+		if (pingflags & ABTEST)
+			ab_record(icp->icmp_seq & 1, tv.tv_sec * 1e6 + tv.tv_usec);
+		if (t) {
+			double usec = tv.tv_sec * 1e6 + tv.tv_usec;
+
+			if (t->nreceived == 1 || usec < t->tmin)
+				t->tmin = usec;
+			if (usec > t->tmax)
+				t->tmax = usec;
+			t->tsum += usec;
+		}
 		tsum += triptime;
 		if( triptime < tmin )
 			tmin = triptime;
@@ -435,7 +840,7 @@ struct sockaddr_in *from;
 	if(!(pingflags & QUIET)) {
 		if(pingflags != FLOOD) {
 			printf("%d bytes from %s: icmp_seq=%d", cc,
-			  inet_ntoa(from->sin_addr),
+			  t ? t->name : inet_ntoa(from->sin_addr),
 			  icp->icmp_seq );	/* DFM */
 			if (timing) 
 				printf(" time=%d ms\n", triptime );
@@ -510,6 +915,335 @@ register struct timeval *out, *in;
 	out->tv_sec -= in->tv_sec;
 }
 
+/*
+ *			A B _ R E C O R D
+ *
+ * Keep the round-trip time of a probe of stream 0 (plain) or 1 (ASN-FWD).
+ */
+void ab_record(int stream, double usec)
+{
+	if (nrtt[stream] == artt[stream]) {
+		artt[stream] = artt[stream] ? 2 * artt[stream] : 1024;
+		rtt[stream] = realloc(rtt[stream], artt[stream] * sizeof(double));
+		if (!rtt[stream]) {
+			fprintf(stderr, "ping: out of memory\n");
+			exit(2);
+		}
+	}
+	rtt[stream][nrtt[stream]++] = usec;
+}
+
+int dcmp(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* two-sided 95% quantile of Student's t distribution */
+double tcrit(double df)
+{
+	static double t[] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365,
+		2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+		2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060,
+		2.056, 2.052, 2.048, 2.045, 2.042 };
+
+	if (df < 1)
+		df = 1;
+	if (df <= 30)
+		return t[(int) df - 1];
+	if (df <= 40)
+		return 2.021;
+	if (df <= 60)
+		return 2.000;
+	if (df <= 120)
+		return 1.980;
+	return 1.960;
+}
+
+/*
+ *			A B _ R E P O R T
+ *
+ * Print both round-trip time distributions side by side, and the
+ * difference of the means with its 95% confidence interval (Welch's
+ * t-test, the streams need not have the same variance).
+ */
+void ab_report(void)
+{
+	char *name[2] = { "plain", "option" };
+	double mean[2], var[2], se, df, diff, t;
+	int k, i, n;
+
+	if (gateway.sin_addr.s_addr)
+		name[1] = "ipip";
+
+	printf("%-8s %8s %10s %10s %10s %10s %10s (usec)\n",
+	  "stream", "n", "min", "median", "mean", "p99", "max");
+
+	for (k = 0; k < 2; k++) {
+		n = nrtt[k];
+		mean[k] = var[k] = 0;
+		if (n == 0) {
+			printf("%-8s %8d\n", name[k], 0);
+			continue;
+		}
+		qsort(rtt[k], n, sizeof(double), dcmp);
+		for (i = 0; i < n; i++)
+			mean[k] += rtt[k][i];
+		mean[k] /= n;
+		for (i = 0; i < n; i++)
+			var[k] += (rtt[k][i] - mean[k]) * (rtt[k][i] - mean[k]);
+		if (n > 1)
+			var[k] /= n - 1;
+		printf("%-8s %8d %10.1f %10.1f %10.1f %10.1f %10.1f\n", name[k], n,
+		  rtt[k][0], rtt[k][n / 2], mean[k], rtt[k][(int) (n * 0.99)], rtt[k][n - 1]);
+	}
+
+	if (nrtt[0] < 2 || nrtt[1] < 2)
+		return;
+
+	diff = mean[1] - mean[0];
+	se = sqrt(var[0] / nrtt[0] + var[1] / nrtt[1]);
+	if (se == 0) {
+		printf("difference %.1f usec\n", diff);
+		return;
+	}
+	df = pow(se, 4) / (pow(var[0] / nrtt[0], 2) / (nrtt[0] - 1) +
+	                   pow(var[1] / nrtt[1], 2) / (nrtt[1] - 1));
+	t = tcrit(df);
+	printf("difference %.1f usec, 95%% CI [%.1f, %.1f]\n",
+	  diff, diff - t * se, diff + t * se);
+}
+
+/*
+ *			T A R G E T S _ R E A D
+ *
+ * Load the target list of -T, one host or address per line, "#" starts
+ * a comment.
+ */
+void targets_read(char *file)
+{
+	char line[256], *name, *p;
+	struct target *t;
+	FILE *fp;
+	int atargets = 0;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		perror(file);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		name = strtok(line, " \t\r\n");
+		if (!name)
+			continue;
+
+		if (ntargets == atargets) {
+			atargets = atargets ? 2 * atargets : 256;
+			targets = realloc(targets, atargets * sizeof(struct target));
+			if (!targets) {
+				fprintf(stderr, "ping: out of memory\n");
+				exit(2);
+			}
+		}
+		t = &targets[ntargets];
+		bzero(t, sizeof(*t));
+		t->addr.sin_family = AF_INET;
+		t->addr.sin_addr.s_addr = inet_addr(name);
+		if (t->addr.sin_addr.s_addr == (unsigned)-1) {
+			hp = gethostbyname(name);
+			if (!hp || hp->h_addrtype != AF_INET) {
+				fprintf(stderr, "ping: unknown host %s, skipped\n", name);
+				continue;
+			}
+			bcopy(hp->h_addr, (caddr_t)&t->addr.sin_addr, hp->h_length);
+		}
+		t->name = strdup(name);
+		ntargets++;
+	}
+	fclose(fp);
+
+	if (ntargets == 0) {
+		fprintf(stderr, "ping: no target in %s\n", file);
+		exit(1);
+	}
+}
+
+/*
+ *			P R O B E S _ A L L O C
+ *
+ * Size the table of probes in flight for MAXWAIT seconds of sends, a
+ * probe is forgotten when its reply has not come by then.
+ */
+void probes_alloc(void)
+{
+	double inflight = interval > 0 ? MAXWAIT * 1e9 / interval : 100000;
+	u_int size = 1024;
+
+	while (size < 2 * inflight && size < (1 << 22))
+		size <<= 1;
+
+	if ((probes = calloc(size, sizeof(struct probe))) == NULL) {
+		fprintf(stderr, "ping: out of memory\n");
+		exit(2);
+	}
+	pmask = size - 1;
+}
+
+u_int probe_hash(in_addr_t addr, int seq)
+{
+	u_int32_t h = (addr ^ (u_int32_t) seq << 16) * 2654435761U;
+
+	return (h ^ h >> 15) & pmask;
+}
+
+/* remember a probe sent, replacing a slot of a probe timed out */
+void probe_add(int n, int seq)
+{
+	in_addr_t addr = targets[n].addr.sin_addr.s_addr;
+	u_int h = probe_hash(addr, seq);
+	time_t now = time(NULL);
+	struct probe *p = &probes[h], *q;
+	int k;
+
+	for (k = 0; k < PROBE_SCAN; k++) {
+		q = &probes[(h + k) & pmask];
+		if (!q->used || now - q->sent > MAXWAIT) {
+			p = q;
+			break;
+		}
+		/* no free slot near, the oldest neighbour will count as lost */
+		if (q->sent < p->sent)
+			p = q;
+	}
+
+	p->addr = addr;
+	p->seq = seq;
+	p->used = 1;
+	p->target = n;
+	p->sent = now;
+}
+
+/* target of the probe a reply answers, -1 if none; the probe is consumed */
+int probe_match(in_addr_t addr, int seq)
+{
+	u_int h = probe_hash(addr, (u_short) seq);
+	struct probe *p;
+	int k;
+
+	for (k = 0; k < PROBE_SCAN; k++) {
+		p = &probes[(h + k) & pmask];
+		if (p->used && p->addr == addr && p->seq == (u_short) seq) {
+			p->used = 0;
+			return p->target;
+		}
+	}
+	return -1;
+}
+
+/* target of -T an echo reply answers, NULL if it answers no probe */
+struct target *reply_target(struct ip *ip, struct icmp *icp, int cc)
+{
+	int n;
+
+	if ((n = probe_match(ip->ip_src.s_addr, icp->icmp_seq)) < 0) {
+		nunknown++;
+		if (pingflags & VERBOSE)
+			printf("%d bytes from %s: icmp_seq=%d, no probe sent or already answered\n",
+			  cc, inet_ntoa(ip->ip_src), icp->icmp_seq);
+		return NULL;
+	}
+	return &targets[n];
+}
+
+/*
+ *			T A R G E T S _ R E P O R T
+ *
+ * One summary line per target of -T, the unreachable ones first so they
+ * are not lost in a long list.
+ */
+void targets_report(void)
+{
+	struct target *t;
+	int pass, k, down = 0;
+
+	for (pass = 0; pass < 2; pass++) {
+		for (k = 0; k < ntargets; k++) {
+			t = &targets[k];
+			if ((t->nreceived == 0) != (pass == 0))
+				continue;
+			down += t->nreceived == 0;
+			printf("%-20s : xmt/rcv/%%loss = %d/%d/%d%%", t->name,
+			  t->ntransmitted, t->nreceived, t->ntransmitted ?
+			  (t->ntransmitted - t->nreceived) * 100 / t->ntransmitted : 0);
+			if (t->nreceived && timing)
+				printf(", min/avg/max = %.3f/%.3f/%.3f ms",
+				  t->tmin / 1000, t->tsum / t->nreceived / 1000, t->tmax / 1000);
+			putchar('\n');
+		}
+	}
+	printf("%d targets, %d unreachable, %d unmatched replies\n",
+	  ntargets, down, nunknown);
+}
+
+/*
+ *			L O G _ O P E N
+ *
+ * Start the binary result log of -w.  Records go through a large stdio
+ * buffer, so the file is written in big chunks, far less often than
+ * replies arrive.
+ */
+void log_open(char *file)
+{
+	static char buf[1 << 20];
+
+	if ((logfp = fopen(file, "w")) == NULL) {
+		perror(file);
+		exit(1);
+	}
+	setvbuf(logfp, buf, _IOFBF, sizeof(buf));
+
+	loghdr.magic = PINGLOG_MAGIC;
+	loghdr.version = PINGLOG_VERSION;
+	loghdr.recsize = sizeof(struct pinglog_rec);
+	fwrite(&loghdr, sizeof(loghdr), 1, logfp);
+}
+
+void log_reply(struct ip *ip, struct icmp *icp, int cc, struct timeval *sent, struct timeval *recv)
+{
+	struct pinglog_rec rec;
+	u_int32_t seq;
+
+	/* icmp_seq wraps at 65535, the log keeps counting */
+	seq = lastseq + (int16_t) ((u_int16_t) icp->icmp_seq - (u_int16_t) lastseq);
+	if ((int32_t) (seq - lastseq) > 0)
+		lastseq = seq;
+
+	rec.seq = seq;
+	rec.size = cc;
+	rec.ttl = ip->ip_ttl;
+	rec.stream = (pingflags & ABTEST) ? icp->icmp_seq & 1 : 0;
+	rec.source = ip->ip_src.s_addr;
+	rec.reserved = 0;
+	rec.sent = sent->tv_sec * 1000000000LL + sent->tv_usec * 1000LL;
+	rec.received = recv->tv_sec * 1000000000LL + recv->tv_usec * 1000LL;
+
+	fwrite(&rec, sizeof(rec), 1, logfp);
+}
+
+/* the number of probes sent is only known now, rewrite the header */
+void log_close(void)
+{
+	loghdr.target = ((struct sockaddr_in *) &whereto)->sin_addr.s_addr;
+	loghdr.transmitted = ntransmitted;
+	fflush(logfp);
+	fseek(logfp, 0, SEEK_SET);
+	fwrite(&loghdr, sizeof(loghdr), 1, logfp);
+	fclose(logfp);
+}
+
 /*
  *			F I N I S H
  *
@@ -539,6 +1273,19 @@ void finish(int sig)
 		tmin,
 		tsum / nreceived,
 		tmax );
+	if (interval > 0 && ntransmitted > 1) {
+		double secs = (last_sent.tv_sec - first_sent.tv_sec) +
+		  (last_sent.tv_nsec - first_sent.tv_nsec) / 1e9;
+
+		printf("send rate %.1f pps, target %.1f pps, %lld probes sent late\n",
+		  secs > 0 ? (ntransmitted - 1) / secs : 0, 1e9 / interval, late);
+	}
+	if (pingflags & ABTEST)
+		ab_report();
+	if (ntargets)
+		targets_report();
+	if (logfp)
+		log_close();
 	fflush(stdout);
 	exit(0);
 }
@@ -0,0 +1,136 @@
+/*
+ *			P I N G L O G . C
+ *
+ * Offline analysis of the binary result log written by ping -w:
+ * loss and loss bursts, reordering, duplicates and latency percentiles.
+ *
+ * Usage:  pinglog file
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "pinglog.h"
+
+int cmp64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+int cmp32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+/*
+ *			M A I N
+ */
+int main(int argc, char **argv)
+{
+	static double pct[] = { 50, 90, 99, 99.9 };
+	struct pinglog_hdr hdr;
+	struct pinglog_rec rec;
+	struct in_addr target;
+	FILE *f;
+	int64_t *rtt;
+	uint32_t *seq, maxseq = 0;
+	long n = 0, alloc = 0, reordered = 0, dups = 0;
+	long lost, bursts = 0, maxburst = 0, gap, i;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage:  pinglog file\n");
+		exit(1);
+	}
+
+	if ((f = fopen(argv[1], "r")) == NULL) {
+		perror(argv[1]);
+		exit(1);
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != PINGLOG_MAGIC ||
+	    hdr.version != PINGLOG_VERSION || hdr.recsize != sizeof(rec)) {
+		fprintf(stderr, "pinglog: %s: not a ping log\n", argv[1]);
+		exit(1);
+	}
+
+	rtt = NULL;
+	seq = NULL;
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (n == alloc) {
+			alloc = alloc ? 2 * alloc : 65536;
+			rtt = realloc(rtt, alloc * sizeof(*rtt));
+			seq = realloc(seq, alloc * sizeof(*seq));
+			if (!rtt || !seq) {
+				fprintf(stderr, "pinglog: out of memory\n");
+				exit(2);
+			}
+		}
+
+		/* arrived after a later probe */
+		if (n > 0 && rec.seq < maxseq)
+			reordered++;
+		if (rec.seq > maxseq)
+			maxseq = rec.seq;
+
+		rtt[n] = rec.received - rec.sent;
+		seq[n] = rec.seq;
+		n++;
+	}
+	fclose(f);
+
+	target.s_addr = hdr.target;
+	printf("%s: %u probes sent to %s, %ld replies\n", argv[1],
+	  hdr.transmitted, inet_ntoa(target), n);
+
+	if (n == 0)
+		exit(0);
+
+	/* loss bursts are runs of missing sequence numbers */
+	qsort(seq, n, sizeof(*seq), cmp32);
+	for (i = 1; i < n; i++) {
+		if (seq[i] == seq[i - 1]) {
+			dups++;
+			continue;
+		}
+		gap = seq[i] - seq[i - 1] - 1;
+		if (gap > 0) {
+			bursts++;
+			if (gap > maxburst)
+				maxburst = gap;
+		}
+	}
+	/* probes lost at the start and at the end */
+	if (seq[0] > 0) {
+		bursts++;
+		if (seq[0] > maxburst)
+			maxburst = seq[0];
+	}
+	if (hdr.transmitted > seq[n - 1] + 1) {
+		bursts++;
+		if (hdr.transmitted - seq[n - 1] - 1 > maxburst)
+			maxburst = hdr.transmitted - seq[n - 1] - 1;
+	}
+
+	lost = (long) hdr.transmitted - (n - dups);
+	if (lost < 0)
+		lost = 0;
+	printf("lost %ld (%.3f%%) in %ld bursts, longest %ld, mean %.1f\n",
+	  lost, hdr.transmitted ? 100.0 * lost / hdr.transmitted : 0.0,
+	  bursts, maxburst, bursts ? (double) lost / bursts : 0.0);
+	printf("reordered %ld, duplicates %ld\n", reordered, dups);
+
+	qsort(rtt, n, sizeof(*rtt), cmp64);
+	printf("round-trip (usec)  min %.1f", rtt[0] / 1e3);
+	for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+		printf(" p%g %.1f", pct[i], rtt[(long) (n * pct[i] / 100)] / 1e3);
+	printf(" max %.1f\n", rtt[n - 1] / 1e3);
+
+	return 0;
+}
@@ -0,0 +1,30 @@
+/*
+ *			P I N G L O G . H
+ *
+ * Binary result log written by ping -w, read by pinglog.  One header,
+ * then one fixed-size record per reply, in host byte order.
+ */
+
+#include <stdint.h>
+
+#define PINGLOG_MAGIC   0x504c4f47	/* "PLOG" */
+#define PINGLOG_VERSION 1
+
+struct pinglog_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t recsize;	/* sizeof(struct pinglog_rec) */
+	uint32_t target;	/* network byte order */
+	uint32_t transmitted;	/* probes sent, written when ping exits */
+};
+
+struct pinglog_rec {
+	uint32_t seq;		/* icmp_seq, unwrapped past 65535 */
+	uint16_t size;		/* ICMP bytes received */
+	uint8_t  ttl;
+	uint8_t  stream;	/* A/B mode stream, 0 otherwise */
+	uint32_t source;	/* network byte order */
+	uint32_t reserved;
+	int64_t  sent;		/* nsec since the epoch */
+	int64_t  received;
+};
@@ -0,0 +1,499 @@
+/*
+ *			R E P L A Y . C
+ *
+ * Replay a pcap file on an interface through PACKET_TX_RING (TPACKET_V3),
+ * to load the ASN-FWD box with real destination and size distributions.
+ *
+ * The capture is loaded in memory and split among the sender threads,
+ * thread N sending packets N, N + threads, N + 2 * threads, ... on its
+ * own ring, pinned to CPU N. Frames are queued on the ring and the kernel
+ * is kicked with one sendto every batch. Rates are per run and split
+ * evenly among the threads.
+ *
+ * Packets cut by the capture snap length are padded with zeros back to
+ * their original length, so the box sees the real IP total lengths.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#define PCAP_MAGIC       0xa1b2c3d4
+#define PCAP_MAGIC_NSEC  0xa1b23c4d
+#define LINKTYPE_ETHERNET 1
+
+#define FRAME_SIZE  2048
+#define BLOCK_SIZE  (FRAME_SIZE * 32)
+#define BLOCK_NR    64
+#define FRAME_NR    (BLOCK_NR * (BLOCK_SIZE / FRAME_SIZE))
+#define DATA_OFFSET TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+#define MAX_PKT     (FRAME_SIZE - DATA_OFFSET)
+
+struct pcap_file_hdr {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t  thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_pkt_hdr {
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+struct pkt {
+	uint8_t *data;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+struct sender {
+	pthread_t thread;
+	int id;
+	int fd;
+	uint8_t *ring;
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t errors;
+};
+
+struct pkt *pkts;
+size_t npkts;
+uint64_t pkt_bytes;            /* bytes in one pass over the file */
+
+int ifindex;
+int nthreads = 1;
+int batch = 64;
+int loops = 1;                 /* 0 loops forever */
+int qdisc_bypass;
+double pps;                    /* 0 is as fast as possible */
+double mbps;
+int rewrite_mac;
+uint8_t dst_mac[6];
+uint8_t src_mac[6];
+
+struct sender *senders;
+volatile int stop;
+
+static void usage(void)
+{
+	fprintf(stderr,
+	        "Usage:  replay [-Q] [-r pps | -b mbps] [-l loops] [-t threads] [-B batch] [-m dst-mac] -i ifname file.pcap\n"
+	        "  -l  number of passes over the file, 0 loops until interrupted\n"
+	        "  -m  rewrite destination MAC (source MAC becomes the interface one)\n"
+	        "  -Q  bypass the qdisc layer\n");
+	exit(1);
+}
+
+static void sigint(int sig)
+{
+	stop = 1;
+}
+
+static uint32_t swap32(uint32_t v, int swapped)
+{
+	return swapped ? __builtin_bswap32(v) : v;
+}
+
+/*
+ *			L O A D _ P C A P
+ *
+ * Read the whole capture in memory. Only Ethernet captures are handled.
+ */
+static void load_pcap(const char *file)
+{
+	struct pcap_file_hdr fh;
+	struct pcap_pkt_hdr ph;
+	size_t size = 0, skipped = 0;
+	int swapped;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f || fread(&fh, sizeof(fh), 1, f) != 1)
+	{
+		fprintf(stderr, "replay: cannot read %s\n", file);
+		exit(2);
+	}
+
+	if (fh.magic == PCAP_MAGIC || fh.magic == PCAP_MAGIC_NSEC)
+		swapped = 0;
+	else if (__builtin_bswap32(fh.magic) == PCAP_MAGIC || __builtin_bswap32(fh.magic) == PCAP_MAGIC_NSEC)
+		swapped = 1;
+	else
+	{
+		fprintf(stderr, "replay: %s is not a pcap file\n", file);
+		exit(2);
+	}
+
+	if (swap32(fh.linktype, swapped) != LINKTYPE_ETHERNET)
+	{
+		fprintf(stderr, "replay: %s is not an Ethernet capture\n", file);
+		exit(2);
+	}
+
+	while (fread(&ph, sizeof(ph), 1, f) == 1)
+	{
+		struct pkt *p;
+		uint32_t caplen = swap32(ph.caplen, swapped);
+		uint32_t len = swap32(ph.len, swapped);
+
+		if (len < caplen)
+			len = caplen;
+
+		if (len > MAX_PKT || caplen < ETH_HLEN)
+		{
+			skipped++;
+			if (fseek(f, caplen, SEEK_CUR) != 0)
+				break;
+			continue;
+		}
+
+		if (npkts == size)
+		{
+			size = size ? 2 * size : 65536;
+			pkts = realloc(pkts, size * sizeof(*pkts));
+			if (!pkts)
+				exit(2);
+		}
+
+		p = &pkts[npkts];
+		p->caplen = caplen;
+		p->len = len;
+		p->data = malloc(caplen);
+		if (!p->data || fread(p->data, caplen, 1, f) != 1)
+			break;
+
+		if (rewrite_mac)
+		{
+			memcpy(p->data, dst_mac, 6);
+			memcpy(p->data + 6, src_mac, 6);
+		}
+
+		pkt_bytes += len;
+		npkts++;
+	}
+
+	fclose(f);
+
+	if (npkts == 0)
+	{
+		fprintf(stderr, "replay: no packets to send in %s\n", file);
+		exit(2);
+	}
+
+	printf("%zu packets, %llu bytes loaded, %zu skipped\n",
+	       npkts, (unsigned long long) pkt_bytes, skipped);
+}
+
+/*
+ *			O P E N _ R I N G
+ *
+ * Packet socket bound to the interface for sending only, with a
+ * TPACKET_V3 TX ring mapped in.
+ */
+static int open_ring(struct sender *s)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	int version = TPACKET_V3;
+	int one = 1;
+
+	s->fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (s->fd < 0)
+		return -1;
+
+	if (setsockopt(s->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+		return -1;
+
+	if (qdisc_bypass && setsockopt(s->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one)) != 0)
+		return -1;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = BLOCK_SIZE;
+	req.tp_block_nr = BLOCK_NR;
+	req.tp_frame_size = FRAME_SIZE;
+	req.tp_frame_nr = FRAME_NR;
+	if (setsockopt(s->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) != 0)
+		return -1;
+
+	s->ring = mmap(NULL, (size_t) BLOCK_SIZE * BLOCK_NR, PROT_READ | PROT_WRITE,
+	               MAP_SHARED | MAP_LOCKED | MAP_POPULATE, s->fd, 0);
+	if (s->ring == MAP_FAILED)
+		return -1;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = ifindex;
+	sll.sll_protocol = 0; /* TX only */
+	if (bind(s->fd, (struct sockaddr *) &sll, sizeof(sll)) != 0)
+		return -1;
+
+	return 0;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* sleep until @t, the last stretch is spun for precision */
+static void wait_until(uint64_t t)
+{
+	uint64_t now = now_ns();
+
+	if (t > now + 100000)
+	{
+		struct timespec ts;
+		uint64_t wake = t - 50000;
+
+		ts.tv_sec = wake / 1000000000ULL;
+		ts.tv_nsec = wake % 1000000000ULL;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+
+	while (now_ns() < t)
+		;
+}
+
+static void kick(struct sender *s)
+{
+	while (sendto(s->fd, NULL, 0, 0, NULL, 0) < 0 && errno == EINTR)
+		;
+}
+
+/*
+ *			S E N D E R
+ *
+ * Queue this thread's share of the capture on the ring, kicking the
+ * kernel every batch and whenever rate control has to wait.
+ */
+static void *sender(void *arg)
+{
+	struct sender *s = arg;
+	struct pollfd pfd = { .fd = s->fd, .events = POLLOUT };
+	uint64_t start, sent_bytes = 0, sent_pkts = 0;
+	double thread_pps = pps / nthreads;
+	double thread_bps = mbps * 1e6 / 8 / nthreads;
+	unsigned int frame = 0;
+	int queued = 0, loop;
+	cpu_set_t set;
+	size_t i;
+
+	CPU_ZERO(&set);
+	CPU_SET(s->id % CPU_SETSIZE, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+	start = now_ns();
+
+	for (loop = 0; !stop && (loops == 0 || loop < loops); loop++)
+	{
+		for (i = s->id; i < npkts && !stop; i += nthreads)
+		{
+			struct pkt *p = &pkts[i];
+			struct tpacket3_hdr *hdr;
+			uint64_t t = 0;
+
+			if (thread_pps > 0)
+				t = start + (uint64_t) (sent_pkts / thread_pps * 1e9);
+			else if (thread_bps > 0)
+				t = start + (uint64_t) (sent_bytes / thread_bps * 1e9);
+
+			if (t && t > now_ns())
+			{
+				if (queued)
+				{
+					kick(s);
+					queued = 0;
+				}
+				wait_until(t);
+			}
+
+			hdr = (struct tpacket3_hdr *) (s->ring + (size_t) frame * FRAME_SIZE);
+
+			/* ring full, wait for the kernel to give frames back */
+			while (hdr->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+			{
+				if (queued)
+				{
+					kick(s);
+					queued = 0;
+				}
+				poll(&pfd, 1, 10);
+				if (stop)
+					goto end;
+			}
+
+			if (hdr->tp_status & TP_STATUS_WRONG_FORMAT)
+				s->errors++;
+
+			memcpy((uint8_t *) hdr + DATA_OFFSET, p->data, p->caplen);
+			if (p->len > p->caplen)
+				memset((uint8_t *) hdr + DATA_OFFSET + p->caplen, 0, p->len - p->caplen);
+
+			hdr->tp_len = p->len;
+			hdr->tp_snaplen = p->len;
+			hdr->tp_next_offset = 0;
+			__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+
+			frame = (frame + 1) % FRAME_NR;
+			sent_pkts++;
+			sent_bytes += p->len;
+
+			if (++queued >= batch)
+			{
+				kick(s);
+				queued = 0;
+			}
+		}
+	}
+
+end:
+	if (queued)
+		kick(s);
+
+	s->packets = sent_pkts;
+	s->bytes = sent_bytes;
+
+	return NULL;
+}
+
+static int get_mac(const char *ifname, uint8_t *mac)
+{
+	struct ifreq ifr;
+	int fd, err;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	err = ioctl(fd, SIOCGIFHWADDR, &ifr);
+	close(fd);
+	if (err != 0)
+		return -1;
+
+	memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *ifname = NULL;
+	uint64_t start, elapsed, packets = 0, bytes = 0, errors = 0;
+	unsigned int m[6];
+	double secs;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "Qr:b:l:t:B:m:i:")) != -1)
+	{
+		switch (c)
+		{
+		case 'Q':
+			qdisc_bypass = 1;
+			break;
+		case 'r':
+			pps = atof(optarg);
+			break;
+		case 'b':
+			mbps = atof(optarg);
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'B':
+			batch = atoi(optarg);
+			break;
+		case 'm':
+			if (sscanf(optarg, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6)
+				usage();
+			for (i = 0; i < 6; i++)
+				dst_mac[i] = m[i];
+			rewrite_mac = 1;
+			break;
+		case 'i':
+			ifname = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc - 1 || !ifname || nthreads < 1 || batch < 1 || loops < 0 || (pps > 0 && mbps > 0))
+		usage();
+
+	ifindex = if_nametoindex(ifname);
+	if (ifindex == 0 || (rewrite_mac && get_mac(ifname, src_mac) != 0))
+	{
+		fprintf(stderr, "replay: unknown interface %s\n", ifname);
+		exit(1);
+	}
+
+	load_pcap(argv[optind]);
+
+	senders = calloc(nthreads, sizeof(*senders));
+	if (!senders)
+		exit(2);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		senders[i].id = i;
+		if (open_ring(&senders[i]) != 0)
+		{
+			perror("replay: packet ring");
+			exit(3);
+		}
+	}
+
+	signal(SIGINT, sigint);
+
+	start = now_ns();
+
+	for (i = 0; i < nthreads; i++)
+		pthread_create(&senders[i].thread, NULL, sender, &senders[i]);
+
+	for (i = 0; i < nthreads; i++)
+	{
+		pthread_join(senders[i].thread, NULL);
+		packets += senders[i].packets;
+		bytes += senders[i].bytes;
+		errors += senders[i].errors;
+	}
+
+	elapsed = now_ns() - start;
+	secs = elapsed / 1e9;
+
+	printf("%llu packets, %llu bytes sent in %.3f s: %.0f pps, %.2f Mbps, %llu errors\n",
+	       (unsigned long long) packets, (unsigned long long) bytes, secs,
+	       secs > 0 ? packets / secs : 0, secs > 0 ? bytes * 8 / secs / 1e6 : 0,
+	       (unsigned long long) errors);
+
+	return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ *			S A M P L E . C
+ *
+ * Read the packets sampled by the ASN-FWD module from its per-CPU relay
+ * buffers (debugfs asn-fwd/sample<cpu>) and print one sFlow-like line per
+ * record:
+ *
+ *   FLOW,time,cpu,outcome,ifindex,format,gateway,src,dst,proto,tos,ttl,
+ *        sport,dport,length,rate,pool
+ *
+ * src and dst are those of the original packet: the inner header of IPIP
+ * packets, the destination of the ASN-FWD option of OPTIONS packets and
+ * of the shim of SHIM packets.
+ * Sampling is enabled per outcome with, e.g.
+ *
+ *   echo "encap 1000" > /sys/kernel/debug/asn-fwd/sample_rate
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include "../module/asn-fwd-sample.h"
+
+#define ASNFWD_PROTOCOL   254
+#define IPOPT_ASNFWD_TYPE 222
+#define ASNFWD_SHIM_VERSION 1
+#define ASNFWD_SHIM_LEN   8
+#define MAX_CPUS          1024
+
+static const char *outcome_name[ASNFWD_SAMPLE_OUTCOMES] = { "encap", "decap", "drop" };
+static const char *format_name[] = { "IPIP", "OPTIONS", "SHIM" };
+
+static volatile sig_atomic_t stop;
+
+static void catcher(int sig)
+{
+	stop = 1;
+}
+
+/* destination carried by an ASN-FWD option, 0 if none */
+static uint32_t option_dst(const uint8_t *opt, int len)
+{
+	int i = 0;
+
+	while (i < len)
+	{
+		if (opt[i] == IPOPT_EOL)
+			break;
+
+		if (opt[i] == IPOPT_NOP)
+		{
+			i++;
+			continue;
+		}
+
+		if (i + 1 >= len || opt[i + 1] < 2 || i + opt[i + 1] > len)
+			break;
+
+		if (opt[i] == IPOPT_ASNFWD_TYPE && opt[i + 1] >= 6)
+		{
+			uint32_t addr;
+
+			memcpy(&addr, opt + i + 2, sizeof(addr));
+			return addr;
+		}
+
+		i += opt[i + 1];
+	}
+
+	return 0;
+}
+
+static void print_sample(const struct asnfwd_sample *s)
+{
+	const uint8_t *p = s->hdr;
+	int len = s->hdr_len;
+	struct ip ip;
+	uint32_t dst;
+	uint16_t ports[2] = { 0, 0 };
+	char gw[INET_ADDRSTRLEN], src[INET_ADDRSTRLEN], dstbuf[INET_ADDRSTRLEN];
+	int hl, l4;
+
+	if (s->outcome >= ASNFWD_SAMPLE_OUTCOMES || len < (int) sizeof(ip))
+		return;
+
+	memcpy(&ip, p, sizeof(ip));
+	hl = ip.ip_hl << 2;
+
+	/* SHIM: original protocol and destination follow the header */
+	if (ip.ip_p == ASNFWD_PROTOCOL && len >= hl + ASNFWD_SHIM_LEN && p[hl] == ASNFWD_SHIM_VERSION)
+	{
+		ip.ip_p = p[hl + 1];
+		memcpy(&ip.ip_dst, p + hl + 4, sizeof(ip.ip_dst));
+		l4 = hl + ASNFWD_SHIM_LEN;
+	}
+	/* IPIP: report the packet inside, the outer protocol is 4 with std_ipip */
+	else if ((ip.ip_p == ASNFWD_PROTOCOL || (ip.ip_p == IPPROTO_IPIP && s->format == 0)) &&
+	         len >= hl + (int) sizeof(ip))
+	{
+		p += hl;
+		len -= hl;
+		memcpy(&ip, p, sizeof(ip));
+		hl = ip.ip_hl << 2;
+		l4 = hl;
+	}
+	else
+		l4 = hl;
+
+	dst = ip.ip_dst.s_addr;
+	if (hl > (int) sizeof(ip) && len >= hl)
+	{
+		uint32_t odst = option_dst(p + sizeof(ip), hl - sizeof(ip));
+
+		if (odst)
+			dst = odst;
+	}
+
+	if ((ntohs(ip.ip_off) & IP_OFFMASK) == 0 &&
+	    (ip.ip_p == IPPROTO_TCP || ip.ip_p == IPPROTO_UDP) && len >= l4 + 4)
+		memcpy(ports, p + l4, sizeof(ports));
+
+	inet_ntop(AF_INET, &s->gw, gw, sizeof(gw));
+	inet_ntop(AF_INET, &ip.ip_src, src, sizeof(src));
+	inet_ntop(AF_INET, &dst, dstbuf, sizeof(dstbuf));
+
+	printf("FLOW,%llu.%09llu,%u,%s,%u,%s,%s,%s,%s,%u,%u,%u,%u,%u,%u,%u,%llu\n",
+	       (unsigned long long) s->tstamp / 1000000000ULL,
+	       (unsigned long long) s->tstamp % 1000000000ULL,
+	       s->cpu, outcome_name[s->outcome], s->ifindex,
+	       s->format < 3 ? format_name[s->format] : "?",
+	       gw, src, dstbuf, ip.ip_p, ip.ip_tos, ip.ip_ttl,
+	       ntohs(ports[0]), ntohs(ports[1]), s->pkt_len, s->rate,
+	       (unsigned long long) s->pool);
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd pfd[MAX_CPUS];
+	char *dir = "/sys/kernel/debug/asn-fwd";
+	char path[256];
+	struct asnfwd_sample buf[64];
+	long count = 0, printed = 0;
+	int nfd = 0, ncpu, cpu, opt, i;
+
+	while ((opt = getopt(argc, argv, "d:c:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'd':
+			dir = optarg;
+			break;
+		case 'c':
+			count = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: sample [-d debugfs dir] [-c count]\n");
+			return 1;
+		}
+	}
+
+	ncpu = sysconf(_SC_NPROCESSORS_CONF);
+	if (ncpu > MAX_CPUS)
+		ncpu = MAX_CPUS;
+
+	for (cpu = 0; cpu < ncpu; cpu++)
+	{
+		snprintf(path, sizeof(path), "%s/sample%d", dir, cpu);
+
+		pfd[nfd].fd = open(path, O_RDONLY | O_NONBLOCK);
+		if (pfd[nfd].fd < 0)
+		{
+			if (errno != ENOENT)
+				perror(path);
+			continue;
+		}
+
+		pfd[nfd].events = POLLIN;
+		nfd++;
+	}
+
+	if (nfd == 0)
+	{
+		fprintf(stderr, "sample: no relay buffer in %s, is asn-fwd loaded?\n", dir);
+		return 1;
+	}
+
+	signal(SIGINT, catcher);
+	signal(SIGTERM, catcher);
+
+	/* the buffer is a whole number of records, so are the reads */
+	while (!stop && (count == 0 || printed < count))
+	{
+		if (poll(pfd, nfd, 1000) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		for (i = 0; i < nfd; i++)
+		{
+			ssize_t n;
+			int r;
+
+			if (!(pfd[i].revents & POLLIN))
+				continue;
+
+			while ((n = read(pfd[i].fd, buf, sizeof(buf))) > 0)
+			{
+				for (r = 0; r < n / (ssize_t) sizeof(buf[0]); r++)
+				{
+					if (count && printed >= count)
+						break;
+					print_sample(&buf[r]);
+					printed++;
+				}
+			}
+		}
+
+		fflush(stdout);
+	}
+
+	for (i = 0; i < nfd; i++)
+		close(pfd[i].fd);
+
+	return 0;
+}
@@ -0,0 +1,174 @@
+#ifndef _ASN_FWD_XDP_H
+#define _ASN_FWD_XDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <linux/if_xdp.h>
+
+#include "lpm-build.h"
+
+/* wire formats, same values as module/asn-fwd-ipip.h and module/asn-fwd-options.h */
+#define ASNFWD_PROTOCOL       254
+#define IPOPT_ASNFWD_TYPE     222
+#define IPOPT_ASNFWD_LEN      8
+
+#define ASNFWD_FORMAT_IPIP    0
+#define ASNFWD_FORMAT_OPTIONS 1
+
+#define NUM_FRAMES   4096
+#define FRAME_SIZE   2048
+#define RX_RING_SIZE 2048
+#define TX_RING_SIZE 2048
+#define FILL_RING_SIZE NUM_FRAMES
+#define COMP_RING_SIZE NUM_FRAMES
+#define BATCH_SIZE   64
+
+#define PRINTF(...) do { if (cfg.debug) fprintf(stderr, "[ASN-FWD] " __VA_ARGS__); } while (0)
+
+/*
+ * Single producer / single consumer ring shared with the kernel. The
+ * cached indexes avoid touching the shared ones on every operation.
+ */
+struct ring {
+	uint32_t *producer;
+	uint32_t *consumer;
+	uint32_t *flags;
+	void *ring;
+	uint32_t mask;
+	uint32_t size;
+	uint32_t cached_prod;
+	uint32_t cached_cons;
+};
+
+struct xsk {
+	int fd;
+	int queue;
+	void *area;            /* UMEM, NUM_FRAMES frames of FRAME_SIZE bytes */
+	struct ring fill;
+	struct ring comp;
+	struct ring rx;
+	struct ring tx;
+};
+
+struct stats {
+	uint64_t rx;
+	uint64_t tx;
+	uint64_t encap;
+	uint64_t decap;
+	uint64_t skipped;
+	uint64_t drop;
+};
+
+struct worker {
+	pthread_t thread;
+	struct xsk xsk;
+	uint64_t epoch;        /* bumped every loop, see lpm_publish */
+	struct stats stats;
+};
+
+struct config {
+	int ifindex;
+	int queues;
+	unsigned int table;
+	unsigned int format;
+	uint32_t xdp_flags;    /* XDP_FLAGS_SKB_MODE or XDP_FLAGS_DRV_MODE */
+	uint16_t bind_flags;   /* XDP_COPY or XDP_ZEROCOPY */
+	uint8_t src_mac[6];
+	uint8_t dst_mac[6];
+	int affinity;
+	int debug;
+};
+
+extern struct config cfg;
+extern struct lpm *lpm_current;
+extern struct worker *workers;
+extern volatile int stop;
+
+/* ring helpers, see the kernel AF_XDP documentation for the protocol */
+static inline uint32_t ring_prod_free(struct ring *r, uint32_t nb)
+{
+	uint32_t free_entries = r->cached_cons - r->cached_prod;
+
+	if (free_entries >= nb)
+		return free_entries;
+
+	r->cached_cons = __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE) + r->size;
+
+	return r->cached_cons - r->cached_prod;
+}
+
+static inline uint32_t ring_reserve(struct ring *r, uint32_t nb, uint32_t *idx)
+{
+	if (ring_prod_free(r, nb) < nb)
+		return 0;
+
+	*idx = r->cached_prod;
+	r->cached_prod += nb;
+
+	return nb;
+}
+
+static inline void ring_submit(struct ring *r)
+{
+	__atomic_store_n(r->producer, r->cached_prod, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t ring_peek(struct ring *r, uint32_t nb, uint32_t *idx)
+{
+	uint32_t entries = r->cached_prod - r->cached_cons;
+
+	if (entries == 0)
+	{
+		r->cached_prod = __atomic_load_n(r->producer, __ATOMIC_ACQUIRE);
+		entries = r->cached_prod - r->cached_cons;
+	}
+
+	if (entries > nb)
+		entries = nb;
+
+	*idx = r->cached_cons;
+	r->cached_cons += entries;
+
+	return entries;
+}
+
+static inline void ring_release(struct ring *r)
+{
+	__atomic_store_n(r->consumer, r->cached_cons, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t *ring_addr(struct ring *r, uint32_t idx)
+{
+	return &((uint64_t *) r->ring)[idx & r->mask];
+}
+
+static inline struct xdp_desc *ring_desc(struct ring *r, uint32_t idx)
+{
+	return &((struct xdp_desc *) r->ring)[idx & r->mask];
+}
+
+static inline int ring_needs_wakeup(struct ring *r)
+{
+	return *r->flags & XDP_RING_NEED_WAKEUP;
+}
+
+/* xsk.c */
+int xsk_open(struct xsk *xsk, int ifindex, int queue, uint16_t bind_flags);
+void xsk_close(struct xsk *xsk);
+int xdp_prog_load(int queues, int *map_fd);
+int xdp_attach(int ifindex, int prog_fd, uint32_t flags);
+int xsk_map_set(int map_fd, int queue, int xsk_fd);
+
+/* lpm.c */
+struct lpm *lpm_load_table(unsigned int table);
+void *lpm_sync(void *arg);
+
+/* encap.c */
+#define FWD_TX   0
+#define FWD_DROP 1
+
+int asnfwd_process(void *area, uint64_t *addr, uint32_t *len,
+                   const struct lpm *lpm, struct stats *stats);
+
+#endif /* _ASN_FWD_XDP_H */
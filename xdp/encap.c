@@ -0,0 +1,261 @@
+/*
+ * ASN-FWD encapsulation on raw Ethernet frames.
+ *
+ * Same wire formats and decisions as the kernel module hook
+ * (module/asn-fwd-ipip.c and module/asn-fwd-options.c), plus the part of
+ * ip_forward the module leaves to the stack: TTL and next hop MAC.
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+
+#include "asn-fwd-xdp.h"
+
+#define MAX_IPOPTLEN 40
+
+struct __attribute__((packed)) asnfwd_opt {
+	uint8_t type;
+	uint8_t len;
+	uint32_t addr;
+	uint8_t pad1;
+	uint8_t pad2;
+};
+
+static uint16_t ip_csum(const struct iphdr *iph)
+{
+	const uint16_t *w = (const uint16_t *) iph;
+	uint32_t sum = 0;
+	int i;
+
+	for (i = 0; i < iph->ihl * 2; i++)
+		sum += w[i];
+
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += sum >> 16;
+
+	return ~sum;
+}
+
+static int ip_opt_len(const struct iphdr *iph)
+{
+	return iph->ihl * 4 - sizeof(struct iphdr);
+}
+
+/*
+ * Move the first @hlen bytes of the frame by @delta (negative grows the
+ * frame at its front) and update the descriptor.
+ */
+static uint8_t *frame_shift(void *area, uint64_t *addr, uint32_t *len, int hlen, int delta)
+{
+	uint8_t *frame = (uint8_t *) area + *addr;
+
+	memmove(frame + delta, frame, hlen);
+
+	*addr += delta;
+	*len -= delta;
+
+	return frame + delta;
+}
+
+/* same rules as asnfwd_find_option */
+static int asnfwd_find_option(struct iphdr *iph, struct asnfwd_opt **opt)
+{
+	uint8_t *optptr = (uint8_t *) (iph + 1);
+	int optlen = ip_opt_len(iph);
+	int len;
+
+	*opt = NULL;
+
+	while (optlen > 0)
+	{
+		if (*optptr == IPOPT_NOOP || *optptr == IPOPT_END)
+		{
+			optlen--;
+			optptr++;
+			continue;
+		}
+
+		if (optlen < 2)
+			return 0;
+
+		len = optptr[1];
+		if (len < 2 || len > optlen)
+			return 0;
+
+		if (*optptr == IPOPT_ASNFWD_TYPE)
+		{
+			*opt = (struct asnfwd_opt *) optptr;
+			return (*opt)->len != IPOPT_ASNFWD_LEN ? -1 : 0;
+		}
+
+		optlen -= len;
+		optptr += len;
+	}
+
+	return 0;
+}
+
+static void asnfwd_replace_eol(struct iphdr *iph)
+{
+	uint8_t *optptr = (uint8_t *) (iph + 1);
+	int optlen = ip_opt_len(iph);
+
+	while (optlen > 0)
+	{
+		if (*optptr == IPOPT_END)
+			*optptr = IPOPT_NOOP;
+
+		if (*optptr == IPOPT_NOOP)
+		{
+			optlen--;
+			optptr++;
+			continue;
+		}
+
+		/* malformed option, asnfwd_find_option stopped here as well */
+		if (optlen < 2 || optptr[1] < 2)
+			break;
+
+		optlen -= optptr[1];
+		optptr += optptr[1];
+	}
+}
+
+/*
+ *			A S N F W D _ P R O C E S S
+ *
+ * Encapsulate or decapsulate the frame at @addr in place and rewrite its
+ * link layer header for the next hop. Frames grow at their front, into
+ * the XDP headroom of the UMEM frame. Returns FWD_TX or FWD_DROP.
+ */
+int asnfwd_process(void *area, uint64_t *addr, uint32_t *len,
+                   const struct lpm *lpm, struct stats *stats)
+{
+	uint8_t *frame = (uint8_t *) area + *addr;
+	uint32_t headroom = *addr & (FRAME_SIZE - 1);
+	struct ethhdr *eth = (struct ethhdr *) frame;
+	struct iphdr *iph = (struct iphdr *) (eth + 1);
+	struct asnfwd_opt *opt;
+	uint32_t gw;
+	int hlen;
+
+	stats->rx++;
+
+	if (*len < ETH_HLEN + sizeof(struct iphdr) || eth->h_proto != htons(ETH_P_IP))
+		goto drop;
+
+	hlen = iph->ihl * 4;
+	if (iph->version != 4 || hlen < sizeof(struct iphdr) || *len < ETH_HLEN + hlen)
+		goto drop;
+
+	if (cfg.format == ASNFWD_FORMAT_IPIP)
+	{
+		if (iph->protocol == ASNFWD_PROTOCOL)
+		{
+			uint8_t ttl = iph->ttl;
+
+			if (*len < ETH_HLEN + hlen + sizeof(struct iphdr))
+				goto drop;
+
+			/* drop the outer header, the inner one takes its TTL */
+			frame = frame_shift(area, addr, len, ETH_HLEN, hlen);
+			iph = (struct iphdr *) (frame + ETH_HLEN);
+			iph->ttl = ttl;
+
+			stats->decap++;
+		}
+		else if ((gw = lpm_lookup(lpm, iph->daddr)) != 0)
+		{
+			struct iphdr *orig;
+
+			if (headroom < sizeof(struct iphdr))
+				goto drop;
+
+			frame = frame_shift(area, addr, len, ETH_HLEN, -(int) sizeof(struct iphdr));
+			iph = (struct iphdr *) (frame + ETH_HLEN);
+			orig = iph + 1;
+
+			memset(iph, 0, sizeof(*iph));
+			iph->version = 4;
+			iph->ihl = sizeof(struct iphdr) >> 2;
+			iph->tos = orig->tos;
+			iph->tot_len = htons(ntohs(orig->tot_len) + sizeof(struct iphdr));
+			iph->id = orig->id;
+			iph->frag_off = orig->frag_off;
+			iph->ttl = orig->ttl;
+			iph->protocol = ASNFWD_PROTOCOL;
+			iph->saddr = orig->saddr;
+			iph->daddr = gw;
+
+			stats->encap++;
+		}
+		else
+			stats->skipped++;
+	}
+	else
+	{
+		if (asnfwd_find_option(iph, &opt) != 0)
+			goto drop;
+
+		if (opt)
+		{
+			int before = (uint8_t *) opt - frame;
+
+			iph->daddr = opt->addr;
+
+			/* overwrite the option with what comes before it */
+			frame = frame_shift(area, addr, len, before, IPOPT_ASNFWD_LEN);
+			iph = (struct iphdr *) (frame + ETH_HLEN);
+			iph->ihl -= IPOPT_ASNFWD_LEN >> 2;
+			iph->tot_len = htons(ntohs(iph->tot_len) - IPOPT_ASNFWD_LEN);
+
+			stats->decap++;
+		}
+		else if ((gw = lpm_lookup(lpm, iph->daddr)) != 0)
+		{
+			if (headroom < IPOPT_ASNFWD_LEN || MAX_IPOPTLEN - ip_opt_len(iph) < IPOPT_ASNFWD_LEN)
+				goto drop;
+
+			asnfwd_replace_eol(iph);
+
+			frame = frame_shift(area, addr, len, ETH_HLEN + hlen, -IPOPT_ASNFWD_LEN);
+			iph = (struct iphdr *) (frame + ETH_HLEN);
+
+			opt = (struct asnfwd_opt *) ((uint8_t *) iph + hlen);
+			opt->type = IPOPT_ASNFWD_TYPE;
+			opt->len = IPOPT_ASNFWD_LEN;
+			opt->addr = iph->daddr;
+			opt->pad1 = IPOPT_NOOP;
+			opt->pad2 = IPOPT_END;
+
+			iph->ihl += IPOPT_ASNFWD_LEN >> 2;
+			iph->tot_len = htons(ntohs(iph->tot_len) + IPOPT_ASNFWD_LEN);
+			iph->daddr = gw;
+
+			stats->encap++;
+		}
+		else
+			stats->skipped++;
+	}
+
+	/* forward: what ip_forward does after the module hook */
+	if (iph->ttl <= 1)
+		goto drop;
+	iph->ttl--;
+
+	iph->check = 0;
+	iph->check = ip_csum(iph);
+
+	eth = (struct ethhdr *) frame;
+	memcpy(eth->h_dest, cfg.dst_mac, ETH_ALEN);
+	memcpy(eth->h_source, cfg.src_mac, ETH_ALEN);
+
+	stats->tx++;
+	return FWD_TX;
+
+drop:
+	stats->drop++;
+	return FWD_DROP;
+}
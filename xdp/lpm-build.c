@@ -0,0 +1,138 @@
+/*
+ * Prefixes are flattened into sorted disjoint ranges, so a lookup is a
+ * binary search over a compact array. Also built into mktable and into
+ * the lookup benchmark.
+ */
+
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+#include "lpm-build.h"
+
+static uint32_t prefix_end(const struct lpm_prefix *p)
+{
+	return p->addr | (p->len ? (uint32_t) (((uint64_t) 1 << (32 - p->len)) - 1) : 0xffffffff);
+}
+
+/* shorter prefixes first on the same start address, then input order */
+static int prefix_cmp(const void *a, const void *b)
+{
+	const struct lpm_prefix *pa = a, *pb = b;
+
+	if (pa->addr != pb->addr)
+		return pa->addr < pb->addr ? -1 : 1;
+
+	if (pa->len != pb->len)
+		return (int) pa->len - (int) pb->len;
+
+	return pa->seq < pb->seq ? -1 : pa->seq > pb->seq;
+}
+
+static void lpm_emit(struct lpm *lpm, uint64_t start, uint32_t end, uint32_t gw)
+{
+	struct lpm_range *last = lpm->n ? &lpm->r[lpm->n - 1] : NULL;
+
+	if (start > end)
+		return;
+
+	/* merge with the previous range when contiguous and same gateway */
+	if (last && last->gw == gw && (uint64_t) last->end + 1 == start)
+	{
+		last->end = end;
+		return;
+	}
+
+	lpm->r[lpm->n].start = start;
+	lpm->r[lpm->n].end = end;
+	lpm->r[lpm->n].gw = gw;
+	lpm->n++;
+}
+
+/*
+ *			L P M _ B U I L D
+ *
+ * Resolve overlapping prefixes into disjoint ranges, the most specific
+ * prefix winning. Of duplicated prefixes, the one with the lowest seq is
+ * kept. Sorts @p in place.
+ */
+struct lpm *lpm_build(struct lpm_prefix *p, size_t n)
+{
+	struct lpm_prefix *stack[33];
+	struct lpm *lpm;
+	uint64_t cur = 0;
+	size_t i;
+	int top = 0;
+
+	/* each prefix splits at most one enclosing range in two */
+	lpm = malloc(sizeof(*lpm) + (2 * n + 1) * sizeof(struct lpm_range));
+	if (!lpm)
+		return NULL;
+	lpm->n = 0;
+
+	for (i = 0; i < n; i++)
+		p[i].addr &= p[i].len ? ~(uint32_t) 0 << (32 - p[i].len) : 0;
+
+	qsort(p, n, sizeof(*p), prefix_cmp);
+
+	for (i = 0; i < n; i++)
+	{
+		/* duplicated prefix (different metric or TOS), only one is kept */
+		if (i > 0 && p[i].addr == p[i - 1].addr && p[i].len == p[i - 1].len)
+			continue;
+
+		/* close the enclosing prefixes that end before this one */
+		while (top > 0 && prefix_end(stack[top - 1]) < p[i].addr)
+		{
+			top--;
+			lpm_emit(lpm, cur, prefix_end(stack[top]), stack[top]->gw);
+			cur = (uint64_t) prefix_end(stack[top]) + 1;
+		}
+
+		if (top > 0 && p[i].addr > cur)
+			lpm_emit(lpm, cur, p[i].addr - 1, stack[top - 1]->gw);
+
+		cur = p[i].addr;
+		stack[top++] = &p[i];
+	}
+
+	while (top > 0)
+	{
+		top--;
+		lpm_emit(lpm, cur, prefix_end(stack[top]), stack[top]->gw);
+		cur = (uint64_t) prefix_end(stack[top]) + 1;
+	}
+
+	return lpm;
+}
+
+/*
+ *			L P M _ L O O K U P
+ *
+ * Returns the gateway (network order) for @daddr (network order), 0 if
+ * there is no ASN route.
+ */
+uint32_t lpm_lookup(const struct lpm *lpm, uint32_t daddr)
+{
+	uint32_t addr = ntohl(daddr);
+	size_t lo = 0, hi;
+
+	if (!lpm || lpm->n == 0)
+		return 0;
+
+	/* last range starting at or before addr */
+	hi = lpm->n;
+	while (hi - lo > 1)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (lpm->r[mid].start <= addr)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (lpm->r[lo].start <= addr && addr <= lpm->r[lo].end)
+		return lpm->r[lo].gw;
+
+	return 0;
+}
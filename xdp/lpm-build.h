@@ -0,0 +1,35 @@
+#ifndef _LPM_BUILD_H
+#define _LPM_BUILD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Prefix to range flattening and lookup, shared by the AF_XDP data plane,
+ * by mktable, which writes the same layout for the module, and by the
+ * lookup benchmark.
+ */
+
+/* disjoint address ranges, the most specific prefix already resolved */
+struct lpm_range {
+	uint32_t start;        /* host order */
+	uint32_t end;          /* host order, inclusive */
+	uint32_t gw;           /* network order */
+};
+
+struct lpm {
+	size_t n;
+	struct lpm_range r[];
+};
+
+struct lpm_prefix {
+	uint32_t addr;         /* host order */
+	uint8_t len;
+	uint32_t gw;           /* network order, 0 if no ASN */
+	size_t seq;            /* input order, the first of duplicated prefixes is kept */
+};
+
+struct lpm *lpm_build(struct lpm_prefix *p, size_t n);
+uint32_t lpm_lookup(const struct lpm *lpm, uint32_t daddr);
+
+#endif /* _LPM_BUILD_H */
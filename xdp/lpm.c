@@ -0,0 +1,277 @@
+/*
+ * Userspace copy of the ASN-FWD table.
+ *
+ * Prefixes of table 100 are flattened into sorted disjoint ranges by
+ * lpm_build (lpm-build.c), so a lookup (lpm_lookup, same file) is a binary
+ * search over a compact array. A sync thread follows rtnetlink route notifications and
+ * publishes a new copy on changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "asn-fwd-xdp.h"
+
+#define NL_BUFSIZE 65536
+
+/* table and gateway of a route message, 0 if not an ASN route of @table */
+static int route_parse(struct nlmsghdr *nh, unsigned int table, struct lpm_prefix *p)
+{
+	struct rtmsg *rtm = NLMSG_DATA(nh);
+	struct rtattr *rta;
+	unsigned int tb = rtm->rtm_table;
+	int len = RTM_PAYLOAD(nh);
+
+	if (rtm->rtm_family != AF_INET || rtm->rtm_type != RTN_UNICAST)
+		return 0;
+
+	memset(p, 0, sizeof(*p));
+	p->len = rtm->rtm_dst_len;
+
+	for (rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len))
+	{
+		switch (rta->rta_type)
+		{
+		case RTA_TABLE:
+			tb = *(uint32_t *) RTA_DATA(rta);
+			break;
+		case RTA_DST:
+			p->addr = ntohl(*(uint32_t *) RTA_DATA(rta));
+			break;
+		case RTA_GATEWAY:
+			p->gw = *(uint32_t *) RTA_DATA(rta);
+			break;
+		case RTA_MULTIPATH:
+			/* same as the module, the first next hop is the ASN */
+			if (!p->gw)
+			{
+				struct rtnexthop *nh = RTA_DATA(rta);
+				struct rtattr *a = RTNH_DATA(nh);
+				int alen = nh->rtnh_len - sizeof(*nh);
+
+				for ( ; RTA_OK(a, alen); a = RTA_NEXT(a, alen))
+				{
+					if (a->rta_type == RTA_GATEWAY)
+						p->gw = *(uint32_t *) RTA_DATA(a);
+				}
+			}
+			break;
+		}
+	}
+
+	return tb == table && p->gw != 0;
+}
+
+/*
+ *			L P M _ L O A D _ T A B L E
+ *
+ * Dump the IPv4 routes through rtnetlink and build a copy of @table.
+ */
+struct lpm *lpm_load_table(unsigned int table)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct rtmsg rtm;
+	} req;
+	struct lpm_prefix *p = NULL;
+	size_t n = 0, size = 0;
+	struct lpm *lpm = NULL;
+	char *buf;
+	int fd, len, done = 0;
+
+	buf = malloc(NL_BUFSIZE);
+	if (!buf)
+		return NULL;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		goto end;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = sizeof(req);
+	req.nh.nlmsg_type = RTM_GETROUTE;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nh.nlmsg_seq = 1;
+	req.rtm.rtm_family = AF_INET;
+
+	if (send(fd, &req, sizeof(req), 0) < 0)
+		goto end;
+
+	while (!done)
+	{
+		struct nlmsghdr *nh;
+
+		len = recv(fd, buf, NL_BUFSIZE, 0);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			goto end;
+		}
+
+		for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+		{
+			if (nh->nlmsg_type == NLMSG_DONE)
+			{
+				done = 1;
+				break;
+			}
+			if (nh->nlmsg_type == NLMSG_ERROR)
+				goto end;
+			if (nh->nlmsg_type != RTM_NEWROUTE)
+				continue;
+
+			if (n == size)
+			{
+				struct lpm_prefix *np;
+
+				size = size ? 2 * size : 1024;
+				np = realloc(p, size * sizeof(*p));
+				if (!np)
+					goto end;
+				p = np;
+			}
+
+			if (route_parse(nh, table, &p[n]))
+			{
+				p[n].seq = n;
+				n++;
+			}
+		}
+	}
+
+	lpm = lpm_build(p, n);
+
+end:
+	if (fd >= 0)
+		close(fd);
+	free(p);
+	free(buf);
+	return lpm;
+}
+
+/*
+ * Swap in @lpm and free the previous copy once every worker went through
+ * a new loop iteration, i.e. none of them can still be using it.
+ */
+static void lpm_publish(struct lpm *lpm)
+{
+	uint64_t *seen;
+	struct lpm *old;
+	int i;
+
+	old = __atomic_exchange_n(&lpm_current, lpm, __ATOMIC_ACQ_REL);
+
+	/*
+	 * Pairs with the fence of the workers between their epoch store and
+	 * their load of lpm_current: an epoch sampled below that is not the
+	 * new one belongs to an iteration that will see the new table.
+	 */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	seen = calloc(cfg.queues, sizeof(*seen));
+	if (!seen)
+		return; /* leak the old copy rather than free it under a reader */
+
+	for (i = 0; i < cfg.queues; i++)
+		seen[i] = __atomic_load_n(&workers[i].epoch, __ATOMIC_ACQUIRE);
+
+	for (i = 0; i < cfg.queues && !stop; )
+	{
+		if (__atomic_load_n(&workers[i].epoch, __ATOMIC_ACQUIRE) != seen[i])
+			i++;
+		else
+			usleep(1000);
+	}
+
+	/* on shutdown a worker may still be in its last batch */
+	if (i == cfg.queues)
+		free(old);
+
+	free(seen);
+}
+
+/*
+ *			L P M _ S Y N C
+ *
+ * Thread following route changes. Notifications are coalesced for 100ms
+ * before the table is dumped again, so a burst of updates from the
+ * control plane costs one rebuild.
+ */
+void *lpm_sync(void *arg)
+{
+	struct sockaddr_nl snl;
+	struct pollfd pfd;
+	char *buf;
+	int dirty = 0;
+
+	buf = malloc(NL_BUFSIZE);
+	if (!buf)
+		return NULL;
+
+	pfd.fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	pfd.events = POLLIN;
+	if (pfd.fd < 0)
+	{
+		perror("asn-fwd-xdp: netlink");
+		free(buf);
+		return NULL;
+	}
+
+	memset(&snl, 0, sizeof(snl));
+	snl.nl_family = AF_NETLINK;
+	snl.nl_groups = RTMGRP_IPV4_ROUTE;
+	if (bind(pfd.fd, (struct sockaddr *) &snl, sizeof(snl)) != 0)
+	{
+		perror("asn-fwd-xdp: netlink bind");
+		goto end;
+	}
+
+	while (!stop)
+	{
+		int ret = poll(&pfd, 1, 100);
+
+		if (ret > 0)
+		{
+			struct nlmsghdr *nh;
+			int len = recv(pfd.fd, buf, NL_BUFSIZE, MSG_DONTWAIT);
+
+			/* ENOBUFS means notifications were lost, resync anyway */
+			if (len < 0 && errno == ENOBUFS)
+				dirty = 1;
+
+			for (nh = (struct nlmsghdr *) buf; len > 0 && NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+			{
+				struct lpm_prefix p;
+
+				if ((nh->nlmsg_type == RTM_NEWROUTE || nh->nlmsg_type == RTM_DELROUTE) &&
+				    route_parse(nh, cfg.table, &p))
+					dirty = 1;
+			}
+		}
+		else if (ret == 0 && dirty)
+		{
+			struct lpm *lpm = lpm_load_table(cfg.table);
+
+			if (lpm)
+			{
+				PRINTF("Table %u reloaded, %zu ranges\n", cfg.table, lpm->n);
+				lpm_publish(lpm);
+				dirty = 0;
+			}
+		}
+	}
+
+end:
+	close(pfd.fd);
+	free(buf);
+	return NULL;
+}
@@ -0,0 +1,362 @@
+/*
+ *			A S N - F W D - X D P
+ *
+ * Userspace ASN-FWD data plane over AF_XDP sockets.
+ *
+ * One worker thread per RX queue, each with its own UMEM. Frames are
+ * forwarded in place: RX descriptors go straight to the TX ring of the
+ * same socket, completed frames go back to the fill ring, and dropped
+ * frames go back to the fill ring right away. The ASN table is a
+ * userspace copy of the routing table given with -t, kept in sync by
+ * lpm_sync.
+ *
+ * The box is assumed to be dedicated to forwarding: every IPv4 frame
+ * received on the interface is sent back out to the next hop given with
+ * -m. Non IPv4 traffic (ARP, ...) still goes to the kernel.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <linux/if_link.h>
+
+#include "asn-fwd-xdp.h"
+
+struct config cfg = {
+	.queues = 1,
+	.table = 100,
+	.format = ASNFWD_FORMAT_IPIP,
+	.xdp_flags = XDP_FLAGS_DRV_MODE,
+	.bind_flags = XDP_COPY,
+};
+
+struct lpm *lpm_current;
+struct worker *workers;
+volatile int stop;
+
+static void usage(void)
+{
+	fprintf(stderr,
+	        "Usage:  asn-fwd-xdp [-Szavd] [-q queues] [-t table] [-f format] -m nexthop-mac ifname\n"
+	        "  -S  XDP generic/SKB mode (veth, drivers without XDP)\n"
+	        "  -z  zero-copy, default is copy mode\n"
+	        "  -a  pin worker N to CPU N\n"
+	        "  -f  header format: 0 - IPIP, 1 - OPTIONS\n"
+	        "  -v  print counters every second\n"
+	        "  -d  debug\n");
+	exit(1);
+}
+
+static int parse_mac(const char *s, uint8_t *mac)
+{
+	unsigned int m[6];
+	int i;
+
+	if (sscanf(s, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6)
+		return -1;
+
+	for (i = 0; i < 6; i++)
+		mac[i] = m[i];
+
+	return 0;
+}
+
+static int get_mac(const char *ifname, uint8_t *mac)
+{
+	struct ifreq ifr;
+	int fd, err;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return -1;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, ifname, IFNAMSIZ - 1);
+	err = ioctl(fd, SIOCGIFHWADDR, &ifr);
+	close(fd);
+	if (err != 0)
+		return -1;
+
+	memcpy(mac, ifr.ifr_hwaddr.sa_data, 6);
+	return 0;
+}
+
+static void sigint(int sig)
+{
+	stop = 1;
+}
+
+/* completed TX frames are free again, hand them back to the kernel */
+static void recycle_tx(struct xsk *xsk)
+{
+	uint32_t idx_cq, idx_fq = 0, n, i;
+
+	n = ring_peek(&xsk->comp, BATCH_SIZE, &idx_cq);
+	if (n == 0)
+		return;
+
+	/* cannot fail, the fill ring holds every frame of the UMEM */
+	ring_reserve(&xsk->fill, n, &idx_fq);
+	for (i = 0; i < n; i++)
+		*ring_addr(&xsk->fill, idx_fq + i) = *ring_addr(&xsk->comp, idx_cq + i);
+
+	ring_submit(&xsk->fill);
+	ring_release(&xsk->comp);
+}
+
+/*
+ *			W O R K E R
+ *
+ * Batched loop over one RX queue.
+ */
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	struct xsk *xsk = &w->xsk;
+	struct pollfd pfd = { .fd = xsk->fd, .events = POLLIN };
+	struct xdp_desc tx[BATCH_SIZE];
+	uint64_t drop[BATCH_SIZE];
+
+	if (cfg.affinity)
+	{
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(xsk->queue, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+	while (!stop)
+	{
+		const struct lpm *lpm;
+		uint32_t idx_rx, idx = 0, rcvd, ntx = 0, ndrop = 0, i;
+
+		__atomic_store_n(&w->epoch, w->epoch + 1, __ATOMIC_RELEASE);
+
+		recycle_tx(xsk);
+
+		rcvd = ring_peek(&xsk->rx, BATCH_SIZE, &idx_rx);
+		if (rcvd == 0)
+		{
+			/* nothing to do, sleep until the kernel has frames for us */
+			if (ring_needs_wakeup(&xsk->fill))
+				poll(&pfd, 1, 100);
+			continue;
+		}
+
+		/* the epoch store must be visible before the table is read, see lpm_publish */
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		lpm = __atomic_load_n(&lpm_current, __ATOMIC_ACQUIRE);
+
+		for (i = 0; i < rcvd; i++)
+		{
+			struct xdp_desc *desc = ring_desc(&xsk->rx, idx_rx + i);
+			uint64_t addr = desc->addr;
+			uint32_t len = desc->len;
+
+			if (asnfwd_process(xsk->area, &addr, &len, lpm, &w->stats) == FWD_TX)
+			{
+				tx[ntx].addr = addr;
+				tx[ntx].len = len;
+				tx[ntx].options = 0;
+				ntx++;
+			}
+			else
+				drop[ndrop++] = addr;
+		}
+
+		ring_release(&xsk->rx);
+
+		/* TX ring full, these frames are dropped as well */
+		while (ntx > 0 && ring_reserve(&xsk->tx, ntx, &idx) == 0)
+		{
+			drop[ndrop++] = tx[--ntx].addr;
+			w->stats.tx--;
+			w->stats.drop++;
+		}
+
+		if (ntx > 0)
+		{
+			for (i = 0; i < ntx; i++)
+				*ring_desc(&xsk->tx, idx + i) = tx[i];
+			ring_submit(&xsk->tx);
+
+			if (ring_needs_wakeup(&xsk->tx))
+				sendto(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+		}
+
+		if (ndrop > 0)
+		{
+			ring_reserve(&xsk->fill, ndrop, &idx);
+			for (i = 0; i < ndrop; i++)
+				*ring_addr(&xsk->fill, idx + i) = drop[i] & ~(uint64_t) (FRAME_SIZE - 1);
+			ring_submit(&xsk->fill);
+		}
+	}
+
+	return NULL;
+}
+
+static void print_stats(FILE *f)
+{
+	struct stats sum;
+	int i;
+
+	memset(&sum, 0, sizeof(sum));
+	for (i = 0; i < cfg.queues; i++)
+	{
+		sum.rx += workers[i].stats.rx;
+		sum.tx += workers[i].stats.tx;
+		sum.encap += workers[i].stats.encap;
+		sum.decap += workers[i].stats.decap;
+		sum.skipped += workers[i].stats.skipped;
+		sum.drop += workers[i].stats.drop;
+	}
+
+	fprintf(f, "rx %llu tx %llu encap %llu decap %llu skipped %llu drop %llu\n",
+	        (unsigned long long) sum.rx, (unsigned long long) sum.tx,
+	        (unsigned long long) sum.encap, (unsigned long long) sum.decap,
+	        (unsigned long long) sum.skipped, (unsigned long long) sum.drop);
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit rlim = { RLIM_INFINITY, RLIM_INFINITY };
+	pthread_t sync;
+	int have_mac = 0, verbose = 0;
+	int prog_fd, map_fd, err, c, i;
+
+	while ((c = getopt(argc, argv, "Szavdq:t:f:m:")) != -1)
+	{
+		switch (c)
+		{
+		case 'S':
+			cfg.xdp_flags = XDP_FLAGS_SKB_MODE;
+			break;
+		case 'z':
+			cfg.bind_flags = XDP_ZEROCOPY;
+			break;
+		case 'a':
+			cfg.affinity = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'd':
+			cfg.debug = 1;
+			break;
+		case 'q':
+			cfg.queues = atoi(optarg);
+			break;
+		case 't':
+			cfg.table = atoi(optarg);
+			break;
+		case 'f':
+			cfg.format = atoi(optarg);
+			break;
+		case 'm':
+			if (parse_mac(optarg, cfg.dst_mac) != 0)
+				usage();
+			have_mac = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if (optind != argc - 1 || !have_mac || cfg.queues < 1 ||
+	    (cfg.format != ASNFWD_FORMAT_IPIP && cfg.format != ASNFWD_FORMAT_OPTIONS))
+		usage();
+
+	cfg.ifindex = if_nametoindex(argv[optind]);
+	if (cfg.ifindex == 0 || get_mac(argv[optind], cfg.src_mac) != 0)
+	{
+		fprintf(stderr, "asn-fwd-xdp: unknown interface %s\n", argv[optind]);
+		exit(1);
+	}
+
+	/* older kernels account the UMEM as locked memory */
+	setrlimit(RLIMIT_MEMLOCK, &rlim);
+
+	lpm_current = lpm_load_table(cfg.table);
+	if (!lpm_current)
+	{
+		fprintf(stderr, "asn-fwd-xdp: cannot load table %u\n", cfg.table);
+		exit(2);
+	}
+
+	workers = calloc(cfg.queues, sizeof(*workers));
+	if (!workers)
+		exit(2);
+
+	prog_fd = xdp_prog_load(cfg.queues, &map_fd);
+	if (prog_fd < 0)
+	{
+		fprintf(stderr, "asn-fwd-xdp: XDP program: %s\n", strerror(-prog_fd));
+		exit(3);
+	}
+
+	err = xdp_attach(cfg.ifindex, prog_fd, cfg.xdp_flags);
+	if (err != 0)
+	{
+		fprintf(stderr, "asn-fwd-xdp: XDP attach: %s\n", strerror(-err));
+		exit(3);
+	}
+
+	signal(SIGINT, sigint);
+	signal(SIGTERM, sigint);
+
+	for (i = 0; i < cfg.queues; i++)
+	{
+		err = xsk_open(&workers[i].xsk, cfg.ifindex, i, cfg.bind_flags);
+		if (err == 0)
+			err = xsk_map_set(map_fd, i, workers[i].xsk.fd);
+		if (err != 0)
+		{
+			fprintf(stderr, "asn-fwd-xdp: queue %d: %s\n", i, strerror(-err));
+			stop = 1;
+			cfg.queues = i;
+			break;
+		}
+	}
+
+	for (i = 0; i < cfg.queues; i++)
+		pthread_create(&workers[i].thread, NULL, worker, &workers[i]);
+	pthread_create(&sync, NULL, lpm_sync, NULL);
+
+	printf("ASN-FWD on %s, %d queue(s), table = %u, format = %s, %s mode, %zu ranges\n",
+	       argv[optind], cfg.queues, cfg.table,
+	       cfg.format == ASNFWD_FORMAT_IPIP ? "IPIP" : "OPTIONS",
+	       cfg.xdp_flags == XDP_FLAGS_SKB_MODE ? "skb" : "driver",
+	       lpm_current->n);
+
+	while (!stop)
+	{
+		sleep(1);
+		if (verbose)
+			print_stats(stdout);
+	}
+
+	for (i = 0; i < cfg.queues; i++)
+		pthread_join(workers[i].thread, NULL);
+	pthread_join(sync, NULL);
+
+	xdp_attach(cfg.ifindex, -1, cfg.xdp_flags);
+
+	for (i = 0; i < cfg.queues; i++)
+		xsk_close(&workers[i].xsk);
+
+	print_stats(stdout);
+
+	return err != 0;
+}
@@ -0,0 +1,299 @@
+/*
+ * AF_XDP sockets and the XDP program redirecting to them.
+ *
+ * Built on the raw uapi only (no libbpf/libxdp), so the data plane can be
+ * compiled on the forwarding boxes as they are.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "asn-fwd-xdp.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+#define INSN(CODE, DST, SRC, OFF, IMM) \
+	((struct bpf_insn) { .code = (CODE), .dst_reg = (DST), .src_reg = (SRC), .off = (OFF), .imm = (IMM) })
+
+static int sys_bpf(int cmd, union bpf_attr *attr)
+{
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static void *ring_mmap(int fd, struct ring *r, const struct xdp_ring_offset *off,
+                       uint32_t size, size_t entry, off_t pgoff)
+{
+	void *map;
+
+	map = mmap(NULL, off->desc + size * entry, PROT_READ | PROT_WRITE,
+	           MAP_SHARED | MAP_POPULATE, fd, pgoff);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	r->producer = map + off->producer;
+	r->consumer = map + off->consumer;
+	r->flags = map + off->flags;
+	r->ring = map + off->desc;
+	r->mask = size - 1;
+	r->size = size;
+
+	return map;
+}
+
+/*
+ *			X S K _ O P E N
+ *
+ * Create an AF_XDP socket with its own UMEM for one RX queue. Every frame
+ * starts on the fill ring, see the worker loop for how they circulate.
+ */
+int xsk_open(struct xsk *xsk, int ifindex, int queue, uint16_t bind_flags)
+{
+	struct xdp_umem_reg reg;
+	struct xdp_mmap_offsets off;
+	struct sockaddr_xdp sxdp;
+	socklen_t optlen = sizeof(off);
+	int size;
+	uint32_t idx = 0, i;
+
+	memset(xsk, 0, sizeof(*xsk));
+	xsk->queue = queue;
+
+	xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+	if (xsk->fd < 0)
+		return -errno;
+
+	xsk->area = mmap(NULL, (size_t) NUM_FRAMES * FRAME_SIZE, PROT_READ | PROT_WRITE,
+	                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if (xsk->area == MAP_FAILED)
+		goto err;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.addr = (uintptr_t) xsk->area;
+	reg.len = (uint64_t) NUM_FRAMES * FRAME_SIZE;
+	reg.chunk_size = FRAME_SIZE;
+	reg.headroom = 0;
+	if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0)
+		goto err;
+
+	size = FILL_RING_SIZE;
+	if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) != 0)
+		goto err;
+	size = COMP_RING_SIZE;
+	if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof(size)) != 0)
+		goto err;
+	size = RX_RING_SIZE;
+	if (setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) != 0)
+		goto err;
+	size = TX_RING_SIZE;
+	if (setsockopt(xsk->fd, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) != 0)
+		goto err;
+
+	if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0)
+		goto err;
+
+	if (!ring_mmap(xsk->fd, &xsk->fill, &off.fr, FILL_RING_SIZE, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+	    !ring_mmap(xsk->fd, &xsk->comp, &off.cr, COMP_RING_SIZE, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) ||
+	    !ring_mmap(xsk->fd, &xsk->rx, &off.rx, RX_RING_SIZE, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+	    !ring_mmap(xsk->fd, &xsk->tx, &off.tx, TX_RING_SIZE, sizeof(struct xdp_desc), XDP_PGOFF_TX_RING))
+		goto err;
+
+	/* producer rings start empty, i.e. with all their entries free */
+	xsk->fill.cached_cons = FILL_RING_SIZE;
+	xsk->tx.cached_cons = TX_RING_SIZE;
+
+	ring_reserve(&xsk->fill, NUM_FRAMES, &idx);
+	for (i = 0; i < NUM_FRAMES; i++)
+		*ring_addr(&xsk->fill, idx + i) = (uint64_t) i * FRAME_SIZE;
+	ring_submit(&xsk->fill);
+
+	memset(&sxdp, 0, sizeof(sxdp));
+	sxdp.sxdp_family = AF_XDP;
+	sxdp.sxdp_ifindex = ifindex;
+	sxdp.sxdp_queue_id = queue;
+	sxdp.sxdp_flags = bind_flags | XDP_USE_NEED_WAKEUP;
+	if (bind(xsk->fd, (struct sockaddr *) &sxdp, sizeof(sxdp)) != 0)
+		goto err;
+
+	return 0;
+
+err:
+	i = errno;
+	xsk_close(xsk);
+	return -i;
+}
+
+void xsk_close(struct xsk *xsk)
+{
+	/* the ring mappings go away with the socket */
+	if (xsk->fd >= 0)
+		close(xsk->fd);
+	if (xsk->area && xsk->area != MAP_FAILED)
+		munmap(xsk->area, (size_t) NUM_FRAMES * FRAME_SIZE);
+
+	xsk->fd = -1;
+	xsk->area = NULL;
+}
+
+/*
+ *			X D P _ P R O G _ L O A D
+ *
+ * Load the XDP program: IPv4 frames are redirected to the AF_XDP socket
+ * of their RX queue, everything else (ARP, ...) goes on to the kernel.
+ * Queues without a socket fall back to XDP_PASS as well.
+ */
+int xdp_prog_load(int queues, int *map_fd)
+{
+	static char license[] = "GPL";
+	struct bpf_insn prog[15];
+	union bpf_attr attr;
+	int fd, n = 0;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_XSKMAP;
+	attr.key_size = sizeof(uint32_t);
+	attr.value_size = sizeof(uint32_t);
+	attr.max_entries = queues;
+	*map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (*map_fd < 0)
+		return -errno;
+
+	/* r2 = ctx->data, r3 = ctx->data_end */
+	prog[n++] = INSN(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0);
+	prog[n++] = INSN(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0);
+	/* if (data + ETH_HLEN > data_end) goto pass */
+	prog[n++] = INSN(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0);
+	prog[n++] = INSN(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, ETH_HLEN);
+	prog[n++] = INSN(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 8, 0);
+	/* if (eth->h_proto != htons(ETH_P_IP)) goto pass */
+	prog[n++] = INSN(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2, offsetof(struct ethhdr, h_proto), 0);
+	prog[n++] = INSN(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_4, 0, 6, htons(ETH_P_IP));
+	/* return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS) */
+	prog[n++] = INSN(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, rx_queue_index), 0);
+	prog[n++] = INSN(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, *map_fd);
+	prog[n++] = INSN(0, 0, 0, 0, 0);
+	prog[n++] = INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS);
+	prog[n++] = INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map);
+	prog[n++] = INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+	/* pass: return XDP_PASS */
+	prog[n++] = INSN(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS);
+	prog[n++] = INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uintptr_t) prog;
+	attr.insn_cnt = n;
+	attr.license = (uintptr_t) license;
+	fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0)
+	{
+		fd = -errno;
+		close(*map_fd);
+	}
+
+	return fd;
+}
+
+int xsk_map_set(int map_fd, int queue, int xsk_fd)
+{
+	union bpf_attr attr;
+	uint32_t key = queue;
+	uint32_t value = xsk_fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = (uintptr_t) &key;
+	attr.value = (uintptr_t) &value;
+	attr.flags = BPF_ANY;
+
+	return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) == 0 ? 0 : -errno;
+}
+
+static struct rtattr *rta_add(struct nlmsghdr *nh, int type, const void *data, int len)
+{
+	struct rtattr *rta = (struct rtattr *) ((char *) nh + NLMSG_ALIGN(nh->nlmsg_len));
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	if (len)
+		memcpy(RTA_DATA(rta), data, len);
+	nh->nlmsg_len = NLMSG_ALIGN(nh->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+
+	return rta;
+}
+
+/*
+ *			X D P _ A T T A C H
+ *
+ * Attach (prog_fd >= 0) or detach (prog_fd = -1) the XDP program through
+ * rtnetlink. @flags selects generic/SKB or driver mode.
+ */
+int xdp_attach(int ifindex, int prog_fd, uint32_t flags)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifinfomsg ifi;
+		char attrs[64];
+	} req;
+	char buf[512];
+	struct nlmsghdr *nh;
+	struct rtattr *xdp;
+	int fd, len, err = 0;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return -errno;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.nh.nlmsg_type = RTM_SETLINK;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req.ifi.ifi_family = AF_UNSPEC;
+	req.ifi.ifi_index = ifindex;
+
+	xdp = rta_add(&req.nh, IFLA_XDP | NLA_F_NESTED, NULL, 0);
+	rta_add(&req.nh, IFLA_XDP_FD, &prog_fd, sizeof(prog_fd));
+	if (flags)
+		rta_add(&req.nh, IFLA_XDP_FLAGS, &flags, sizeof(flags));
+	xdp->rta_len = (char *) &req + req.nh.nlmsg_len - (char *) xdp;
+
+	if (send(fd, &req, req.nh.nlmsg_len, 0) < 0)
+	{
+		err = -errno;
+		goto end;
+	}
+
+	len = recv(fd, buf, sizeof(buf), 0);
+	if (len < 0)
+	{
+		err = -errno;
+		goto end;
+	}
+
+	for (nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+	{
+		if (nh->nlmsg_type == NLMSG_ERROR)
+			err = ((struct nlmsgerr *) NLMSG_DATA(nh))->error;
+	}
+
+end:
+	close(fd);
+	return err;
+}